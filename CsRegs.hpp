@@ -801,7 +801,29 @@ namespace WdRiscv
     /// trigger. Return true on success and false if trigger is out of
     /// bounds.
     bool pokeTrigger(URV trigger, URV data1, URV data2, URV data3)
-    { return triggers_.poke(trigger, data1, data2, data3); }
+    {
+      if (not triggers_.poke(trigger, data1, data2, data3))
+	return false;
+      // Update cached values.
+      hasActiveTrigger_ = triggers_.hasActiveTrigger();
+      hasActiveInstTrigger_ = triggers_.hasActiveInstTrigger();
+      return true;
+    }
+
+    /// Copy the state of all the debug triggers into the given
+    /// object (see restoreTriggers).
+    void saveTriggers(Triggers<URV>& copy) const
+    { copy = triggers_; }
+
+    /// Restore the state of all the debug triggers from the given
+    /// object (see saveTriggers).
+    void restoreTriggers(const Triggers<URV>& copy)
+    {
+      triggers_ = copy;
+      // Update cached values.
+      hasActiveTrigger_ = triggers_.hasActiveTrigger();
+      hasActiveInstTrigger_ = triggers_.hasActiveInstTrigger();
+    }
 
     /// Return true if any of the load (store if isLoad is true)
     /// triggers trips. A load/store trigger trips if it matches the
@@ -877,6 +899,15 @@ namespace WdRiscv
     bool hasEnterDebugModeTripped() const
     { return triggers_.hasEnterDebugModeTripped(); }
 
+    /// Enable/disable the start-trace and stop-trace trigger actions.
+    void enableTriggerTraceActions(bool flag)
+    { triggers_.enableTraceActions(flag); }
+
+    /// Return false if tracing was turned off by a stop-trace trigger
+    /// action (or was never turned on by a start-trace action).
+    bool isTriggerTraceOn() const
+    { return triggers_.isTraceOn(); }
+
     /// Set value to the value of the given register returning true on
     /// success and false if number is out of bound.
     bool peek(CsrNumber number, URV& value) const;
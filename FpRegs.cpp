@@ -30,19 +30,17 @@ FpRegs<FRV>::FpRegs(unsigned regCount)
 
   for (unsigned ix = 0; ix < 32; ++ix)
     {
-      std::string name = "f" + std::to_string(ix);
+      std::string name = staticRegName(ix);
       nameToNumber_[name] = FpRegNumber(ix);
       numberToName_[ix] = name;
     }
 
-  numberToAbiName_ = { "ft0", "ft1", "ft2", "ft3", "ft4", "ft5", "ft6", "ft7",
-		       "fs0", "fs1", "fa0", "fa1", "fa2", "fa3", "fa4", "fa5",
-		       "fa6", "fa7", "fs2", "fs3", "fs4", "fs5", "fs6", "fs7",
-		       "fs8", "fs9", "fs10", "fs11", "ft8", "ft9", "ft0", "ft11" };
+  numberToAbiName_.resize(32);
 
   for (unsigned ix = 0; ix < 32; ++ix)
     {
-      std::string abiName = numberToAbiName_.at(ix);
+      std::string abiName = staticRegName(ix, true);
+      numberToAbiName_[ix] = abiName;
       nameToNumber_[abiName] = FpRegNumber(ix);
     }
 }
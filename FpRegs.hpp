@@ -236,6 +236,26 @@ namespace WdRiscv
     /// 2. If name is "fa0" then ix will be set to 10.
     bool findReg(const std::string& name, unsigned& ix) const;
 
+    /// Return the name of the given register as a string with
+    /// static storage (no allocation).
+    static const char* staticRegName(unsigned i, bool abiNames = false)
+    {
+      static const char* names[] = {
+	"f0",  "f1",  "f2",  "f3",  "f4",  "f5",  "f6",  "f7",
+	"f8",  "f9",  "f10", "f11", "f12", "f13", "f14", "f15",
+	"f16", "f17", "f18", "f19", "f20", "f21", "f22", "f23",
+	"f24", "f25", "f26", "f27", "f28", "f29", "f30", "f31" };
+      static const char* abi[] = {
+	"ft0", "ft1", "ft2", "ft3", "ft4", "ft5", "ft6", "ft7",
+	"fs0", "fs1", "fa0", "fa1", "fa2", "fa3", "fa4", "fa5",
+	"fa6", "fa7", "fs2", "fs3", "fs4", "fs5", "fs6", "fs7",
+	"fs8", "fs9", "fs10", "fs11", "ft8", "ft9", "ft0", "ft11" };
+
+      if (i >= 32)
+	return "f?";
+      return abiNames ? abi[i] : names[i];
+    }
+
     /// Return the name of the given register.
     std::string regName(unsigned i, bool abiNames = false) const
     {
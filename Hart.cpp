@@ -21,9 +21,9 @@
 #include <sstream>
 #include <cfenv>
 #include <cmath>
-#include <map>
 #include <mutex>
 #include <array>
+#include <algorithm>
 #include <boost/format.hpp>
 #include <emmintrin.h>
 #include <sys/time.h>
@@ -55,6 +55,7 @@
 #include "instforms.hpp"
 #include "DecodedInst.hpp"
 #include "Hart.hpp"
+#include "WhisperMessage.h"
 
 using namespace WdRiscv;
 
@@ -114,10 +115,23 @@ union Uint64DoubleUnion
 
 
 
+/// Return the instruction table shared by all the harts of the
+/// process (constructed on first use). The table is never modified
+/// after construction: Harts in different threads (e.g. independent
+/// simulations, see --manifest) may use it concurrently.
+static
+const InstTable&
+sharedInstTable()
+{
+  static const InstTable table;
+  return table;
+}
+
+
 template <typename URV>
 Hart<URV>::Hart(unsigned localHartId, Memory& memory, unsigned intRegCount)
   : localHartId_(localHartId), memory_(memory), intRegs_(intRegCount),
-    fpRegs_(32), syscall_(*this)
+    fpRegs_(32), syscall_(*this), instTable_(sharedInstTable())
 {
   regionHasLocalMem_.resize(16);
   regionHasLocalDataMem_.resize(16);
@@ -2586,148 +2600,254 @@ Hart<URV>::configMachineModePerfCounters(unsigned numCounters)
 }
 
 
+static std::mutex stderrMutex;
+
+
+/// Lock a trace stream for the duration of a scope. Harts sharing a
+/// trace stream are serialized (avoiding jumbled output) while harts
+/// tracing to their own streams never contend with each other.
+class TraceFileLock
+{
+public:
+
+  TraceFileLock(FILE* out)
+    : out_(out)
+  {
+#ifdef __MINGW64__
+    _lock_file(out_);
+#else
+    flockfile(out_);
+#endif
+  }
+
+  ~TraceFileLock()
+  {
+#ifdef __MINGW64__
+    _unlock_file(out_);
+#else
+    funlockfile(out_);
+#endif
+  }
+
+private:
+
+  FILE* out_;
+};
+
+/// Flush the text trace buffer of a hart on exit from a scope.
+template <typename URV>
+class TraceBufferFlush
+{
+public:
+
+  TraceBufferFlush(Hart<URV>& hart)
+    : hart_(hart)
+  { }
+
+  ~TraceBufferFlush()
+  { hart_.flushTraceBuffer(); }
+
+private:
+
+  Hart<URV>& hart_;
+};
+
+
 template <typename URV>
 void
-formatInstTrace(FILE* out, uint64_t tag, unsigned hartId, URV currPc,
-		const char* opcode, char resource, URV addr,
-		URV value, const char* assembly);
+Hart<URV>::printInstTrace(uint32_t inst, uint64_t tag, FILE* out,
+			  bool interrupt)
+{
+  DecodedInst di;
+  decode(pc_, inst, di);
 
-template <>
+  printInstTrace(di, tag, out, interrupt);
+}
+
+
+template <typename URV>
 void
-formatInstTrace<uint32_t>(FILE* out, uint64_t tag, unsigned hartId, uint32_t currPc,
-		const char* opcode, char resource, uint32_t addr,
-		uint32_t value, const char* assembly)
+Hart<URV>::printInstTrace(const DecodedInst& di, uint64_t tag, FILE* out,
+			  bool interrupt)
 {
-  if (resource == 'r')
+  TraceRecord& rec = traceRecord_;
+  collectTraceRecord(di, tag, interrupt, rec);
+
+  if (asyncTrace_)
     {
-      fprintf(out, "#%" PRId64 " %d %08x %8s r %02x         %08x  %s",
-              tag, hartId, currPc, opcode, addr, value, assembly);
+      asyncTrace_->push(asyncTraceSource_, rec);
+      return;
     }
-  else if (resource == 'c')
+
+  if (binaryTrace_)
     {
-      if ((addr >> 16) == 0)
-        fprintf(out, "#%" PRId64 " %d %08x %8s c %04x       %08x  %s",
-                tag, hartId, currPc, opcode, addr, value, assembly);
-      else
-        fprintf(out, "#%" PRId64 " %d %08x %8s c %08x   %08x  %s",
-                tag, hartId, currPc, opcode, addr, value, assembly);
+      binaryTrace_->write(rec);
+      return;
     }
-  else
+
+  if (columnTrace_)
     {
-      fprintf(out, "#%" PRId64 " %d %08x %8s %c %08x   %08x  %s", tag, hartId,
-              currPc, opcode, resource, addr, value, assembly);
+      // Data address/size of a store or of a load.
+      const InstEntry* entry = di.instEntry();
+      uint64_t memAddr = rec.memAddr;
+      unsigned memSize = rec.memSize;
+      if (memSize == 0 and ldStAddrValid_ and entry->isLoad())
+	{
+	  memAddr = ldStAddr_;
+	  memSize = entry->loadSize();
+	}
+      columnTrace_->write(rec, unsigned(entry->instId()), memAddr, memSize);
+      return;
+    }
+
+  // Text is accumulated in a per-hart buffer written in bulk (see
+  // flushTraceBuffer).
+  if (out != traceBufferFile_)
+    {
+      flushTraceBuffer();
+      traceBufferFile_ = out;
     }
+
+  const std::string& text = disassembleCached(di);
+  appendTraceRecord(traceBuffer_, rec, text.c_str(), sizeof(URV)*8);
+
+  if (traceBuffer_.size() >= traceBufferLimit_)
+    flushTraceBuffer();
 }
 
-template <>
-void
-formatInstTrace<uint64_t>(FILE* out, uint64_t tag, unsigned hartId, uint64_t currPc,
-		const char* opcode, char resource, uint64_t addr,
-		uint64_t value, const char* assembly)
+
+template <typename URV>
+const std::string&
+Hart<URV>::disassembleCached(const DecodedInst& di)
 {
-  fprintf(out, "#%" PRId64 " %d %016" PRIx64 " %8s %c %016" PRIx64 " %016" PRIx64 "  %s",
-          tag, hartId, currPc, opcode, resource, addr, value, assembly);
+  bool hit = false;
+  std::string& text = disasCache_.slot(di.address(), di.inst(), hit);
+  if (not hit)
+    disassembleInst(di, text);
+  return text;
 }
 
-template <typename URV>
-void
-formatFpInstTrace(FILE* out, uint64_t tag, unsigned hartId, URV currPc,
-		  const char* opcode, unsigned fpReg,
-		  uint64_t fpVal, const char* assembly);
 
-template <>
+template <typename URV>
 void
-formatFpInstTrace<uint32_t>(FILE* out, uint64_t tag, unsigned hartId, uint32_t currPc,
-		  const char* opcode, unsigned fpReg,
-		  uint64_t fpVal, const char* assembly)
+Hart<URV>::flushTraceBuffer()
 {
-  fprintf(out, "#%" PRId64 " %d %08x %8s f %02x %016" PRIx64 "  %s",
-          tag, hartId, currPc, opcode, fpReg, fpVal, assembly);
+  if (traceBuffer_.empty() or traceHeld_)
+    return;
+
+  // Serialize to avoid jumbled output.
+  TraceFileLock guard(traceBufferFile_);
+  fwrite(traceBuffer_.data(), 1, traceBuffer_.size(), traceBufferFile_);
+  traceBuffer_.clear();
 }
 
-template <>
+
+template <typename URV>
+inline
 void
-formatFpInstTrace<uint64_t>(FILE* out, uint64_t tag, unsigned hartId, uint64_t currPc,
-		  const char* opcode, unsigned fpReg,
-		  uint64_t fpVal, const char* assembly)
+Hart<URV>::recordFlight(const DecodedInst& di)
 {
-  fprintf(out, "#%" PRId64 " %d %016" PRIx64 " %8s f %016" PRIx64 " %016" PRIx64 "  %s",
-          tag, hartId, currPc, opcode, uint64_t(fpReg), fpVal, assembly);
-}
+  FlightRecord& rec = flightRecorder_.next();
+  rec.tag = instCounter_;
+  rec.pc = currPc_;
+  rec.inst = di.inst();
+
+  int reg = intRegs_.getLastWrittenReg();
+  rec.intReg = reg > 0 ? reg : -1;
+  if (reg > 0)
+    rec.intValue = intRegs_.read(reg);
 
+  rec.fpReg = fpRegs_.getLastWrittenReg();
+  if (rec.fpReg >= 0)
+    rec.fpValue = fpRegs_.readBitsRaw(rec.fpReg);
+
+  size_t addr = 0;
+  rec.memSize = memory_.getLastWriteNewValue(localHartId_, addr, rec.memValue);
+  rec.memAddr = addr;
+
+  if (exceptionCount_ >= flightExceptionLimit_)
+    {
+      flightExceptionLimit_ = ~uint64_t(0);  // Dump once.
+      dumpFlightRecorder("exception limit reached");
+    }
+}
 
-static std::mutex printInstTraceMutex;
-static std::mutex stderrMutex;
 
 template <typename URV>
 void
-Hart<URV>::printInstTrace(uint32_t inst, uint64_t tag, std::string& tmp,
-			  FILE* out, bool interrupt)
+Hart<URV>::dumpFlightRecorder(const char* reason)
 {
+  size_t count = flightRecorder_.size();
+  if (count == 0)
+    return;
+
+  FILE* out = flightFile_ ? flightFile_ : stderr;
+
+  std::cerr << "Hart " << localHartId_ << " flight recorder (" << reason
+	    << "): Last " << count << " executed instructions:\n";
+
+  // Serialize to avoid jumbled output.
+  flushTraceBuffer();
+  TraceFileLock guard(out);
+
+  TraceRecord& rec = traceRecord_;
+  std::string text;
   DecodedInst di;
-  decode(pc_, inst, di);
+  for (size_t i = 0; i < count; ++i)
+    {
+      const FlightRecord& flight = flightRecorder_.at(i);
+      flight.toTraceRecord(rec, localHartId_);
+      decode(URV(flight.pc), flight.inst, di);
+      disassembleInst(di, text);
+      printTraceRecord(out, rec, text.c_str(), sizeof(URV)*8);
+    }
 
-  printInstTrace(di, tag, tmp, out, interrupt);
+  flightRecorder_.clear();
 }
 
 
 template <typename URV>
 void
-Hart<URV>::printInstTrace(const DecodedInst& di, uint64_t tag, std::string& tmp,
-			  FILE* out, bool interrupt)
+Hart<URV>::collectTraceRecord(const DecodedInst& di, uint64_t tag,
+			      bool interrupt, TraceRecord& rec)
 {
-  // Serialize to avoid jumbled output.
-  std::lock_guard<std::mutex> guard(printInstTraceMutex);
-
-  disassembleInst(di, tmp);
-  if (interrupt)
-    tmp += " (interrupted)";
+  rec.clearChanges();
+  rec.tag = tag;
+  rec.pc = currPc_;
+  rec.inst = di.inst();
+  rec.instSize = di.instSize();
+  rec.hartId = localHartId_;
+  rec.interrupted = interrupt;
 
   if (traceLdSt_ and ldStAddrValid_)
     {
-      std::ostringstream oss;
-      oss << "0x" << std::hex << ldStAddr_;
-      tmp += " [" + oss.str() + "]";
+      rec.hasLdSt = true;
+      rec.ldStAddr = ldStAddr_;
     }
 
-  char instBuff[128];
-  if (di.instSize() == 4)
-    sprintf(instBuff, "%08x", di.inst());
-  else
-    sprintf(instBuff, "%04x", di.inst() & 0xffff);
-
-  bool pending = false;  // True if a printed line need to be terminated.
-
-  // Process integer register diff.
+  // Integer register diff.
   int reg = intRegs_.getLastWrittenReg();
   URV value = 0;
   if (reg > 0)
     {
-      value = intRegs_.read(reg);
-      formatInstTrace<URV>(out, tag, localHartId_, currPc_, instBuff, 'r', reg,
-			   value, tmp.c_str());
-      pending = true;
+      rec.intReg = reg;
+      rec.intValue = intRegs_.read(reg);
     }
 
-  // Process floating point register diff.
+  // Floating point register diff.
   int fpReg = fpRegs_.getLastWrittenReg();
   if (fpReg >= 0)
     {
-      uint64_t val = fpRegs_.readBitsRaw(fpReg);
-      if (pending) fprintf(out, "  +\n");
-      formatFpInstTrace<URV>(out, tag, localHartId_, currPc_, instBuff, fpReg,
-			     val, tmp.c_str());
-      pending = true;
+      rec.fpReg = fpReg;
+      rec.fpValue = fpRegs_.readBitsRaw(fpReg);
     }
 
-  // Process CSR diffs.
-  std::vector<CsrNumber> csrs;
-  std::vector<unsigned> triggers;
+  // CSR diffs. Scratch vectors are members to avoid allocation.
+  auto& csrs = traceCsrs_;
+  auto& triggers = traceTriggers_;
   csRegs_.getLastWrittenRegs(csrs, triggers);
 
-  std::vector<bool> tdataChanged(3);
-
-  std::map<URV, URV> csrMap; // Map csr-number to its value.
+  bool tdataChanged[3] = { false, false, false };
 
   for (CsrNumber csr : csrs)
     {
@@ -2737,65 +2857,54 @@ Hart<URV>::printInstTrace(const DecodedInst& di, uint64_t tag, std::string& tmp,
       if (csr >= CsrNumber::TDATA1 and csr <= CsrNumber::TDATA3)
 	{
 	  size_t ix = size_t(csr) - size_t(CsrNumber::TDATA1);
-	  tdataChanged.at(ix) = true;
-	  continue; // Debug triggers printed separately below
+	  tdataChanged[ix] = true;
+	  continue; // Debug triggers reported separately below
 	}
-      csrMap[URV(csr)] = value;
+      rec.addCsr(URV(csr), value);
     }
 
-  // Process trigger register diffs.
+  // Trigger register diffs.
   for (unsigned trigger : triggers)
     {
       URV data1(0), data2(0), data3(0);
       if (not peekTrigger(trigger, data1, data2, data3))
 	continue;
-      if (tdataChanged.at(0))
+      if (tdataChanged[0])
 	{
 	  URV ecsr = (trigger << 16) | URV(CsrNumber::TDATA1);
-	  csrMap[ecsr] = data1;
+	  rec.addCsr(ecsr, data1);
 	}
-      if (tdataChanged.at(1))
+      if (tdataChanged[1])
 	{
 	  URV ecsr = (trigger << 16) | URV(CsrNumber::TDATA2);
-	  csrMap[ecsr] = data2;
+	  rec.addCsr(ecsr, data2);
 	}
-      if (tdataChanged.at(2))
+      if (tdataChanged[2])
 	{
 	  URV ecsr = (trigger << 16) | URV(CsrNumber::TDATA3);
-	  csrMap[ecsr] = data3;
+	  rec.addCsr(ecsr, data3);
 	}
     }
 
-  for (const auto& [key, val] : csrMap)
+  if (rec.droppedCsrs and not warnedDroppedCsrs_)
     {
-      if (pending) fprintf(out, "  +\n");
-      formatInstTrace<URV>(out, tag, localHartId_, currPc_, instBuff, 'c',
-			   key, val, tmp.c_str());
-      pending = true;
+      std::cerr << "Warning: Hart " << localHartId_ << ": Instruction at 0x"
+		<< std::hex << rec.pc << std::dec << " changed more than "
+		<< unsigned(TraceRecord::MaxCsrs) << " CSRs: "
+		<< rec.droppedCsrs << " dropped from the trace (further "
+		<< "occurrences not reported)\n";
+      warnedDroppedCsrs_ = true;
     }
 
-  // Process memory diff.
+  // Memory diff.
   size_t address = 0;
   uint64_t memValue = 0;
   unsigned writeSize = memory_.getLastWriteNewValue(localHartId_, address, memValue);
   if (writeSize > 0)
     {
-      if (pending)
-	fprintf(out, "  +\n");
-
-      formatInstTrace<URV>(out, tag, localHartId_, currPc_, instBuff, 'm',
-			   URV(address), URV(memValue), tmp.c_str());
-      pending = true;
-    }
-
-  if (pending) 
-    fprintf(out, "\n");
-  else
-    {
-      // No diffs: Generate an x0 record.
-      formatInstTrace<URV>(out, tag, localHartId_, currPc_, instBuff, 'r', 0, 0,
-			  tmp.c_str());
-      fprintf(out, "\n");
+      rec.memSize = writeSize;
+      rec.memAddr = URV(address);
+      rec.memValue = memValue;
     }
 }
 
@@ -3406,8 +3515,7 @@ Hart<URV>::takeTriggerAction(FILE* traceFile, URV pc, URV info,
       uint32_t inst = 0;
       readInst(currPc_, inst);
 
-      std::string instStr;
-      printInstTrace(inst, counter, instStr, traceFile);
+      printInstTrace(inst, counter, traceFile);
     }
 
   return enteredDebug;
@@ -3563,8 +3671,7 @@ Hart<URV>::logStop(const CoreException& ce, uint64_t counter, FILE* traceFile)
 	{
 	  uint32_t inst = 0;
 	  readInst(currPc_, inst);
-	  std::string instStr;
-	  printInstTrace(inst, counter, instStr, traceFile);
+	  printInstTrace(inst, counter, traceFile);
 	}
     }
 
@@ -3579,6 +3686,17 @@ Hart<URV>::logStop(const CoreException& ce, uint64_t counter, FILE* traceFile)
   else
     cerr << "Stopped -- unexpected exception\n";
 
+  if (not success and flightRecorder_.capacity())
+    {
+      // Record the stopping instruction then dump.
+      uint32_t inst = 0;
+      readInst(currPc_, inst);
+      DecodedInst di;
+      decode(currPc_, inst, di);
+      recordFlight(di);
+      dumpFlightRecorder("failed stop");
+    }
+
   return success;
 }
 
@@ -3587,11 +3705,12 @@ template <typename URV>
 bool
 Hart<URV>::untilAddress(URV address, FILE* traceFile)
 {
-  std::string instStr;
-  instStr.reserve(128);
+  TraceBufferFlush<URV> flushOnExit(*this);
 
-  // Need csr history when tracing or for triggers
-  bool trace = traceFile != nullptr or enableTriggers_;
+  // Need csr history when tracing or for triggers. Need register and
+  // memory history for the flight recorder.
+  bool flight = flightRecorder_.capacity() != 0;
+  bool trace = traceFile != nullptr or enableTriggers_ or flight;
   clearTraceData();
 
   uint64_t limit = instCountLim_;
@@ -3608,8 +3727,21 @@ Hart<URV>::untilAddress(URV address, FILE* traceFile)
       if (kbdInterrupt)
         break;
 
+      // Outside the trace window: Do not trace or, if requested, let
+      // the caller continue in fast mode.
+      FILE* file = traceFile;
+      if (traceFiltered_ and not inTraceWindow(pc_, instCounter_ + 1))
+	{
+	  if (traceWindowExit_)
+	    {
+	      traceWindowLeft_ = true;
+	      break;
+	    }
+	  file = nullptr;
+	}
+
       if (alarmCounter_ and doAlarmCountdown())
-        if (processExternalInterrupt(traceFile, instStr))
+        if (processExternalInterrupt(file))
           continue;
 
       inst = 0;
@@ -3633,7 +3765,7 @@ Hart<URV>::untilAddress(URV address, FILE* traceFile)
 	  bool fetchOk = true;
 	  if (triggerTripped_)
 	    {
-	      if (not fetchInstPostTrigger(pc_, inst, traceFile))
+	      if (not fetchInstPostTrigger(pc_, inst, file))
 		{
 		  ++cycleCount_;
 		  continue;  // Next instruction in trap handler.
@@ -3644,8 +3776,8 @@ Hart<URV>::untilAddress(URV address, FILE* traceFile)
 	  if (not fetchOk)
 	    {
 	      ++cycleCount_;
-	      if (traceFile)
-		printInstTrace(inst, instCounter_, instStr, traceFile);
+	      if (file)
+		printInstTrace(inst, instCounter_, file);
 	      continue;  // Next instruction in trap handler.
 	    }
 
@@ -3654,6 +3786,10 @@ Hart<URV>::untilAddress(URV address, FILE* traceFile)
 					       isInterruptEnabled()))
 	    triggerTripped_ = true;
 
+	  // A start/stop trace trigger action may have changed the trace.
+	  if (hasTrig and traceFiltered_)
+	    file = inTraceWindow(currPc_, instCounter_)? traceFile : nullptr;
+
 	  // Decode unless match in decode cache.
 	  uint32_t ix = (pc_ >> 1) & decodeCacheMask_;
 	  DecodedInst* di = &decodeCache_[ix];
@@ -3672,18 +3808,19 @@ Hart<URV>::untilAddress(URV address, FILE* traceFile)
 	    {
               if (doStats)
                 accumulateInstructionStats(*di);
-	      if (traceFile)
-		{
-		  printInstTrace(*di, instCounter_, instStr, traceFile);
-		  clearTraceData();
-		}
+	      if (flight)
+		recordFlight(*di);
+	      if (file)
+		printInstTrace(*di, instCounter_, file);
+	      if (trace)
+		clearTraceData();
 	      continue;
 	    }
 
 	  if (triggerTripped_)
 	    {
 	      undoForTrigger();
-	      if (takeTriggerAction(traceFile, currPc_, currPc_,
+	      if (takeTriggerAction(file, currPc_, currPc_,
 				    instCounter_, true))
 		return true;
 	      continue;
@@ -3702,19 +3839,21 @@ Hart<URV>::untilAddress(URV address, FILE* traceFile)
 
 	  if (trace)
 	    {
-	      if (traceFile)
-		printInstTrace(*di, instCounter_, instStr, traceFile);
+	      if (flight)
+		recordFlight(*di);
+	      if (file)
+		printInstTrace(*di, instCounter_, file);
 	      clearTraceData();
 	    }
 
 	  if (icountHit)
-	    if (takeTriggerAction(traceFile, pc_, pc_, instCounter_, false))
+	    if (takeTriggerAction(file, pc_, pc_, instCounter_, false))
 	      return true;
           prevPerfControl_ = perfControl_;
 	}
       catch (const CoreException& ce)
 	{
-	  success = logStop(ce, instCounter_, traceFile);
+	  success = logStop(ce, instCounter_, file);
 	  break;
 	}
     }
@@ -3723,6 +3862,241 @@ Hart<URV>::untilAddress(URV address, FILE* traceFile)
 }
 
 
+template <typename URV>
+void
+Hart<URV>::RunConditions::reset(uint64_t count)
+{
+  pcs.clear();
+  memRanges.clear();
+  csrs.clear();
+  watchCsrs = false;
+  anyCsr = false;
+  maxCount = count? count : ~uint64_t(0);
+}
+
+
+template <typename URV>
+bool
+Hart<URV>::RunConditions::add(uint32_t resource, uint64_t address,
+			      uint64_t value)
+{
+  if (resource == 'p')
+    pcs.push_back(URV(address));
+  else if (resource == 'm')
+    {
+      if (value)
+	memRanges.push_back(std::make_pair(size_t(address),
+					   size_t(address + value - 1)));
+    }
+  else if (resource == 'c')
+    {
+      watchCsrs = true;
+      if (address == WHISPER_RUN_ANY_CSR)
+	anyCsr = true;
+      else
+	csrs.push_back(CsrNumber(address));
+    }
+  else
+    {
+      std::cerr << "Error: Invalid run-until condition resource: "
+		<< resource << '\n';
+      return false;
+    }
+  return true;
+}
+
+
+template <typename URV>
+void
+Hart<URV>::RunConditions::finish()
+{
+  // Watching all CSRs subsumes watching specific ones.
+  if (anyCsr)
+    csrs.clear();
+
+  std::sort(pcs.begin(), pcs.end());
+}
+
+
+template <typename URV>
+bool
+Hart<URV>::runUntilStopped(const RunConditions& conditions, bool wasInDebug,
+			   RunStop& stop)
+{
+  if (targetProgFinished_)
+    {
+      stop = RunStop::Finished;
+      return true;
+    }
+  if (debugMode_ and not wasInDebug)
+    {
+      stop = RunStop::DebugMode;
+      return true;
+    }
+
+  const auto& ranges = conditions.memRanges;
+  if (not ranges.empty())
+    {
+      size_t addr = 0;
+      uint64_t value = 0;
+      unsigned size = memory_.getLastWriteNewValue(localHartId_, addr, value);
+      if (size)
+	for (const auto& range : ranges)
+	  if (addr <= range.second and addr + size - 1 >= range.first)
+	    {
+	      stop = RunStop::MemoryWrite;
+	      return true;
+	    }
+    }
+
+  const auto& csrs = conditions.csrs;
+  const auto& written = csRegs_.lastWrittenRegs_;
+  if (conditions.watchCsrs and not written.empty())
+    {
+      bool hit = csrs.empty();
+      for (size_t i = 0; i < written.size() and not hit; ++i)
+	hit = std::find(csrs.begin(), csrs.end(), written[i]) != csrs.end();
+      if (hit)
+	{
+	  stop = RunStop::CsrWrite;
+	  return true;
+	}
+    }
+
+  const auto& pcs = conditions.pcs;
+  if (not pcs.empty() and std::binary_search(pcs.begin(), pcs.end(), pc_))
+    {
+      stop = RunStop::Pc;
+      return true;
+    }
+
+  return false;
+}
+
+
+template <typename URV>
+bool
+Hart<URV>::canRunUntilFast(FILE* traceFile) const
+{
+  return (not traceFile and not hasActiveTrigger() and not instFreq_ and
+	  not enableCounters_ and not alarmCounter_ and not wideLdSt_ and
+	  not dcsrStep_ and not forceAccessFail_ and not debugMode_);
+}
+
+
+template <typename URV>
+bool
+Hart<URV>::runUntilFast(const RunConditions& conditions, uint64_t& count,
+			RunStop& stop)
+{
+  try
+    {
+      while (true)
+	{
+	  if (targetProgFinished_)
+	    {
+	      stop = RunStop::Finished;
+	      return true;
+	    }
+	  if (count >= conditions.maxCount)
+	    {
+	      stop = RunStop::Count;
+	      return true;
+	    }
+
+	  clearTraceData();
+	  currPc_ = pc_;
+	  ldStAddrValid_ = false;
+	  triggerTripped_ = false;
+	  hasException_ = false;
+	  ebreakInstDebug_ = false;
+	  ++instCounter_;
+	  ++count;
+
+	  if (not processExternalInterrupt(nullptr))
+	    {
+	      // Fetch/decode unless match in decode cache.
+	      uint32_t ix = (pc_ >> 1) & decodeCacheMask_;
+	      DecodedInst* di = &decodeCache_[ix];
+	      bool fetchOk = true;
+	      if (not di->isValid() or di->address() != pc_)
+		{
+		  uint32_t inst = 0;
+		  fetchOk = fetchInst(pc_, inst);
+		  if (fetchOk)
+		    decode(pc_, inst, *di);
+		}
+
+	      ++cycleCount_;
+	      if (fetchOk)
+		{
+		  pc_ += di->instSize();
+		  execute(di);
+
+		  if (not hasException_)
+		    {
+		      if (not ebreakInstDebug_ and minstretEnabled())
+			++retiredInsts_;
+		      updateLoadQueue(*di);
+		      prevPerfControl_ = perfControl_;
+		    }
+		}
+	    }
+
+	  if (runUntilStopped(conditions, false, stop))
+	    return true;
+
+	  // A CSR write (including a trap) may disable the fast path.
+	  if (debugMode_ or not csRegs_.lastWrittenRegs_.empty())
+	    return false;
+	}
+    }
+  catch (const CoreException& ce)
+    {
+      logStop(ce, instCounter_, nullptr);
+    }
+
+  return runUntilStopped(conditions, false, stop);
+}
+
+
+template <typename URV>
+typename Hart<URV>::RunStop
+Hart<URV>::runUntil(const RunConditions& conditions, FILE* traceFile,
+		    uint64_t& count)
+{
+  TraceBufferFlush<URV> flushOnExit(*this);
+
+  count = 0;
+  RunStop stop = RunStop::Count;
+
+  while (true)
+    {
+      // Common case (no trace, no triggers): simpleRun-style loop.
+      if (canRunUntilFast(traceFile))
+	{
+	  if (runUntilFast(conditions, count, stop))
+	    return stop;
+	  continue;
+	}
+
+      if (targetProgFinished_)
+	return RunStop::Finished;
+      if (count >= conditions.maxCount)
+	return RunStop::Count;
+
+      bool wasInDebug = debugMode_;
+
+      clearTraceData();
+      singleStep(traceFile, true);
+      ++count;
+
+      if (runUntilStopped(conditions, wasInDebug, stop))
+	return stop;
+    }
+}
+
+
 template <typename URV>
 bool
 Hart<URV>::runUntilAddress(URV address, FILE* traceFile)
@@ -3737,6 +4111,9 @@ Hart<URV>::runUntilAddress(URV address, FILE* traceFile)
   SignalHandlers handlers();
 
   bool success = untilAddress(address, traceFile);
+
+  if (kbdInterrupt)
+    dumpFlightRecorder("keyboard interrupt");
       
   if (instCounter_ == limit)
     std::cerr << "Stopped -- Reached instruction limit\n";
@@ -3770,7 +4147,9 @@ Hart<URV>::simpleRun()
       while (true)
         {
           bool hasLim = (instCountLim_ < ~uint64_t(0));
-          if (hasLim)
+          if (flightRecorder_.capacity())
+            simpleRunFlight();
+          else if (hasLim)
             simpleRunWithLimit();
           else
             simpleRunNoLimit();
@@ -3778,6 +4157,7 @@ Hart<URV>::simpleRun()
           if (kbdInterrupt)
             {
               std::cerr << "Stopped -- keyboard interrupt\n";
+              dumpFlightRecorder("keyboard interrupt");
               break;
             }
 
@@ -3853,6 +4233,167 @@ Hart<URV>::simpleRunNoLimit()
 }
 
 
+template <typename URV>
+bool
+Hart<URV>::simpleRunFlight()
+{
+  uint64_t limit = instCountLim_;
+  while (noLinuxInterrupt and instCounter_ < limit) 
+    {
+      currPc_ = pc_;
+      ++instCounter_;
+
+      // Fetch/decode unless match in decode cache.
+      uint32_t ix = (pc_ >> 1) & decodeCacheMask_;
+      DecodedInst* di = &decodeCache_[ix];
+      if (not di->isValid() or di->address() != pc_)
+        {
+          uint32_t inst = 0;
+          if (not fetchInst(pc_, inst))
+            continue;
+          decode(pc_, inst, *di);
+        }
+
+      // Clear register/memory change info (but not CSR change info
+      // which is not collected in fast mode).
+      intRegs_.clearLastWrittenReg();
+      fpRegs_.clearLastWrittenReg();
+      memory_.clearLastWriteInfo(localHartId_);
+
+      pc_ += di->instSize();
+      execute(di);
+
+      recordFlight(*di);
+    }
+  return true;
+}
+
+
+template <typename URV>
+void
+Hart<URV>::simpleRunToTraceWindow(URV address)
+{
+  // Past the end of the trace window (or trace turned off by a
+  // trigger): Run to the end. Before the start of the window: Run
+  // till the instruction preceding the window. Otherwise, check the
+  // pc ranges before each instruction.
+  uint64_t limit = instCountLim_;
+  bool checkPc = false;
+  if (instCounter_ < traceEnd_ and csRegs_.isTriggerTraceOn())
+    {
+      if (instCounter_ + 1 < traceBegin_)
+	limit = std::min(limit, traceBegin_ - 1);
+      else
+	{
+	  limit = std::min(limit, traceEnd_);
+	  checkPc = true;
+	}
+    }
+
+  bool flight = flightRecorder_.capacity() != 0;
+
+  while (noLinuxInterrupt and instCounter_ < limit and pc_ != address)
+    {
+      if (checkPc and inTraceWindow(pc_, instCounter_ + 1))
+	break;
+
+      currPc_ = pc_;
+      ++instCounter_;
+
+      // Fetch/decode unless match in decode cache.
+      uint32_t ix = (pc_ >> 1) & decodeCacheMask_;
+      DecodedInst* di = &decodeCache_[ix];
+      if (not di->isValid() or di->address() != pc_)
+        {
+          uint32_t inst = 0;
+          if (not fetchInst(pc_, inst))
+            continue;
+          decode(pc_, inst, *di);
+        }
+
+      if (flight)
+	{
+	  // As in simpleRunFlight.
+	  intRegs_.clearLastWrittenReg();
+	  fpRegs_.clearLastWrittenReg();
+	  memory_.clearLastWriteInfo(localHartId_);
+	}
+
+      pc_ += di->instSize();
+      execute(di);
+
+      if (flight)
+	recordFlight(*di);
+    }
+}
+
+
+template <typename URV>
+bool
+Hart<URV>::runTraceWindow(URV address, FILE* traceFile)
+{
+  bool success = true;
+  traceWindowExit_ = true;
+
+  while (pc_ != address and instCounter_ < instCountLim_)
+    {
+      if (inTraceWindow(pc_, instCounter_ + 1))
+	{
+	  traceWindowLeft_ = false;
+	  success = untilAddress(address, traceFile);
+	  if (not traceWindowLeft_)
+	    break;  // Stopped, or reached stop address/instruction limit.
+	  continue;
+	}
+
+      // For speed: do not record/clear CSR changes.
+      enableCsrTrace_ = false;
+      try
+	{
+	  simpleRunToTraceWindow(address);
+	}
+      catch (const CoreException& ce)
+	{
+	  success = logStop(ce, 0, nullptr);
+	  enableCsrTrace_ = true;
+	  break;
+	}
+      enableCsrTrace_ = true;
+
+      if (kbdInterrupt)
+	break;
+    }
+
+  traceWindowExit_ = false;
+
+  if (kbdInterrupt)
+    {
+      std::cerr << "Stopped -- keyboard interrupt\n";
+      dumpFlightRecorder("keyboard interrupt");
+    }
+  else if (instCounter_ == instCountLim_)
+    std::cerr << "Stopped -- Reached instruction limit\n";
+  else if (pc_ == address)
+    std::cerr << "Stopped -- Reached end address\n";
+
+  return success;
+}
+
+
+template <typename URV>
+bool
+Hart<URV>::addTraceFunction(const std::string& name)
+{
+  ElfSymbol sym;
+  if (not this->findElfSymbol(name, sym))
+    return false;
+
+  size_t size = sym.size_ ? sym.size_ : 1;
+  addTracePcRange(URV(sym.addr_), URV(sym.addr_ + size - 1));
+  return true;
+}
+
+
 template <typename URV>
 bool
 Hart<URV>::openTcpForGdb()
@@ -3893,14 +4434,16 @@ Hart<URV>::run(FILE* file)
   URV stopAddr = stopAddrValid_? stopAddr_ : ~URV(0); // ~URV(0): No-stop PC.
   bool hasWideLdSt = csRegs_.isImplemented(CsrNumber::MDBAC);
   bool complex = stopAddrValid_ and not toHostValid_;
-  complex = (complex or file or instFreq_ or enableTriggers_ or
-             enableCounters_ or enableGdb_ or hasWideLdSt or alarmInterval_);
+  complex = (complex or instFreq_ or enableTriggers_ or enableCounters_ or
+             enableGdb_ or hasWideLdSt or alarmInterval_);
   if (gdbTcpPort_ >= 0)
     openTcpForGdb();
   else
     assert(gdbSocket_ < 0);
 
-  if (complex)
+  // A windowed trace runs in fast mode outside the trace window.
+  bool windowed = file and traceFiltered_;
+  if (complex or (file and not windowed))
     return runUntilAddress(stopAddr, file); 
 
   uint64_t counter0 = instCounter_;
@@ -3911,7 +4454,7 @@ Hart<URV>::run(FILE* file)
   // Setup signal handlers. Restore on destruction.
   SignalHandlers handlers();
 
-  bool success = simpleRun();
+  bool success = windowed? runTraceWindow(stopAddr, file) : simpleRun();
 
   // Simulator stats.
   struct timeval t1;
@@ -3994,7 +4537,7 @@ Hart<URV>::isInterruptPossible(InterruptCause& cause)
 
 template <typename URV>
 bool
-Hart<URV>::processExternalInterrupt(FILE* traceFile, std::string& instStr)
+Hart<URV>::processExternalInterrupt(FILE* traceFile)
 {
   if (debugStepMode_ and not dcsrStepIe_)
     return false;
@@ -4008,7 +4551,7 @@ Hart<URV>::processExternalInterrupt(FILE* traceFile, std::string& instStr)
       uint32_t inst = 0; // Load interrupted inst.
       readInst(currPc_, inst);
       if (traceFile)  // Trace interrupted instruction.
-	printInstTrace(inst, instCounter_, instStr, traceFile, true);
+	printInstTrace(inst, instCounter_, traceFile, true);
       return true;
     }
 
@@ -4021,7 +4564,7 @@ Hart<URV>::processExternalInterrupt(FILE* traceFile, std::string& instStr)
       uint32_t inst = 0; // Load interrupted inst.
       readInst(currPc_, inst);
       if (traceFile)  // Trace interrupted instruction.
-	printInstTrace(inst, instCounter_, instStr, traceFile, true);
+	printInstTrace(inst, instCounter_, traceFile, true);
       ++cycleCount_;
       return true;
     }
@@ -4037,6 +4580,8 @@ Hart<URV>::invalidateDecodeCache(URV addr, unsigned storeSize)
   // write/poke. This way it can be applied only to pages marked
   // execute.
 
+  disasCache_.invalidate(addr, storeSize);
+
   // We want to check the location before the address just in case it
   // contains a 4-byte instruction that overlaps what was written.
   storeSize += 3;
@@ -4059,6 +4604,35 @@ Hart<URV>::invalidateDecodeCache()
 {
   for (auto& entry : decodeCache_)
     entry.invalidate();
+  disasCache_.clear();
+}
+
+
+template <typename URV>
+void
+Hart<URV>::updateLoadQueue(const DecodedInst& di)
+{
+  // If a register is used as a source by an instruction then any
+  // pending load with same register as target is removed from the
+  // load queue (because in such a case the hardware will stall
+  // till load is completed). Source operands of load instructions
+  // are handled in the load and loadRserve methods.
+  const InstEntry* entry = di.instEntry();
+  if (entry->isLoad())
+    return;
+
+  if (entry->isIthOperandIntRegSource(0))
+    removeFromLoadQueue(di.op0(), entry->isDivide());
+  if (entry->isIthOperandIntRegSource(1))
+    removeFromLoadQueue(di.op1(), entry->isDivide());
+  if (entry->isIthOperandIntRegSource(2))
+    removeFromLoadQueue(di.op2(), entry->isDivide());
+
+  // If a register is written by a non-load instruction, then
+  // its entry is invalidated in the load queue.
+  int regIx = intRegs_.getLastWrittenReg();
+  if (regIx > 0)
+    invalidateInLoadQueue(regIx, entry->isDivide());
 }
 
 
@@ -4066,8 +4640,15 @@ template <typename URV>
 void
 Hart<URV>::singleStep(FILE* traceFile)
 {
-  std::string instStr;
+  singleStep(traceFile, false);
+  flushTraceBuffer();
+}
 
+
+template <typename URV>
+void
+Hart<URV>::singleStep(FILE* traceFile, bool useCache)
+{
   // Single step is mostly used for follow-me mode where we want to
   // know the changes after the execution of each instruction.
   bool doStats = instFreq_ or enableCounters_;
@@ -4087,7 +4668,7 @@ Hart<URV>::singleStep(FILE* traceFile)
 
       ++instCounter_;
 
-      if (processExternalInterrupt(traceFile, instStr))
+      if (processExternalInterrupt(traceFile))
 	return;  // Next instruction in interrupt handler.
 
       // Process pre-execute address trigger and fetch instruction.
@@ -4111,7 +4692,7 @@ Hart<URV>::singleStep(FILE* traceFile)
 	{
 	  ++cycleCount_;
 	  if (traceFile)
-	    printInstTrace(inst, instCounter_, instStr, traceFile);
+	    printInstTrace(inst, instCounter_, traceFile);
 	  if (dcsrStep_)
 	    enterDebugMode(DebugModeCause::STEP, pc_);
 	  return; // Next instruction in trap handler
@@ -4122,14 +4703,24 @@ Hart<URV>::singleStep(FILE* traceFile)
 					   isInterruptEnabled()))
 	triggerTripped_ = true;
 
-      DecodedInst di;
-      decode(pc_, inst, di);
+      // Decode. With useCache, decode unless match in decode cache.
+      DecodedInst localDi;
+      DecodedInst* di = &localDi;
+      if (useCache)
+	{
+	  uint32_t ix = (pc_ >> 1) & decodeCacheMask_;
+	  di = &decodeCache_[ix];
+	  if (not di->isValid() or di->address() != pc_)
+	    decode(pc_, inst, *di);
+	}
+      else
+	decode(pc_, inst, localDi);
 
       bool doingWide = wideLdSt_;
 
       // Increment pc and execute instruction
-      pc_ += di.instSize();
-      execute(&di);
+      pc_ += di->instSize();
+      execute(di);
 
       ++cycleCount_;
 
@@ -4143,9 +4734,9 @@ Hart<URV>::singleStep(FILE* traceFile)
       if (hasException_)
 	{
 	  if (doStats)
-	    accumulateInstructionStats(di);
+	    accumulateInstructionStats(*di);
 	  if (traceFile)
-	    printInstTrace(inst, instCounter_, instStr, traceFile);
+	    printInstTrace(inst, instCounter_, traceFile);
 	  if (dcsrStep_ and not ebreakInstDebug_)
 	    enterDebugMode(DebugModeCause::STEP, pc_);
 	  return;
@@ -4166,32 +4757,12 @@ Hart<URV>::singleStep(FILE* traceFile)
           ++retiredInsts_;
 
       if (doStats)
-	accumulateInstructionStats(di);
+	accumulateInstructionStats(*di);
 
       if (traceFile)
-	printInstTrace(inst, instCounter_, instStr, traceFile);
+	printInstTrace(inst, instCounter_, traceFile);
 
-      // If a register is used as a source by an instruction then any
-      // pending load with same register as target is removed from the
-      // load queue (because in such a case the hardware will stall
-      // till load is completed). Source operands of load instructions
-      // are handled in the load and loadRserve methods.
-      const InstEntry* entry = di.instEntry();
-      if (not entry->isLoad())
-	{
-	  if (entry->isIthOperandIntRegSource(0))
-	    removeFromLoadQueue(di.op0(), entry->isDivide());
-	  if (entry->isIthOperandIntRegSource(1))
-	    removeFromLoadQueue(di.op1(), entry->isDivide());
-	  if (entry->isIthOperandIntRegSource(2))
-	    removeFromLoadQueue(di.op2(), entry->isDivide());
-
-	  // If a register is written by a non-load instruction, then
-	  // its entry is invalidated in the load queue.
-	  int regIx = intRegs_.getLastWrittenReg();
-	  if (regIx > 0)
-	    invalidateInLoadQueue(regIx, entry->isDivide());
-	}
+      updateLoadQueue(*di);
 
       bool icountHit = (enableTriggers_ and isInterruptEnabled() and
 			icountTriggerHit());
@@ -4462,6 +5033,111 @@ Hart<URV>::collectAndUndoWhatIfChanges(URV prevPc, ChangeRecord& record)
 }
 
 
+template <typename URV>
+void
+Hart<URV>::saveUndoState(UndoRecord& record) const
+{
+  record.pc = pc_;
+  record.instCounter = instCounter_;
+  record.retiredInsts = retiredInsts_;
+  record.cycleCount = cycleCount_;
+  record.privMode = privMode_;
+  if (loadQueueEnabled_)
+    record.loadQueue = loadQueue_;
+
+  record.reservation = memory_.hartData_.at(localHartId_).reservation_;
+
+  // Trigger hit bits and icount counts change without a CSR write.
+  record.hasTriggerState = enableTriggers_;
+  if (enableTriggers_)
+    csRegs_.saveTriggers(record.triggerState);
+
+  record.traceSize = traceBuffer_.size();
+}
+
+
+template <typename URV>
+void
+Hart<URV>::collectUndoData(UndoRecord& record) const
+{
+  record.hasIntReg = intRegs_.getLastWrittenReg(record.intRegIx,
+						record.intRegValue);
+
+  record.hasFpReg = fpRegs_.getLastWrittenReg(record.fpRegIx,
+					      record.fpRegValue);
+
+  record.memSize = memory_.getLastWriteOldValue(localHartId_, record.memAddr,
+						record.memValue);
+
+  csRegs_.getLastWrittenRegs(record.csrIx, record.triggers);
+  record.csrValue.clear();
+  for (auto csrn : record.csrIx)
+    {
+      const Csr<URV>* csr = csRegs_.getImplementedCsr(csrn);
+      record.csrValue.push_back(csr? csr->prevValue() : 0);
+    }
+}
+
+
+template <typename URV>
+void
+Hart<URV>::undoStep(const UndoRecord& record)
+{
+  pc_ = record.pc;
+  instCounter_ = record.instCounter;
+  retiredInsts_ = record.retiredInsts;
+  cycleCount_ = record.cycleCount;
+  privMode_ = record.privMode;
+
+  if (record.hasIntReg)
+    pokeIntReg(record.intRegIx, record.intRegValue);
+
+  if (record.hasFpReg)
+    pokeFpReg(record.fpRegIx, record.fpRegValue);
+
+  // Restore memory as a poke would: Invalidate overlapping LR
+  // reservations and decoded instructions.
+  size_t addr = record.memAddr;
+  uint64_t value = record.memValue;
+  for (size_t i = 0; i < record.memSize; ++i)
+    {
+      uint8_t byte = value & 0xff;
+      pokeMemory(addr, byte);
+      addr++;
+      value = value >> 8;
+    }
+
+  {
+    std::lock_guard<std::mutex> lock(memory_.lrMutex_);
+    memory_.hartData_.at(localHartId_).reservation_ = record.reservation;
+  }
+
+  // Restore raw value of each CSR then poke it (same value) to update
+  // the hart state derived from it.
+  for (size_t i = 0; i < record.csrIx.size(); ++i)
+    {
+      CsrNumber csrn = record.csrIx.at(i);
+      Csr<URV>* csr = csRegs_.getImplementedCsr(csrn);
+      if (not csr)
+	continue;
+      URV oldVal = record.csrValue.at(i);
+      csr->pokeNoMask(oldVal);
+      pokeCsr(csrn, oldVal);
+    }
+
+  if (record.hasTriggerState)
+    csRegs_.restoreTriggers(record.triggerState);
+
+  if (loadQueueEnabled_)
+    loadQueue_ = record.loadQueue;
+
+  if (traceHeld_ and record.traceSize < traceBuffer_.size())
+    traceBuffer_.resize(record.traceSize);
+
+  clearTraceData();
+}
+
+
 template <typename URV>
 void
 Hart<URV>::setInvalidInFcsr()
@@ -32,6 +32,7 @@
 #include "InstProfile.hpp"
 #include "DecodedInst.hpp"
 #include "Syscall.hpp"
+#include "Trace.hpp"
 
 namespace WdRiscv
 {
@@ -316,6 +317,11 @@ namespace WdRiscv
     /// tracing information related to the executed instruction.
     void singleStep(FILE* file = nullptr);
 
+    /// Helper to singleStep and runUntil: Same as singleStep but, if
+    /// useCache is true, decode using the decode cache. Text trace is
+    /// left in the trace buffer (see flushTraceBuffer).
+    void singleStep(FILE* file, bool useCache);
+
     /// Determine the effect of instruction fetching and discarding n
     /// bytes (where n is the instruction size of the given
     /// instruction) from memory and then executing the given
@@ -348,6 +354,56 @@ namespace WdRiscv
     /// print run-time and instructions per second.
     bool untilAddress(URV address, FILE* file = nullptr);
 
+    /// Helper to run method: Run until the program counter reaches the
+    /// given address, the instruction count limit is reached, or
+    /// tohost is written. Instructions inside the trace window (see
+    /// setTraceInstWindow and addTracePcRange) are executed with
+    /// tracing to the given file, the others are executed in fast
+    /// mode.
+    bool runTraceWindow(URV address, FILE* file);
+
+    /// Stop conditions of the runUntil method.
+    struct RunConditions
+    {
+      /// Remove all the conditions and set the instruction count
+      /// limit to the given count (no limit if zero). Keep the
+      /// allocated storage.
+      void reset(uint64_t count);
+
+      /// Add the condition defined by the resource, address and value
+      /// of a run-until condition record (see RunUntil in
+      /// WhisperMessage.h). Return false if the resource is not valid.
+      bool add(uint32_t resource, uint64_t address, uint64_t value);
+
+      /// Complete the definition of the conditions once all have been
+      /// added.
+      void finish();
+
+      std::vector<URV> pcs;     // Breakpoint addresses in ascending order.
+      uint64_t maxCount = ~uint64_t(0);  // Instruction count limit.
+      std::vector< std::pair<size_t, size_t> > memRanges; // Inclusive.
+      bool watchCsrs = false;   // Stop on CSR writes if true.
+      bool anyCsr = false;      // Watch all CSRs.
+      std::vector<CsrNumber> csrs;  // Watched CSRs. Empty: Any CSR.
+    };
+
+    /// Reason for the runUntil method to stop.
+    enum class RunStop { Count, Pc, MemoryWrite, CsrWrite, DebugMode,
+			 Finished };
+
+    /// Execute instructions (as singleStep would) until: the maximum
+    /// count is reached, the pc reaches one of the given breakpoint
+    /// addresses, an instruction writes memory overlapping one of the
+    /// given ranges, an instruction writes a watched CSR, the hart
+    /// enters debug mode or the target program finishes. Execute at
+    /// least one instruction unless the maximum count is zero or the
+    /// program has already finished. The changes of the last executed
+    /// instruction are kept (see lastCsr, lastMemory). Set count to
+    /// the number of executed instructions and return the reason for
+    /// stopping.
+    RunStop runUntil(const RunConditions& conditions, FILE* file,
+		     uint64_t& count);
+
     /// Define the program counter value at which the run method will
     /// stop.
     void setStopAddress(URV address)
@@ -393,6 +449,13 @@ namespace WdRiscv
     /// string.
     void disassembleInst(const DecodedInst& di, std::string& str);
 
+    /// Disassemble given instruction into the given character buffer
+    /// of the given size (at least 1) without allocating memory.
+    /// The text is null-terminated and truncated if it does not fit
+    /// (128 characters are enough for any instruction). Return the
+    /// length of the text.
+    size_t disassembleInst(const DecodedInst& di, char* buffer, size_t size);
+
     /// Decode given instruction returning a pointer to the
     /// instruction information and filling op0, op1 and op2 with the
     /// corresponding operand specifier values. For example, if inst
@@ -634,6 +697,95 @@ namespace WdRiscv
     void setTraceLoadStore(bool flag)
     { traceLdSt_ = flag; }
 
+    /// Write the instruction trace in binary form (see
+    /// BinaryTraceWriter) using the given writer instead of printing
+    /// text to the trace file. Writer must wrap the trace file passed
+    /// to the run/step methods. Pass null to revert to text.
+    void setBinaryTraceWriter(BinaryTraceWriter* writer)
+    { binaryTrace_ = writer; }
+
+    /// Push the instruction trace records of this hart into the ring
+    /// of the given source of the given asynchronous tracer instead of
+    /// formatting and writing them (see AsyncTracer). Takes precedence
+    /// over the binary trace writer. Pass null to revert to
+    /// synchronous tracing.
+    void setAsyncTracer(AsyncTracer* tracer, unsigned source)
+    { asyncTrace_ = tracer; asyncTraceSource_ = source; }
+
+    /// Write the instruction trace in columnar form (see
+    /// ColumnTraceWriter) using the given writer instead of printing
+    /// text to the trace file. Pass null to revert to text.
+    void setColumnTraceWriter(ColumnTraceWriter* writer)
+    { columnTrace_ = writer; }
+
+    /// Write to the trace file the text trace lines accumulated by
+    /// this hart. Text trace lines are buffered and written in bulk:
+    /// The buffer is flushed when large, when the trace file changes
+    /// and on exit from the run and step methods.
+    void flushTraceBuffer();
+
+    /// Restrict the instruction trace to the instructions with rank
+    /// (trace tag) between begin and end inclusive. The run method
+    /// executes the instructions outside the trace window in fast
+    /// (no trace) mode.
+    void setTraceInstWindow(uint64_t begin, uint64_t end)
+    {
+      traceBegin_ = begin; traceEnd_ = end;
+      traceFiltered_ = true;
+    }
+
+    /// Restrict the instruction trace to the instructions with a
+    /// program counter between low and high inclusive. May be called
+    /// more than once: An instruction is traced if it falls in any of
+    /// the ranges.
+    void addTracePcRange(URV low, URV high)
+    {
+      tracePcRanges_.push_back(std::make_pair(low, high));
+      traceFiltered_ = true;
+    }
+
+    /// Restrict the instruction trace to the instructions of the
+    /// function (ELF symbol) of the given name. Return false if
+    /// symbol is not found in the loaded ELF files.
+    bool addTraceFunction(const std::string& name);
+
+    /// Start with the instruction trace turned off and turn it on/off
+    /// when a trigger with a start-trace/stop-trace action trips. Such
+    /// triggers do not cause breakpoints.
+    void enableTraceTriggers(bool flag)
+    {
+      csRegs_.enableTriggerTraceActions(flag);
+      traceFiltered_ = traceFiltered_ or flag;
+    }
+
+    /// Keep the changes of the last count executed instructions (see
+    /// FlightRecorder) including in fast (no trace) mode. The kept
+    /// instructions are printed to the given file in the instruction
+    /// trace format when the run stops with a failure, on a keyboard
+    /// interrupt, or when the exception count reaches the limit set
+    /// by setFlightRecorderExceptionLimit. A count of zero disables
+    /// the flight recorder.
+    void enableFlightRecorder(size_t count, FILE* file)
+    { flightRecorder_.resize(count); flightFile_ = file; }
+
+    /// Dump the flight recorder once the number of exceptions taken
+    /// by this hart reaches the given count.
+    void setFlightRecorderExceptionLimit(uint64_t count)
+    { flightExceptionLimit_ = count; }
+
+    /// Print the instructions kept by the flight recorder to its
+    /// file and clear the recorder. Reason is reported on the
+    /// standard error stream. Do nothing if the recorder is disabled
+    /// or empty.
+    void dumpFlightRecorder(const char* reason);
+
+    /// Fill the given record with the changes made by the given
+    /// instruction (assumed to have just executed) as reported in
+    /// the instruction trace. Tag is the record tag (see
+    /// printInstTrace).
+    void collectTraceRecord(const DecodedInst& di, uint64_t tag,
+			    bool interrupt, TraceRecord& rec);
+
     /// Return count of traps (exceptions or interrupts) seen by this
     /// hart.
     uint64_t getTrapCount() const
@@ -791,7 +943,7 @@ namespace WdRiscv
     /// Enable use of ABI register names (e.g. sp instead of x2) in
     /// instruction disassembly.
     void enableAbiNames(bool flag)
-    { abiNames_ = flag; }
+    { abiNames_ = flag; disasCache_.clear(); }
 
     /// Return true if ABI register names are enabled.
     bool abiNames() const
@@ -1025,6 +1177,66 @@ namespace WdRiscv
     /// present.
     bool simpleRunNoLimit();
 
+    /// Helper to runTraceWindow: Run in fast mode until the next
+    /// instruction is in the trace window, the program counter reaches
+    /// the given address, or the instruction count limit is reached.
+    /// Feed the flight recorder if it is enabled.
+    void simpleRunToTraceWindow(URV address);
+
+    /// Helper to simpleRun method when the flight recorder is enabled.
+    bool simpleRunFlight();
+
+    /// Helper to runUntil: Return true if the next instructions can be
+    /// executed by runUntilFast: No trace, no active triggers and no
+    /// other per-instruction bookkeeping (statistics, counters, debug
+    /// single step, ...).
+    bool canRunUntilFast(FILE* traceFile) const;
+
+    /// Helper to runUntil: Execute instructions in a simpleRun-style
+    /// loop incrementing count for each. Return true setting stop if
+    /// one of the given conditions is met. Return false if an
+    /// instruction wrote a CSR (or took a trap) since that may
+    /// disable the fast path (see canRunUntilFast).
+    bool runUntilFast(const RunConditions& conditions, uint64_t& count,
+		      RunStop& stop);
+
+    /// Helper to runUntil: Return true setting stop if the last
+    /// executed instruction met one of the given conditions.
+    /// WasInDebug is true if the hart was in debug mode before that
+    /// instruction.
+    bool runUntilStopped(const RunConditions& conditions, bool wasInDebug,
+			 RunStop& stop);
+
+    /// Helper to singleStep and runUntilFast: Update the load queue
+    /// after the given non-load instruction executed.
+    void updateLoadQueue(const DecodedInst& di);
+
+    /// Add the changes of the given instruction (assumed to have just
+    /// executed) to the flight recorder. Dump the recorder if the
+    /// exception limit is reached.
+    void recordFlight(const DecodedInst& di);
+
+    /// Return the disassembly of the given instruction. The text is
+    /// memoized (see DisasCache) so that an instruction executed
+    /// many times is disassembled once.
+    const std::string& disassembleCached(const DecodedInst& di);
+
+    /// Return true if the instruction at the given pc with the given
+    /// rank (trace tag) is in the trace window.
+    bool inTraceWindow(URV pc, uint64_t rank) const
+    {
+      if (rank < traceBegin_ or rank > traceEnd_)
+	return false;
+      if (not csRegs_.isTriggerTraceOn())
+	return false;
+      if (tracePcRanges_.empty())
+	return true;
+      for (const auto& range : tracePcRanges_)
+	if (pc >= range.first and pc <= range.second)
+	  return true;
+      return false;
+    }
+
     /// Helper to decode. Used for compressed instructions.
     const InstEntry& decode16(uint16_t inst, uint32_t& op0, uint32_t& op1,
 			      uint32_t& op2);
@@ -1270,16 +1482,15 @@ namespace WdRiscv
     /// Write trace information about the given instruction to the
     /// given file. This is assumed to be called after instruction
     /// execution. Tag is the record tag (the retired instruction
-    /// count after instruction is executed). Tmp is a temporary
-    /// string (for performance).
-    void printInstTrace(const DecodedInst& di, uint64_t tag, std::string& tmp,
-			FILE* out, bool interrupt = false);
+    /// count after instruction is executed).
+    void printInstTrace(const DecodedInst& di, uint64_t tag, FILE* out,
+			bool interrupt = false);
 
     /// Variant of the above for cases where the trace is printed
     /// before decode. If the instruction is not available then a zero
     /// (illegal) should be passed.
-    void printInstTrace(uint32_t instruction, uint64_t tag, std::string& tmp,
-			FILE* out, bool interrupt = false);
+    void printInstTrace(uint32_t instruction, uint64_t tag, FILE* out,
+			bool interrupt = false);
 
     /// Start a synchronous exceptions.
     void initiateException(ExceptionCause cause, URV pc, URV info,
@@ -1305,7 +1516,7 @@ namespace WdRiscv
     /// interrupt is pending and interrupts are enabled, then take
     /// it. Return true if an nmi or an interrupt is taken and false
     /// otherwise.
-    bool processExternalInterrupt(FILE* traceFile, std::string& insStr);
+    bool processExternalInterrupt(FILE* traceFile);
 
     /// Helper to FP execution: Set the invalid bit in FCSR.
     void setInvalidInFcsr();
@@ -1686,6 +1897,78 @@ namespace WdRiscv
       bool wide_ = false;
     };
 
+  public:
+
+    /// Hart state overwritten by the execution of one instruction:
+    /// Enough to roll back that instruction (see undoStep). Used for
+    /// speculative stepping in server mode. Event-based performance
+    /// counters are not rolled back.
+    struct UndoRecord
+    {
+      URV pc = 0;                  // Value of pc before instruction.
+      uint64_t instCounter = 0;    // Retired count before instruction.
+      uint64_t retiredInsts = 0;   // Minstret before instruction.
+      uint64_t cycleCount = 0;     // Mcycle before instruction.
+      PrivilegeMode privMode = PrivilegeMode::Machine;
+
+      bool hasIntReg = false;      // True if an integer register changed.
+      unsigned intRegIx = 0;       // Number of changed integer register.
+      URV intRegValue = 0;         // Previous value of changed register.
+
+      bool hasFpReg = false;       // True if an FP register changed.
+      unsigned fpRegIx = 0;        // Number of changed fp register.
+      uint64_t fpRegValue = 0;     // Previous value of changed register.
+
+      unsigned memSize = 0;        // Size of changed memory (0 if none).
+      size_t memAddr = 0;          // Address of changed memory.
+      uint64_t memValue = 0;       // Previous value of changed memory.
+
+      std::vector<CsrNumber> csrIx;  // Numbers of changed CSRs.
+      std::vector<URV> csrValue;     // Previous values of changed CSRs.
+      std::vector<unsigned> triggers;
+
+      std::vector<LoadInfo> loadQueue; // Load queue before instruction.
+
+      Memory::Reservation reservation;  // LR reservation before instruction.
+
+      bool hasTriggerState = false;  // True if triggerState is valid.
+      Triggers<URV> triggerState;    // Triggers before instruction.
+
+      size_t traceSize = 0;        // Size of held text trace before instruction.
+    };
+
+    /// Save in the given record the parts of the state of this hart
+    /// that are not recoverable from the trace data of the next
+    /// instruction. To roll back an instruction, call this before
+    /// singleStep, then call collectUndoData after singleStep (and
+    /// before clearTraceData).
+    void saveUndoState(UndoRecord& record) const;
+
+    /// Complete the given record (see saveUndoState) with the previous
+    /// values of the resources changed by the last executed
+    /// instruction.
+    void collectUndoData(UndoRecord& record) const;
+
+    /// Restore the state saved in the given record undoing the
+    /// corresponding instruction. Instructions must be undone in
+    /// reverse order of execution. The text trace lines of the
+    /// instruction are dropped if the trace is held (see holdTrace).
+    void undoStep(const UndoRecord& record);
+
+    /// Hold (flag true) the text trace lines accumulated by this hart
+    /// in its trace buffer instead of writing them to the trace
+    /// file. Releasing (flag false) writes them. Used to keep the
+    /// trace of speculative instructions until they are committed.
+    /// Binary, columnar and asynchronous traces are not held.
+    void holdTrace(bool flag)
+    {
+      traceHeld_ = flag;
+      if (not flag)
+	flushTraceBuffer();
+    }
+
+  private:
+
     void putInLoadQueue(unsigned size, size_t addr, unsigned regIx,
 			uint64_t prevData, bool isWide = false);
 
@@ -1790,6 +2073,28 @@ namespace WdRiscv
     bool traceLdSt_ = false;        // Trace addr of ld/st insts if true.
     URV ldStAddr_ = 0;              // Address of data of most recent ld/st inst.
     bool ldStAddrValid_ = false;    // True if ldStAddr_ valid.
+    BinaryTraceWriter* binaryTrace_ = nullptr;  // Binary trace if not null.
+    AsyncTracer* asyncTrace_ = nullptr;         // Async trace if not null.
+    unsigned asyncTraceSource_ = 0;             // Source index in asyncTrace_.
+    ColumnTraceWriter* columnTrace_ = nullptr;  // Columnar trace if not null.
+    TraceRecord traceRecord_;       // Reused by printInstTrace.
+    std::vector<CsrNumber> traceCsrs_;       // Scratch for collectTraceRecord.
+    std::vector<unsigned> traceTriggers_;    // Scratch for collectTraceRecord.
+    bool warnedDroppedCsrs_ = false;         // See collectTraceRecord.
+    std::string traceBuffer_;       // Buffered text trace (see flushTraceBuffer).
+    DisasCache disasCache_;         // Memoized disassembly of traced instructions.
+    FILE* traceBufferFile_ = nullptr;        // File of buffered text trace.
+    size_t traceBufferLimit_ = 256*1024;     // Flush threshold of traceBuffer_.
+    bool traceHeld_ = false;        // Do not flush traceBuffer_ (see holdTrace).
+    bool traceFiltered_ = false;    // True if trace is windowed/filtered.
+    bool traceWindowExit_ = false;  // Leave untilAddress outside window.
+    bool traceWindowLeft_ = false;  // untilAddress left the trace window.
+    uint64_t traceBegin_ = 0;       // Rank of first traced instruction.
+    uint64_t traceEnd_ = ~uint64_t(0);  // Rank of last traced instruction.
+    std::vector<std::pair<URV, URV>> tracePcRanges_;  // Traced pc ranges.
+    FlightRecorder flightRecorder_;   // Last executed instructions.
+    FILE* flightFile_ = nullptr;      // Flight recorder dump file.
+    uint64_t flightExceptionLimit_ = ~uint64_t(0);  // Dump at this count.
 
     // We keep track of the last committed 8 loads so that we can
     // revert in the case of an imprecise load exception.
@@ -1823,7 +2128,7 @@ namespace WdRiscv
 
     int gdbSocket_ = -1;
 
-    InstTable instTable_;
+    const InstTable& instTable_;  // Immutable: Shared by all harts.
     std::vector<InstProfile> instProfileVec_; // Instruction frequency
 
     std::vector<uint64_t> interruptStat_;  // Count of different types of interrupts.
@@ -30,19 +30,17 @@ IntRegs<URV>::IntRegs(unsigned regCount)
 
   for (unsigned ix = 0; ix < 32; ++ix)
     {
-      std::string name = "x" + std::to_string(ix);
+      std::string name = staticRegName(ix);
       nameToNumber_[name] = IntRegNumber(ix);
       numberToName_[ix] = name;
     }
 
-  numberToAbiName_ = { "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2",
-		       "s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
-		       "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7",
-		       "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6" };
+  numberToAbiName_.resize(32);
 
   for (unsigned ix = 0; ix < 32; ++ix)
     {
-      std::string abiName = numberToAbiName_.at(ix);
+      std::string abiName = staticRegName(ix, true);
+      numberToAbiName_[ix] = abiName;
       nameToNumber_[abiName] = IntRegNumber(ix);
     }
 
@@ -23,7 +23,9 @@
 #include <boost/lexical_cast.hpp>
 #include <boost/format.hpp>
 #include <boost/algorithm/string.hpp>
+#include "WhisperMessage.h"
 #include "Interactive.hpp"
+#include "Server.hpp"
 #include "linenoise.hpp"
 
 using namespace WdRiscv;
@@ -1304,9 +1306,13 @@ Interactive<URV>::executeLine(unsigned& currentHartId,
 
   if (command == "run")
     {
+      uint64_t count0 = hart.getInstructionCount();
       bool success = hart.run(traceFile);
       if (commandLog)
 	fprintf(commandLog, "%s\n", outLine.c_str());
+      if (binaryLog_)
+	logBinaryCommand(hart, hartId, tokens,
+			 hart.getInstructionCount() - count0);
       return success;
     }
 
@@ -1316,6 +1322,8 @@ Interactive<URV>::executeLine(unsigned& currentHartId,
 	return false;
       if (commandLog)
 	fprintf(commandLog, "%s\n", outLine.c_str());
+      if (binaryLog_)
+	logBinaryCommand(hart, hartId, tokens);
       return true;
     }
 
@@ -1330,6 +1338,8 @@ Interactive<URV>::executeLine(unsigned& currentHartId,
 	return false;
       if (commandLog)
 	fprintf(commandLog, "%s\n", outLine.c_str());
+      if (binaryLog_)
+	logBinaryCommand(hart, hartId, tokens);
       return true;
     }
 
@@ -1348,6 +1358,8 @@ Interactive<URV>::executeLine(unsigned& currentHartId,
 	return false;
       if (commandLog)
 	fprintf(commandLog, "%s\n", outLine.c_str());
+      if (binaryLog_)
+	logBinaryCommand(hart, hartId, tokens);
       return true;
     }
 
@@ -1357,6 +1369,8 @@ Interactive<URV>::executeLine(unsigned& currentHartId,
 	return false;
       if (commandLog)
 	fprintf(commandLog, "%s\n", outLine.c_str());
+      if (binaryLog_)
+	logBinaryCommand(hart, hartId, tokens);
       return true;
     }
 
@@ -1366,6 +1380,8 @@ Interactive<URV>::executeLine(unsigned& currentHartId,
 	return false;
       if (commandLog)
 	fprintf(commandLog, "%s\n", outLine.c_str());
+      if (binaryLog_)
+	logBinaryCommand(hart, hartId, tokens);
       return true;
     }
 
@@ -1375,6 +1391,8 @@ Interactive<URV>::executeLine(unsigned& currentHartId,
 	return false;
       if (commandLog)
 	fprintf(commandLog, "%s\n", outLine.c_str());
+      if (binaryLog_)
+	logBinaryCommand(hart, hartId, tokens);
       return true;
     }
 
@@ -1382,6 +1400,8 @@ Interactive<URV>::executeLine(unsigned& currentHartId,
     {
       if (commandLog)
 	fprintf(commandLog, "%s\n", outLine.c_str());
+      if (binaryLog_)
+	logBinaryCommand(hart, hartId, tokens);
       done = true;
       return true;
     }
@@ -1392,6 +1412,8 @@ Interactive<URV>::executeLine(unsigned& currentHartId,
 	return false;
       if (commandLog)
 	fprintf(commandLog, "%s\n", outLine.c_str());
+      if (binaryLog_)
+	logBinaryCommand(hart, hartId, tokens);
       return true;
     }
 
@@ -1401,6 +1423,8 @@ Interactive<URV>::executeLine(unsigned& currentHartId,
 	return false;
       if (commandLog)
 	fprintf(commandLog, "%s\n", outLine.c_str());
+      if (binaryLog_)
+	logBinaryCommand(hart, hartId, tokens);
       return true;
     }
 
@@ -1409,6 +1433,8 @@ Interactive<URV>::executeLine(unsigned& currentHartId,
       hart.enterDebugMode(hart.peekPc());
       if (commandLog)
 	fprintf(commandLog, "%s\n", outLine.c_str());
+      if (binaryLog_)
+	logBinaryCommand(hart, hartId, tokens);
       return true;
     }
 
@@ -1417,6 +1443,8 @@ Interactive<URV>::executeLine(unsigned& currentHartId,
       hart.exitDebugMode();
       if (commandLog)
 	fprintf(commandLog, "%s\n", outLine.c_str());
+      if (binaryLog_)
+	logBinaryCommand(hart, hartId, tokens);
       return true;
     }
 
@@ -1426,6 +1454,8 @@ Interactive<URV>::executeLine(unsigned& currentHartId,
 	return false;
       if (commandLog)
 	fprintf(commandLog, "%s\n", outLine.c_str());
+      if (binaryLog_)
+	logBinaryCommand(hart, hartId, tokens);
       return true;
     }
 
@@ -1435,6 +1465,8 @@ Interactive<URV>::executeLine(unsigned& currentHartId,
         std::cerr << "Warning: Unexpected cancel_div\n";
       if (commandLog)
 	fprintf(commandLog, "%s\n", outLine.c_str());
+      if (binaryLog_)
+	logBinaryCommand(hart, hartId, tokens);
       return true;
     }
 
@@ -1443,6 +1475,8 @@ Interactive<URV>::executeLine(unsigned& currentHartId,
       hart.cancelLr();
       if (commandLog)
 	fprintf(commandLog, "%s\n", outLine.c_str());
+      if (binaryLog_)
+	logBinaryCommand(hart, hartId, tokens);
       return true;
     }
 
@@ -1483,6 +1517,155 @@ Interactive<URV>::executeLine(unsigned& currentHartId,
 }
 
 
+/// Translate an interactive command to the equivalent server request
+/// and append it to the binary command log.
+template <typename URV>
+void
+Interactive<URV>::logBinaryCommand(Hart<URV>& hart, unsigned hartId,
+				   const std::vector<std::string>& tokens,
+				   uint64_t runCount)
+{
+  const std::string& command = tokens.front();
+  size_t count = tokens.size();
+
+  WhisperMessage msg(hartId);
+  bool ok = true;
+
+  if (command == "s" or command == "step")
+    {
+      msg.type = StepBatch;
+      msg.value = 1;
+      if (count > 1)
+	ok = parseCmdLineNumber("instruction-count", tokens.at(1), msg.value);
+    }
+  else if (command == "run")
+    {
+      // A run-until without conditions stops after the given number
+      // of instructions: Replay executes as many as the run did.
+      msg.type = RunUntil;
+      msg.value = runCount;
+      if (runCount == 0)
+	return;
+    }
+  else if (command == "u" or command == "until")
+    {
+      msg.type = Until;
+      ok = parseCmdLineNumber("address", tokens.at(1), msg.address);
+    }
+  else if (command == "poke")
+    {
+      msg.type = Poke;
+      const std::string& resource = tokens.at(1);
+      if (resource == "pc")
+	{
+	  msg.resource = 'p';
+	  ok = parseCmdLineNumber("pc", tokens.at(2), msg.value);
+	}
+      else if (resource == "t")
+	ok = false;
+      else
+	{
+	  msg.resource = resource.at(0);
+	  ok = parseCmdLineNumber("poke", tokens.at(3), msg.value);
+	  const std::string& addrStr = tokens.at(2);
+	  unsigned reg = 0;
+	  if (resource == "r")
+	    ok = ok and hart.findIntReg(addrStr, reg);
+	  else if (resource == "f")
+	    ok = ok and hart.findFpReg(addrStr, reg);
+	  else if (resource == "c")
+	    {
+	      auto csr = hart.findCsr(addrStr);
+	      ok = ok and csr;
+	      if (csr)
+		reg = unsigned(csr->getNumber());
+	    }
+	  msg.address = reg;
+	  if (resource == "m")
+	    ok = ok and parseCmdLineNumber("address", addrStr, msg.address);
+	}
+    }
+  else if (command == "reset")
+    {
+      msg.type = Reset;
+      if (count == 2)
+	{
+	  msg.value = 1;
+	  ok = parseCmdLineNumber("reset-pc", tokens.at(1), msg.address);
+	}
+    }
+  else if (command == "exception")
+    {
+      msg.type = Exception;
+      const std::string& tag = tokens.at(1);
+      if (tag == "inst" or tag == "data")
+	{
+	  msg.value = tag == "inst"? InstAccessFault : DataAccessFault;
+	  if (count == 3)
+	    ok = parseCmdLineNumber("offset", tokens.at(2), msg.address);
+	}
+      else if (tag == "store")
+	{
+	  msg.value = ImpreciseStoreFault;
+	  ok = parseCmdLineNumber("address", tokens.at(2), msg.address);
+	}
+      else if (tag == "load")
+	{
+	  msg.value = ImpreciseLoadFault;
+	  ok = parseCmdLineNumber("address", tokens.at(2), msg.address);
+	  ok = ok and parseCmdLineNumber("tag", tokens.at(3), msg.flags);
+	}
+      else if (tag == "nmi")
+	{
+	  msg.value = NonMaskableInterrupt;
+	  ok = parseCmdLineNumber("nmi", tokens.at(2), msg.address);
+	}
+      else
+	return;  // No-op commands (memory_data, memory_inst).
+    }
+  else if (command == "enter_debug")
+    msg.type = EnterDebug;
+  else if (command == "exit_debug")
+    msg.type = ExitDebug;
+  else if (command == "load_finished")
+    {
+      msg.type = LoadFinished;
+      ok = parseCmdLineNumber("address", tokens.at(1), msg.address);
+      ok = ok and parseCmdLineNumber("tag", tokens.at(2), msg.flags);
+    }
+  else if (command == "cancel_div")
+    msg.type = CancelDiv;
+  else if (command == "cancel_lr")
+    msg.type = CancelLr;
+  else if (command == "q" or command == "quit")
+    msg.type = Quit;
+  else if (command == "d" or command == "disas")
+    return;  // No state change.
+  else
+    ok = false;
+
+  if (not ok)
+    {
+      std::cerr << "Warning: Command " << command << " not recorded in "
+		<< "binary command log\n";
+      return;
+    }
+
+  // A step of more than WHISPER_STEP_BATCH_MAX instructions is
+  // recorded as several batches.
+  if (msg.type == StepBatch)
+    for ( ; msg.value > WHISPER_STEP_BATCH_MAX;
+	  msg.value -= WHISPER_STEP_BATCH_MAX)
+      {
+	WhisperMessage batch = msg;
+	batch.value = WHISPER_STEP_BATCH_MAX;
+	writeBinaryCommand(binaryLog_, batch);
+      }
+
+  writeBinaryCommand(binaryLog_, msg);
+}
+
+
 /// Interactive "replay" command.
 template <typename URV>
 bool
@@ -47,6 +47,12 @@ namespace WdRiscv
     /// Return false otherwise.
     bool interact(FILE* traceFile, FILE* commandLog);
 
+    /// Record each executed command (converted to the equivalent
+    /// server request) in the given binary command log file (no
+    /// recording if null). See WHISPER_BINARY_LOG_MAGIC.
+    void setBinaryCommandLog(FILE* binaryLog)
+    { binaryLog_ = binaryLog; }
+
     /// Helper to interact: "until" command. Run until address.
     bool untilCommand(Hart<URV>&, const std::string& line,
 		     const std::vector<std::string>& tokens,
@@ -110,6 +116,13 @@ namespace WdRiscv
 
   protected:
 
+    /// Helper to executeLine: Record the given successfully executed
+    /// command in the binary command log. The runCount is the number
+    /// of instructions executed by a "run" command.
+    void logBinaryCommand(Hart<URV>&, unsigned hartId,
+			  const std::vector<std::string>& tokens,
+			  uint64_t runCount = 0);
+
     /// Helper to interact. Execute a user command.
     bool executeLine(unsigned& currentHartId,
 		     const std::string& inLine, FILE* traceFile,
@@ -122,6 +135,8 @@ namespace WdRiscv
 
     // Initial resets do not reset memory mapped registers.
     bool resetMemoryMappedRegs_ = false;
+
+    FILE* binaryLog_ = nullptr;
   };
 
 }
@@ -34,8 +34,7 @@ using namespace WdRiscv;
 
 
 Memory::Memory(size_t size, size_t pageSize, size_t regionSize)
-  : size_(size), data_(nullptr), pageSize_(pageSize), reservations_(1),
-    lastWriteData_(1)
+  : size_(size), data_(nullptr), pageSize_(pageSize), hartData_(1)
 { 
   if ((size & 4) != 0)
     {
@@ -371,7 +370,7 @@ Memory::loadElfFile(const std::string& fileName, unsigned regWidth,
 
   // In case writing ELF data modified last-written-data associated
   // with each hart.
-  for (unsigned hartId = 0; hartId < reservations_.size(); ++hartId)
+  for (unsigned hartId = 0; hartId < hartData_.size(); ++hartId)
     clearLastWriteInfo(hartId);
 
   // Collect symbols.
@@ -158,7 +158,7 @@ namespace WdRiscv
     /// Define number of hardware threads for LR/SC. FIX: put this in
     /// constructor.
     void setHartCount(unsigned count)
-    { reservations_.resize(count); lastWriteData_.resize(count); }
+    { hartData_.resize(count); }
 
     /// Return memory size in bytes.
     size_t size() const
@@ -377,7 +377,7 @@ namespace WdRiscv
       else if (attrib1.isMemMappedReg())
 	return false;
 
-      auto& lwd = lastWriteData_.at(localHartId);
+      auto& lwd = hartData_.at(localHartId).lastWrite_;
       lwd.prevValue_ = *(reinterpret_cast<T*>(data_ + address));
       lwd.size_ = sizeof(T);
       lwd.addr_ = address;
@@ -401,7 +401,7 @@ namespace WdRiscv
       if (attrib.isMemMappedReg())
 	return false;  // Only word access allowed to memory mapped regs.
 
-      auto& lwd = lastWriteData_.at(localHartId);
+      auto& lwd = hartData_.at(localHartId).lastWrite_;
       lwd.prevValue_ = *(data_ + address);
 
       data_[address] = value;
@@ -552,7 +552,7 @@ namespace WdRiscv
     /// which case addr and value are not modified.
     unsigned getLastWriteNewValue(unsigned localHartId, size_t& addr, uint64_t& value) const
     {
-      const auto& lwd = lastWriteData_.at(localHartId);
+      const auto& lwd = hartData_.at(localHartId).lastWrite_;
       if (lwd.size_)
 	{
 	  addr = lwd.addr_;
@@ -569,11 +569,11 @@ namespace WdRiscv
     unsigned getLastWriteOldValue(unsigned localHartId, size_t& addr,
                                   uint64_t& value) const
     {
-      auto& lwd = lastWriteData_.at(localHartId);
+      auto& lwd = hartData_.at(localHartId).lastWrite_;
       if (lwd.size_)
 	{
 	  addr = lwd.addr_;
-	  value = lwd.value_;
+	  value = lwd.prevValue_;
 	}
       return lwd.size_;
     }
@@ -581,7 +581,7 @@ namespace WdRiscv
     /// Clear the information associated with last write.
     void clearLastWriteInfo(unsigned localHartId)
     {
-      auto& lwd = lastWriteData_.at(localHartId);
+      auto& lwd = hartData_.at(localHartId).lastWrite_;
       lwd.size_ = 0;
     }
 
@@ -694,7 +694,7 @@ namespace WdRiscv
 
       value = doRegisterMasking(addr, value);
 
-      auto& lwd = lastWriteData_.at(localHartId);
+      auto& lwd = hartData_.at(localHartId).lastWrite_;
       lwd.prevValue_ = *(reinterpret_cast<uint32_t*>(data_ + addr));
 
       *(reinterpret_cast<uint32_t*>(data_ + addr)) = value;
@@ -794,10 +794,10 @@ namespace WdRiscv
     void invalidateOtherHartLr(unsigned localHartId, size_t addr,
                                unsigned storeSize)
     {
-      for (size_t i = 0; i < reservations_.size(); ++i)
+      for (size_t i = 0; i < hartData_.size(); ++i)
         {
           if (i == localHartId) continue;
-          auto& res = reservations_[i];
+          auto& res = hartData_[i].reservation_;
           if (addr >= res.addr_ and (addr - res.addr_) < res.size_)
             res.valid_ = false;
           else if (addr < res.addr_ and (res.addr_ - addr) < storeSize)
@@ -810,9 +810,9 @@ namespace WdRiscv
     /// local hart ids.
     void invalidateLrs(size_t addr, unsigned storeSize)
     {
-      for (size_t i = 0; i < reservations_.size(); ++i)
+      for (size_t i = 0; i < hartData_.size(); ++i)
         {
-          auto& res = reservations_[i];
+          auto& res = hartData_[i].reservation_;
           if (addr >= res.addr_ and (addr - res.addr_) < res.size_)
             res.valid_ = false;
           else if (addr < res.addr_ and (res.addr_ - addr) < storeSize)
@@ -822,12 +822,12 @@ namespace WdRiscv
 
     /// Invalidate LR reservation corresponding to the given hart.
     void invalidateLr(unsigned localHartId)
-    { reservations_.at(localHartId).valid_ = false; }
+    { hartData_.at(localHartId).reservation_.valid_ = false; }
 
     /// Make a LR reservation for the given hart.
     void makeLr(unsigned localHartId, size_t addr, unsigned size)
     {
-      auto& res = reservations_.at(localHartId);
+      auto& res = hartData_.at(localHartId).reservation_;
       res.addr_ = addr;
       res.size_ = size;
       res.valid_ = true;
@@ -837,7 +837,7 @@ namespace WdRiscv
     /// given address.
     bool hasLr(unsigned localHartId, size_t addr) const
     {
-      auto& res = reservations_.at(localHartId);
+      auto& res = hartData_.at(localHartId).reservation_;
       return res.valid_ and res.addr_ == addr;
     }
 
@@ -860,6 +860,15 @@ namespace WdRiscv
       uint64_t prevValue_ = 0;
     };
 
+    /// Per-hart mutable memory state. Each hart updates its own entry
+    /// on every store: Aligning entries to a cache line keeps harts
+    /// running in separate host threads from false-sharing a line.
+    struct alignas(64) HartData
+    {
+      Reservation reservation_;
+      LastWriteData lastWrite_;
+    };
+
     size_t size_;        // Size of memory in bytes.
     uint8_t* data_;      // Pointer to memory data.
 
@@ -890,7 +899,6 @@ namespace WdRiscv
 
     std::unordered_map<std::string, ElfSymbol> symbols_;
 
-    std::vector<Reservation> reservations_;
-    std::vector<LastWriteData> lastWriteData_;
+    std::vector<HartData> hartData_;  // One entry per hart.
   };
 }
@@ -18,7 +18,6 @@
 
 #include <iostream>
 #include <sstream>
-#include <map>
 #include <algorithm>
 #include <boost/format.hpp>
 #include <cstring>
@@ -33,6 +32,7 @@
 #include <cinttypes>
 
 #include "WhisperMessage.h"
+#include "WhisperShm.h"
 #include "Server.hpp"
 
 
@@ -190,13 +190,56 @@ serializeMessage(const WhisperMessage& msg, char buffer[],
 }
 
 
+/// Serialize the given WhisperMessage into the given buffer using
+/// compact framing (see WHISPER_COMPACT_SIZE): A 4-byte length
+/// followed by the serialized message leaving out the buffer and tag
+/// fields if they are all zeros. Return the number of bytes written
+/// into buffer.
+static
+size_t
+serializeFramedMessage(const WhisperMessage& msg, char buffer[],
+		       size_t bufferLen)
+{
+  assert (bufferLen >= sizeof(uint32_t) + sizeof(msg));
+
+  uint32_t len = WHISPER_COMPACT_SIZE;
+  for (char c : msg.buffer)
+    if (c)
+      len = sizeof(msg);
+  for (char c : msg.tag)
+    if (c)
+      len = sizeof(msg);
+
+  uint32_t x = htonl(len);
+  memcpy(buffer, &x, sizeof(x));
+  serializeMessage(msg, buffer + sizeof(x), bufferLen - sizeof(x));
+
+  return sizeof(x) + len;
+}
+
+
+/// Return true if given compact frame length is valid. Complain and
+/// return false otherwise.
+static
+bool
+checkFrameLength(uint32_t len)
+{
+  if (len == WHISPER_COMPACT_SIZE or len == sizeof(WhisperMessage))
+    return true;
+  std::cerr << "Invalid compact frame length: " << len << '\n';
+  return false;
+}
+
+
+/// Receive size bytes from given socket into buffer. Set closed to
+/// true if peer closes the socket before all bytes are received.
+/// Return true on success and false on failure.
 static bool
-receiveMessage(int soc, WhisperMessage& msg)
+receiveBytes(int soc, char* buffer, size_t size, bool& closed)
 {
-  char buffer[sizeof(msg)];
   char* p = buffer;
-
-  size_t remain = sizeof(msg);
+  size_t remain = size;
+  closed = false;
 
   while (remain > 0)
     {
@@ -210,29 +253,120 @@ receiveMessage(int soc, WhisperMessage& msg)
 	}
       if (l == 0)
 	{
-	  msg.type = Quit;
+	  closed = true;
 	  return true;
 	}
       remain -= l;
       p += l;
     }
 
+  return true;
+}
+
+
+static bool
+receiveMessage(int soc, WhisperMessage& msg)
+{
+  char buffer[sizeof(msg)];
+  bool closed = false;
+
+  if (not receiveBytes(soc, buffer, sizeof(buffer), closed))
+    return false;
+  if (closed)
+    {
+      msg.type = Quit;
+      return true;
+    }
+
   deserializeMessage(buffer, sizeof(buffer), msg);
 
   return true;
 }
 
 
+/// Same as receiveMessage but using compact framing.
 static bool
-sendMessage(int soc, WhisperMessage& msg)
+receiveFramedMessage(int soc, WhisperMessage& msg)
 {
-  char buffer[sizeof(msg)];
+  uint32_t len = 0;
+  bool closed = false;
 
-  serializeMessage(msg, buffer, sizeof(buffer));
+  if (not receiveBytes(soc, (char*) &len, sizeof(len), closed))
+    return false;
+  if (not closed)
+    {
+      len = ntohl(len);
+      if (not checkFrameLength(len))
+	return false;
+    }
 
-  // Send command.
-  ssize_t remain = sizeof(msg);
-  char* p = buffer;
+  char buffer[sizeof(msg)] = {};
+  if (not closed and not receiveBytes(soc, buffer, len, closed))
+    return false;
+  if (closed)
+    {
+      msg.type = Quit;
+      return true;
+    }
+
+  deserializeMessage(buffer, sizeof(buffer), msg);
+
+  return true;
+}
+
+
+/// Serialize the given change record appending the result to the
+/// given payload (see WhisperChangeRecord).
+static
+void
+serializeChangeRecord(uint32_t type, uint32_t resource, uint64_t address,
+		      uint64_t value, std::vector<char>& payload)
+{
+  uint32_t words[6] = { htonl(type), htonl(resource),
+			htonl(uint32_t(address >> 32)), htonl(uint32_t(address)),
+			htonl(uint32_t(value >> 32)), htonl(uint32_t(value)) };
+  const char* p = reinterpret_cast<const char*>(words);
+  payload.insert(payload.end(), p, p + sizeof(words));
+}
+
+
+/// Return the CRC-64 of the given bytes starting from the given crc
+/// value (0 for the first block of a sequence). ECMA-182 polynomial
+/// in reflected form with inverted input/output (same as xz).
+static
+uint64_t
+crc64(uint64_t crc, const uint8_t* data, size_t size)
+{
+  struct Table
+  {
+    Table()
+    {
+      for (unsigned i = 0; i < 256; ++i)
+	{
+	  uint64_t x = i;
+	  for (unsigned j = 0; j < 8; ++j)
+	    x = (x & 1) ? (x >> 1) ^ 0xc96c5795d7870f42ull : (x >> 1);
+	  entries[i] = x;
+	}
+    }
+
+    uint64_t entries[256];
+  };
+
+  static const Table table;
+
+  crc = ~crc;
+  for (size_t i = 0; i < size; ++i)
+    crc = table.entries[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  return ~crc;
+}
+
+
+static bool
+sendBytes(int soc, const char* buffer, size_t size)
+{
+  ssize_t remain = size;
+  const char* p = buffer;
   while (remain > 0)
     {
       ssize_t l = send(soc, p, remain , 0);
@@ -251,10 +385,257 @@ sendMessage(int soc, WhisperMessage& msg)
 }
 
 
+static bool
+sendMessage(int soc, WhisperMessage& msg)
+{
+  char buffer[sizeof(msg)];
+
+  serializeMessage(msg, buffer, sizeof(buffer));
+
+  // Send command.
+  return sendBytes(soc, buffer, sizeof(buffer));
+}
+
+
+namespace WdRiscv
+{
+
+  bool
+  writeBinaryLogHeader(FILE* file)
+  {
+    const char* magic = WHISPER_BINARY_LOG_MAGIC;
+    return fwrite(magic, strlen(magic), 1, file) == 1;
+  }
+
+
+  bool
+  writeBinaryCommand(FILE* file, const WhisperMessage& msg,
+		     const char* data, size_t size)
+  {
+    char buffer[sizeof(msg)];
+    serializeMessage(msg, buffer, sizeof(buffer));
+
+    // Keep a request and its data together if multiple connections
+    // are logging to the same file.
+#ifdef __MINGW64__
+    _lock_file(file);
+#else
+    flockfile(file);
+#endif
+    bool ok = fwrite(buffer, sizeof(buffer), 1, file) == 1;
+    if (ok and size)
+      ok = fwrite(data, size, 1, file) == 1;
+#ifdef __MINGW64__
+    _unlock_file(file);
+#else
+    funlockfile(file);
+#endif
+    return ok;
+  }
+
+
+  /// Server transport replaying the requests of a binary command log
+  /// file (see WHISPER_BINARY_LOG_MAGIC). Replies are discarded.
+  class FileChannel
+  {
+  public:
+
+    FileChannel(FILE* file)
+      : file_(file)
+    { }
+
+    /// Receive a message. Set message type to Quit at end of file.
+    bool receive(WhisperMessage& msg)
+    {
+      char buffer[sizeof(msg)];
+      if (fread(buffer, sizeof(buffer), 1, file_) != 1)
+	{
+	  msg.type = Quit;
+	  return true;
+	}
+      deserializeMessage(buffer, sizeof(buffer), msg);
+
+      // Replies are discarded: Skip disassembly.
+      if (msg.type == Step or msg.type == ChangeCount)
+	msg.flags |= NoDisassembly;
+      return true;
+    }
+
+    /// Discard given message.
+    bool send(WhisperMessage&)
+    { return true; }
+
+    /// Discard given bytes.
+    bool send(const char*, size_t)
+    { return true; }
+
+    /// Receive size bytes (variable-length part of a request).
+    bool receive(char* data, size_t size)
+    { return fread(data, 1, size, file_) == size; }
+
+  private:
+
+    FILE* file_;
+  };
+
+
+  /// Server transport over a connected stream socket.
+  class SocketChannel
+  {
+  public:
+
+    SocketChannel(int soc, bool compact)
+      : soc_(soc), compact_(compact)
+    { }
+
+    /// Receive a message. Set message type to Quit if the socket is
+    /// closed by the peer. Return true on success.
+    bool receive(WhisperMessage& msg)
+    {
+      if (compact_)
+	return receiveFramedMessage(soc_, msg);
+      return receiveMessage(soc_, msg);
+    }
+
+    /// Send given message. Return true on success.
+    bool send(WhisperMessage& msg)
+    {
+      if (not compact_)
+	return sendMessage(soc_, msg);
+      char buffer[sizeof(uint32_t) + sizeof(msg)];
+      size_t len = serializeFramedMessage(msg, buffer, sizeof(buffer));
+      return sendBytes(soc_, buffer, len);
+    }
+
+    /// Send the given bytes (variable-length part of a reply).
+    bool send(const char* data, size_t size)
+    { return sendBytes(soc_, data, size); }
+
+    /// Receive size bytes (variable-length part of a request).
+    /// Return true on success.
+    bool receive(char* data, size_t size)
+    {
+      bool closed = false;
+      return receiveBytes(soc_, data, size, closed) and not closed;
+    }
+
+  private:
+
+    int soc_;
+    bool compact_;
+  };
+
+
+#ifdef __linux__
+
+  /// Server transport over the rings of a shared memory region (see
+  /// WhisperShm.h). Same bytes as those of the socket transport.
+  class ShmChannel
+  {
+  public:
+
+    ShmChannel(WhisperShmRegion& region, bool compact)
+      : region_(region), compact_(compact)
+    { }
+
+    /// Receive a message. Set message type to Quit if the region is
+    /// closed by the test-bench or if the test-bench exits. Return
+    /// true on success.
+    bool receive(WhisperMessage& msg)
+    {
+      uint32_t len = sizeof(msg);
+      if (compact_)
+	{
+	  if (whisperShmRead(&region_.request, &len, sizeof(len),
+			     &region_) != 0)
+	    {
+	      msg.type = Quit;
+	      return true;
+	    }
+	  len = ntohl(len);
+	  if (not checkFrameLength(len))
+	    return false;
+	}
+
+      char buffer[sizeof(msg)] = {};
+      if (whisperShmRead(&region_.request, buffer, len,
+			 &region_) != 0)
+	{
+	  msg.type = Quit;
+	  return true;
+	}
+      deserializeMessage(buffer, sizeof(buffer), msg);
+      return true;
+    }
+
+    /// Send given message. Return true on success.
+    bool send(WhisperMessage& msg)
+    {
+      char buffer[sizeof(uint32_t) + sizeof(msg)];
+      size_t len = 0;
+      if (compact_)
+	len = serializeFramedMessage(msg, buffer, sizeof(buffer));
+      else
+	len = serializeMessage(msg, buffer, sizeof(buffer));
+      return whisperShmWrite(&region_.reply, buffer, len, &region_) == 0;
+    }
+
+    /// Send the given bytes (variable-length part of a reply).
+    /// Return true on success.
+    bool send(const char* data, size_t size)
+    { return whisperShmWrite(&region_.reply, data, size, &region_) == 0; }
+
+    /// Receive size bytes (variable-length part of a request).
+    /// Return true on success.
+    bool receive(char* data, size_t size)
+    {
+      return whisperShmRead(&region_.request, data, size,
+			    &region_) == 0;
+    }
+
+  private:
+
+    WhisperShmRegion& region_;
+    bool compact_;
+  };
+
+#endif
+}
+
+
+/// Receive and discard size bytes from the given channel in bounded
+/// chunks. Return true on success.
+template <typename Channel>
+static bool
+discardBytes(Channel& channel, uint64_t size)
+{
+  char buffer[4096];
+  while (size > 0)
+    {
+      size_t n = std::min(size, uint64_t(sizeof(buffer)));
+      if (not channel.receive(buffer, n))
+	return false;
+      size -= n;
+    }
+  return true;
+}
+
+
 template <typename URV>
 Server<URV>::Server(std::vector< Hart<URV>* >& harts)
-  : harts_(harts)
+  : harts_(harts), scratch_(harts.size()), boundHarts_(harts.size())
 {
+  // Reserve enough room for the changes of a typical instruction so
+  // that stepping does not allocate.
+  for (auto& scratch : scratch_)
+    {
+      scratch.csrs.reserve(16);
+      scratch.triggers.reserve(16);
+      scratch.csrValues.reserve(32);
+      scratch.addresses.reserve(4);
+      scratch.words.reserve(4);
+      scratch.text.reserve(256);
+    }
 }
   
 
@@ -282,6 +663,15 @@ Server<URV>::pokeCommand(const WhisperMessage& req, WhisperMessage& reply)
       }
       break;
 
+    case 'f':
+      {
+	unsigned reg = static_cast<unsigned>(req.address);
+	if (reg == req.address)
+	  if (hart.pokeFpReg(reg, req.value))
+	    return true;
+      }
+      break;
+
     case 'c':
       {
 	URV val = static_cast<URV>(req.value);
@@ -290,6 +680,10 @@ Server<URV>::pokeCommand(const WhisperMessage& req, WhisperMessage& reply)
       }
       break;
 
+    case 'p':
+      hart.pokePc(static_cast<URV>(req.value));
+      return true;
+
     case 'm':
       if (sizeof(URV) == 4)
 	{
@@ -368,7 +762,7 @@ Server<URV>::peekCommand(const WhisperMessage& req, WhisperMessage& reply)
 
 
 template <typename URV>
-void
+size_t
 Server<URV>::disassembleAnnotateInst(Hart<URV>& hart,
                                      uint32_t inst, bool interrupted,
 				     bool hasPreTrigger, bool hasPostTrigger,
@@ -384,13 +778,14 @@ Server<URV>::disassembleAnnotateInst(Hart<URV>& hart,
       else
        text += " (NT)";
     }
+  size_t size = text.size();
 
   if (entry.isLoad() or entry.isStore() or entry.isAtomic())
     {
       URV addr = hart.lastLdStAddress();
-      std::ostringstream oss;
-      oss << " [0x" << std::hex << addr << "]" << std::dec;
-      text += oss.str();
+      char buffer[32];
+      snprintf(buffer, sizeof(buffer), " [0x%" PRIx64 "]", uint64_t(addr));
+      text += buffer;
     }
 
   if (interrupted)
@@ -399,6 +794,20 @@ Server<URV>::disassembleAnnotateInst(Hart<URV>& hart,
     text += " (pre-trigger)";
   else if (hasPostTrigger)
     text += " (post-trigger)";
+
+  return size;
+}
+
+
+template <typename URV>
+void
+Server<URV>::rememberDisassembly(Hart<URV>& hart, uint32_t inst, size_t size)
+{
+  StepScratch& scratch = scratch_.at(hart.localHartId());
+  scratch.textInst = inst;
+  scratch.textPc = hart.lastPc();
+  scratch.textNextPc = hart.peekPc();
+  scratch.textSize = size;
 }
 
 
@@ -418,13 +827,45 @@ Server<URV>::processStepCahnges(Hart<URV>& hart,
   reply.address = pc;
   reply.resource = inst;
 
-  // Add disassembly of instruction to reply.
-  std::string text;
-  disassembleAnnotateInst(hart, inst, interrupted, hasPre, hasPost, text);
+  // Remember instruction for a later DisassembleLast request.
+  StepScratch& scratch = scratch_.at(hart.localHartId());
+  scratch.lastInst = inst;
+  scratch.lastInterrupted = interrupted;
+  scratch.lastHasPre = hasPre;
+  scratch.lastHasPost = hasPost;
+
+  // Add disassembly of instruction to reply unless suppressed.
+  if (reply.flags & NoDisassembly)
+    reply.buffer[0] = 0;
+  else
+    {
+      std::string& text = scratch.text;
+      text.clear();
+      size_t size = disassembleAnnotateInst(hart, inst, interrupted, hasPre,
+					    hasPost, text);
+      rememberDisassembly(hart, inst, size);
+
+      strncpy(reply.buffer, text.c_str(), sizeof(reply.buffer) - 1);
+      reply.buffer[sizeof(reply.buffer) -1] = 0;
+    }
 
-  strncpy(reply.buffer, text.c_str(), sizeof(reply.buffer) - 1);
-  reply.buffer[sizeof(reply.buffer) -1] = 0;
+  collectStepChanges(hart, pendingChanges);
 
+  // Add count of changes to reply.
+  reply.value = pendingChanges.size();
+
+  // The changes will be retrieved one at a time from the back of the
+  // pendigChanges vector: Put the vector in reverse order. Changes
+  // are retrieved using a Change request (see interactUsingSocket).
+  std::reverse(pendingChanges.begin(), pendingChanges.end());
+}
+
+
+template <typename URV>
+void
+Server<URV>::collectStepChanges(Hart<URV>& hart,
+				std::vector<WhisperMessage>& pendingChanges)
+{
   // Collect integer register change caused by execution of instruction.
   pendingChanges.clear();
   int regIx = hart.lastIntReg();
@@ -458,16 +899,22 @@ Server<URV>::processStepCahnges(Hart<URV>& hart,
 	}
     }
 
+  // Use the pre-allocated buffers of the hart: No heap allocation
+  // unless a buffer outgrows its reserved capacity.
+  StepScratch& scratch = scratch_.at(hart.localHartId());
+
   // Collect CSR and trigger changes.
-  std::vector<CsrNumber> csrs;
-  std::vector<unsigned> triggers;
+  auto& csrs = scratch.csrs;
+  auto& triggers = scratch.triggers;
   hart.lastCsr(csrs, triggers);
 
-  // Map to keep CSRs in order and to drop duplicate entries.
-  std::map<URV,URV> csrMap;
+  // Address/value pairs of changed CSRs: Sorted and deduplicated
+  // below (small array, cheaper than a map).
+  auto& csrValues = scratch.csrValues;
+  csrValues.clear();
 
   // Components of the triggers that changed (if any).
-  std::vector<bool> tdataChanged(3);
+  bool tdataChanged[3] = { false, false, false };
 
   // Collect changed CSRs and their values. Collect components of
   // changed trigger.
@@ -479,10 +926,10 @@ Server<URV>::processStepCahnges(Hart<URV>& hart,
 	  if (csr >= CsrNumber::TDATA1 and csr <= CsrNumber::TDATA3)
 	    {
 	      size_t ix = size_t(csr) - size_t(CsrNumber::TDATA1);
-	      tdataChanged.at(ix) = true;
+	      tdataChanged[ix] = true;
 	    }
 	  else
-	    csrMap[URV(csr)] = value;
+	    csrValues.emplace_back(URV(csr), value);
 	}
     }
 
@@ -492,31 +939,43 @@ Server<URV>::processStepCahnges(Hart<URV>& hart,
       URV data1(0), data2(0), data3(0);
       if (not hart.peekTrigger(trigger, data1, data2, data3))
 	continue;
-      if (tdataChanged.at(0))
+      if (tdataChanged[0])
 	{
 	  URV addr = (trigger << 16) | unsigned(CsrNumber::TDATA1);
-	  csrMap[addr] = data1;
+	  csrValues.emplace_back(addr, data1);
 	}
-      if (tdataChanged.at(1))
+      if (tdataChanged[1])
 	{
 	  URV addr = (trigger << 16) | unsigned(CsrNumber::TDATA2);
-	  csrMap[addr] = data2;
+	  csrValues.emplace_back(addr, data2);
 	}
-      if (tdataChanged.at(2))
+      if (tdataChanged[2])
 	{
 	  URV addr = (trigger << 16) | unsigned(CsrNumber::TDATA3);
-	  csrMap[addr] = data3;
+	  csrValues.emplace_back(addr, data3);
 	}
     }
 
-  for (const auto& [key, val] : csrMap)
+  // Sort by address with an insertion sort (array is small, sort is
+  // stable, no allocation).
+  for (size_t i = 1; i < csrValues.size(); ++i)
+    for (size_t j = i; j > 0 and csrValues[j-1].first > csrValues[j].first; --j)
+      std::swap(csrValues[j-1], csrValues[j]);
+
+  // Report each CSR once in address order. Keep the last value
+  // collected for a duplicate address.
+  for (size_t i = 0; i < csrValues.size(); ++i)
     {
-      WhisperMessage msg(0, Change, 'c', key, val);
+      if (i + 1 < csrValues.size() and
+	  csrValues[i+1].first == csrValues[i].first)
+	continue;
+      WhisperMessage msg(0, Change, 'c', csrValues[i].first,
+			 csrValues[i].second);
       pendingChanges.push_back(msg);
     }
 
-  std::vector<size_t> addresses;
-  std::vector<uint32_t> words;
+  auto& addresses = scratch.addresses;
+  auto& words = scratch.words;
 
   hart.lastMemory(addresses, words);
   assert(addresses.size() == words.size());
@@ -526,14 +985,6 @@ Server<URV>::processStepCahnges(Hart<URV>& hart,
       WhisperMessage msg(0, Change, 'm', addresses.at(i), words.at(i));
       pendingChanges.push_back(msg);
     }
-
-  // Add count of changes to reply.
-  reply.value = pendingChanges.size();
-
-  // The changes will be retrieved one at a time from the back of the
-  // pendigChanges vector: Put the vector in reverse order. Changes
-  // are retrieved using a Change request (see interactUsingSocket).
-  std::reverse(pendingChanges.begin(), pendingChanges.end());
 }
 
 
@@ -553,6 +1004,37 @@ Server<URV>::checkHartId(const WhisperMessage& req, WhisperMessage& reply)
 }
 
 
+template <typename URV>
+bool
+Server<URV>::checkBoundHart(const WhisperMessage& req, bool bindHart,
+			    int boundHart, WhisperMessage& reply)
+{
+  if (not bindHart or (boundHart >= 0 and req.hart == unsigned(boundHart)))
+    return true;
+
+  if (boundHart < 0)
+    std::cerr << "Error: Hart ID (" << std::dec << req.hart
+	      << ") is bound to another connection\n";
+  else
+    std::cerr << "Error: Hart ID (" << std::dec << req.hart
+	      << ") does not match that of connection (" << boundHart << ")\n";
+  reply.type = Invalid;
+  return false;
+}
+
+
+template <typename URV>
+bool
+Server<URV>::claimHart(unsigned hartId)
+{
+  std::lock_guard<std::mutex> lock(sharedMutex_);
+  if (hartId >= boundHarts_.size() or boundHarts_.at(hartId))
+    return false;
+  boundHarts_.at(hartId) = true;
+  return true;
+}
+
+
 template <typename URV>
 bool
 Server<URV>::checkHart(const WhisperMessage& req, const std::string& command,
@@ -627,33 +1109,474 @@ Server<URV>::stepCommand(const WhisperMessage& req,
 }
 
 
-// Server mode exception command.
+// Server mode step-batch command.
 template <typename URV>
 bool
-Server<URV>::exceptionCommand(const WhisperMessage& req, 
+Server<URV>::stepBatchCommand(const WhisperMessage& req,
+			      std::vector<WhisperMessage>& pendingChanges,
 			      WhisperMessage& reply,
-			      std::string& text)
+			      std::vector<char>& payload,
+			      FILE* traceFile)
 {
   reply = req;
+  payload.clear();
 
-  if (not checkHart(req, "exception", reply))
+  // Hart id must be valid. Hart must be started.
+  if (not checkHart(req, "step_batch", reply))
     return false;
 
+  if (req.value > WHISPER_STEP_BATCH_MAX)
+    {
+      std::cerr << "Error: Batch step count too large: " << req.value
+		<< " (maximum " << WHISPER_STEP_BATCH_MAX << ")\n";
+      reply.type = Invalid;
+      return false;
+    }
+
   uint32_t hartId = req.hart;
   auto& hart = *(harts_.at(hartId));
 
-  std::ostringstream oss;
+  if (hart.inDebugMode() and not hart.inDebugStepMode())
+    {
+      std::cerr << "Error: Batch step while in debug-halt mode\n";
+      reply.type = Invalid;
+      return false;
+    }
 
-  bool ok = true;
-  URV addr = static_cast<URV>(req.address);
-  if (addr != req.address)
-    std::cerr << "Error: Address too large (" << std::hex << req.address
-	      << ") in exception command.\n" << std::dec;
+  bool speculative = req.flags & Speculative;
+  StepScratch& scratch = scratch_.at(hart.localHartId());
+  auto& undoLog = scratch.undoLog;
 
-  WhisperExceptionType expType = WhisperExceptionType(req.value);
-  switch (expType)
+  if (speculative and req.value > WHISPER_SPECULATIVE_MAX - scratch.undoCount)
     {
-    case InstAccessFault:
+      std::cerr << "Error: Speculative batch step count too large: "
+		<< req.value << " (" << scratch.undoCount << " outstanding, "
+		<< "maximum " << WHISPER_SPECULATIVE_MAX << ")\n";
+      reply.type = Invalid;
+      return false;
+    }
+
+  uint64_t stepCount = 0, recordCount = 0;
+
+  // Trace of speculative instructions is written once committed.
+  if (speculative)
+    hart.holdTrace(true);
+
+  while (stepCount < req.value and not hart.hasTargetProgramFinished())
+    {
+      bool wasInDebug = hart.inDebugMode();
+
+      // Get instruction before execution (in case code is self-modifying).
+      uint32_t inst = 0;
+      hart.readInst(hart.peekPc(), inst);
+
+      if (speculative)
+	{
+	  if (scratch.undoCount >= undoLog.size())
+	    undoLog.resize(scratch.undoCount + 1);
+	  hart.saveUndoState(undoLog.at(scratch.undoCount));
+	}
+
+      hart.singleStep(traceFile);
+      stepCount++;
+
+      if (speculative)
+	hart.collectUndoData(undoLog.at(scratch.undoCount++));
+
+      collectStepChanges(hart, pendingChanges);
+      serializeChangeRecord(ChangeCount, inst, hart.lastPc(),
+			    pendingChanges.size(), payload);
+      for (const auto& msg : pendingChanges)
+	serializeChangeRecord(Change, msg.resource, msg.address, msg.value,
+			      payload);
+      recordCount += 1 + pendingChanges.size();
+
+      hart.clearTraceData();
+
+      // Stop if instruction put hart in debug mode.
+      if (hart.inDebugMode() and not wasInDebug)
+	break;
+    }
+
+  // Changes of a batch are not available through Change requests.
+  pendingChanges.clear();
+
+  reply.type = StepBatch;
+  reply.value = stepCount;
+  reply.address = recordCount;
+  return true;
+}
+
+
+// Server mode run-until command.
+template <typename URV>
+bool
+Server<URV>::runUntilCommand(const WhisperMessage& req,
+			     const std::vector<char>& conditions,
+			     std::vector<WhisperMessage>& pendingChanges,
+			     WhisperMessage& reply, std::vector<char>& payload,
+			     FILE* traceFile)
+{
+  reply = req;
+  payload.clear();
+  pendingChanges.clear();
+
+  // Hart id must be valid. Hart must be started.
+  if (not checkHart(req, "run_until", reply))
+    return false;
+
+  auto& hart = *(harts_.at(req.hart));
+
+  if (hart.inDebugMode() and not hart.inDebugStepMode())
+    {
+      std::cerr << "Error: Run-until while in debug-halt mode\n";
+      reply.type = Invalid;
+      return false;
+    }
+
+  StepScratch& scratch = scratch_.at(hart.localHartId());
+  auto& conds = scratch.runConditions;
+  conds.reset(req.value);
+
+  // Decode condition records (see WhisperChangeRecord).
+  const size_t recordSize = 24;
+  for (size_t i = 0; i + recordSize <= conditions.size(); i += recordSize)
+    {
+      uint32_t words[6];
+      memcpy(words, conditions.data() + i, sizeof(words));
+      uint32_t resource = ntohl(words[1]);
+      uint64_t address = (uint64_t(ntohl(words[2])) << 32) | ntohl(words[3]);
+      uint64_t value = (uint64_t(ntohl(words[4])) << 32) | ntohl(words[5]);
+
+      if (not conds.add(resource, address, value))
+	{
+	  reply.type = Invalid;
+	  return false;
+	}
+    }
+  conds.finish();
+
+  uint64_t count = 0;
+  auto stop = hart.runUntil(conds, traceFile, count);
+
+  uint32_t reason = RunStopCount;
+  using RunStop = typename Hart<URV>::RunStop;
+  switch (stop)
+    {
+    case RunStop::Count:       reason = RunStopCount;       break;
+    case RunStop::Pc:          reason = RunStopPc;          break;
+    case RunStop::MemoryWrite: reason = RunStopMemoryWrite; break;
+    case RunStop::CsrWrite:    reason = RunStopCsrWrite;    break;
+    case RunStop::DebugMode:   reason = RunStopDebugMode;   break;
+    case RunStop::Finished:    reason = RunStopFinished;    break;
+    }
+
+  uint64_t recordCount = 0;
+  if (count)
+    {
+      uint32_t inst = 0;
+      hart.readInst(hart.lastPc(), inst);
+      scratch.lastInst = inst;
+      scratch.lastInterrupted = false;
+      scratch.lastHasPre = false;
+      scratch.lastHasPost = false;
+
+      collectStepChanges(hart, pendingChanges);
+      serializeChangeRecord(ChangeCount, inst, hart.lastPc(),
+			    pendingChanges.size(), payload);
+      for (const auto& msg : pendingChanges)
+	serializeChangeRecord(Change, msg.resource, msg.address, msg.value,
+			      payload);
+      recordCount = 1 + pendingChanges.size();
+      hart.clearTraceData();
+    }
+
+  // Changes are sent along with the reply.
+  pendingChanges.clear();
+
+  reply.type = RunUntil;
+  reply.value = count;
+  reply.resource = reason;
+  reply.address = recordCount;
+  return true;
+}
+
+
+// Server mode disassemble-last command.
+template <typename URV>
+bool
+Server<URV>::disassembleLastCommand(const WhisperMessage& req,
+				    WhisperMessage& reply)
+{
+  reply = req;
+
+  if (not checkHartId(req, reply))
+    return false;
+
+  auto& hart = *(harts_.at(req.hart));
+  StepScratch& scratch = scratch_.at(hart.localHartId());
+
+  reply.address = hart.lastPc();
+  reply.resource = scratch.lastInst;
+
+  std::string& text = scratch.text;
+  text.clear();
+  size_t size = disassembleAnnotateInst(hart, scratch.lastInst,
+					scratch.lastInterrupted,
+					scratch.lastHasPre,
+					scratch.lastHasPost, text);
+  rememberDisassembly(hart, scratch.lastInst, size);
+
+  strncpy(reply.buffer, text.c_str(), sizeof(reply.buffer) - 1);
+  reply.buffer[sizeof(reply.buffer) -1] = 0;
+  return true;
+}
+
+
+template <typename URV>
+void
+Server<URV>::commitSpeculation(Hart<URV>& hart, FILE* commandLog,
+			       const std::string& timeStamp)
+{
+  // Trace of committed instructions can now be written.
+  hart.holdTrace(false);
+
+  StepScratch& scratch = scratch_.at(hart.localHartId());
+  if (scratch.undoCount == 0)
+    return;
+
+  if (commandLog)
+    fprintf(commandLog, "hart=%d step %zu # ts=%s\n", hart.localHartId(),
+	    scratch.undoCount, timeStamp.c_str());
+  scratch.undoCount = 0;
+}
+
+
+// Server mode rollback command.
+template <typename URV>
+bool
+Server<URV>::rollbackCommand(const WhisperMessage& req,
+			     std::vector<WhisperMessage>& pendingChanges,
+			     WhisperMessage& reply, FILE* commandLog)
+{
+  reply = req;
+
+  if (not checkHart(req, "rollback", reply))
+    return false;
+
+  auto& hart = *(harts_.at(req.hart));
+  StepScratch& scratch = scratch_.at(hart.localHartId());
+
+  size_t keep = scratch.undoCount;
+  if (req.value < keep)
+    keep = req.value;
+
+  // Undo youngest instruction first.
+  uint64_t undone = 0;
+  for ( ; scratch.undoCount > keep; --scratch.undoCount, ++undone)
+    hart.undoStep(scratch.undoLog.at(scratch.undoCount - 1));
+
+  pendingChanges.clear();
+
+  // Kept instructions are now committed.
+  commitSpeculation(hart, commandLog, std::to_string(req.rank));
+
+  reply.value = undone;
+  return true;
+}
+
+
+// Server mode peek-block command.
+template <typename URV>
+bool
+Server<URV>::peekBlockCommand(const WhisperMessage& req,
+			      WhisperMessage& reply,
+			      std::vector<char>& payload)
+{
+  reply = req;
+
+  if (not checkHartId(req, reply))
+    return false;
+
+  auto& hart = *(harts_.at(req.hart));
+
+  if (req.value > hart.memorySize())
+    {
+      std::cerr << "Error: Peek block size (" << req.value
+		<< ") exceeds memory size\n";
+      reply.type = Invalid;
+      return false;
+    }
+
+  size_t start = payload.size();
+  payload.resize(start + req.value);
+
+  for (uint64_t i = 0; i < req.value; ++i)
+    {
+      uint8_t byte = 0;
+      if (not hart.peekMemory(req.address + i, byte))
+	{
+	  payload.resize(start);
+	  reply.type = Invalid;
+	  return false;
+	}
+      payload[start + i] = byte;
+    }
+
+  return true;
+}
+
+
+// Server mode poke-block command.
+template <typename URV>
+bool
+Server<URV>::pokeBlockCommand(const WhisperMessage& req,
+			      const std::vector<char>& data,
+			      WhisperMessage& reply)
+{
+  reply = req;
+
+  if (not checkHartId(req, reply))
+    return false;
+
+  auto& hart = *(harts_.at(req.hart));
+
+  for (size_t i = 0; i < data.size(); ++i)
+    if (not hart.pokeMemory(req.address + i, uint8_t(data[i])))
+      {
+	reply.type = Invalid;
+	return false;
+      }
+
+  return true;
+}
+
+
+// Server mode dump-registers command.
+template <typename URV>
+bool
+Server<URV>::dumpRegsCommand(const WhisperMessage& req, WhisperMessage& reply,
+			     std::vector<char>& payload)
+{
+  reply = req;
+
+  if (not checkHartId(req, reply))
+    return false;
+
+  auto& hart = *(harts_.at(req.hart));
+  uint64_t count = 0;
+
+  serializeChangeRecord(Peek, 'p', 0, hart.peekPc(), payload);
+  count++;
+
+  for (unsigned i = 0; i < hart.intRegCount(); ++i)
+    {
+      URV val = 0;
+      if (hart.peekIntReg(i, val))
+	{
+	  serializeChangeRecord(Peek, 'r', i, val, payload);
+	  count++;
+	}
+    }
+
+  for (unsigned i = 0; i < hart.fpRegCount(); ++i)
+    {
+      uint64_t val = 0;
+      if (hart.peekFpReg(i, val))
+	{
+	  serializeChangeRecord(Peek, 'f', i, val, payload);
+	  count++;
+	}
+    }
+
+  for (size_t i = 0; i <= size_t(CsrNumber::MAX_CSR_); ++i)
+    {
+      URV val = 0;
+      if (hart.peekCsr(CsrNumber(i), val))
+	{
+	  serializeChangeRecord(Peek, 'c', i, val, payload);
+	  count++;
+	}
+    }
+
+  reply.value = count;
+  return true;
+}
+
+
+// Server mode checksum command.
+template <typename URV>
+bool
+Server<URV>::checksumCommand(const WhisperMessage& req, WhisperMessage& reply)
+{
+  reply = req;
+
+  if (not checkHartId(req, reply))
+    return false;
+
+  auto& hart = *(harts_.at(req.hart));
+
+  uint64_t size = req.resource, memSize = hart.memorySize();
+  if (req.address > memSize or size > memSize - req.address)
+    {
+      std::cerr << "Error: Checksum range (address 0x" << std::hex
+		<< req.address << std::dec << ", size " << size
+		<< ") extends past the end of memory\n";
+      reply.type = Invalid;
+      return false;
+    }
+
+  uint64_t crc = 0;
+  uint8_t buffer[4096];
+  size_t addr = req.address;
+
+  for (uint64_t remain = size; remain > 0; )
+    {
+      size_t n = std::min(remain, uint64_t(sizeof(buffer)));
+      for (size_t i = 0; i < n; ++i)
+	if (not hart.peekMemory(addr + i, buffer[i]))
+	  {
+	    reply.type = Invalid;
+	    return false;
+	  }
+      crc = crc64(crc, buffer, n);
+      addr += n;
+      remain -= n;
+    }
+
+  reply.resource = crc == req.value;
+  reply.value = crc;
+  return true;
+}
+
+
+// Server mode exception command.
+template <typename URV>
+bool
+Server<URV>::exceptionCommand(const WhisperMessage& req, 
+			      WhisperMessage& reply,
+			      std::string& text)
+{
+  reply = req;
+
+  if (not checkHart(req, "exception", reply))
+    return false;
+
+  uint32_t hartId = req.hart;
+  auto& hart = *(harts_.at(hartId));
+
+  std::ostringstream oss;
+
+  bool ok = true;
+  URV addr = static_cast<URV>(req.address);
+  if (addr != req.address)
+    std::cerr << "Error: Address too large (" << std::hex << req.address
+	      << ") in exception command.\n" << std::dec;
+
+  WhisperExceptionType expType = WhisperExceptionType(req.value);
+  switch (expType)
+    {
+    case InstAccessFault:
       hart.postInstAccessFault(addr);
       oss << "exception inst " << addr;
       break;
@@ -713,14 +1636,63 @@ Server<URV>::exceptionCommand(const WhisperMessage& req,
 }
 
 
+template <typename URV>
+bool
+Server<URV>::interact(int soc, FILE* traceFile, FILE* commandLog,
+		      bool bindHart)
+{
+  SocketChannel channel(soc, compact_);
+  return interactWith(channel, traceFile, commandLog, bindHart);
+}
+
+
+template <typename URV>
+bool
+Server<URV>::interact(WhisperShmRegion& region, FILE* traceFile,
+		      FILE* commandLog)
+{
+#ifdef __linux__
+  ShmChannel channel(region, compact_);
+  return interactWith(channel, traceFile, commandLog);
+#else
+  std::cerr << "Shared memory server mode is supported only on Linux\n";
+  return false;
+#endif
+}
+
+
+template <typename URV>
+bool
+Server<URV>::replay(FILE* binaryLog, FILE* traceFile, FILE* commandLog)
+{
+  const char* magic = WHISPER_BINARY_LOG_MAGIC;
+  char header[sizeof(WHISPER_BINARY_LOG_MAGIC)] = {};
+  size_t size = strlen(magic);
+  if (fread(header, size, 1, binaryLog) != 1 or memcmp(header, magic, size))
+    {
+      std::cerr << "Not a whisper binary command log file\n";
+      return false;
+    }
+
+  FileChannel channel(binaryLog);
+  return interactWith(channel, traceFile, commandLog);
+}
+
+
 // Server mode loop: Receive command and send reply till a quit
 // command is received. Return true on successful termination (quit
 // received). Return false otherwise.
 template <typename URV>
+template <typename Channel>
 bool
-Server<URV>::interact(int soc, FILE* traceFile, FILE* commandLog)
+Server<URV>::interactWith(Channel& channel, FILE* traceFile, FILE* commandLog,
+			  bool bindHart)
 {
+  int boundHart = -1;  // Hart bound to this connection (see interact).
   std::vector<WhisperMessage> pendingChanges;
+  pendingChanges.reserve(64);
+  std::vector<char> payload;  // Variable length part of a reply.
+  std::vector<char> inbound;  // Variable length part of a request.
 
   auto hexForm = getHexForm<URV>(); // Format string for printing a hex val
 
@@ -730,20 +1702,94 @@ Server<URV>::interact(int soc, FILE* traceFile, FILE* commandLog)
   while (true)
     {
       WhisperMessage msg;
-      if (not receiveMessage(soc, msg))
+      if (not channel.receive(msg))
 	return false;
+
+      if (bindHart)
+	{
+	  // A quit (also received when the peer closes the connection)
+	  // ends the connection whatever its target hart. It affects
+	  // no hart if the connection is not bound.
+	  if (msg.type == Quit)
+	    {
+	      if (boundHart < 0)
+		return true;
+	      msg.hart = boundHart;
+	    }
+
+	  // Bind to the target hart of the first request for a hart not
+	  // bound to another connection.
+	  if (boundHart < 0 and claimHart(msg.hart))
+	    boundHart = int(msg.hart);
+	}
+
       WhisperMessage reply = msg;
 
-      if (checkHartId(msg, reply))
+      // Receive the variable-length part of a poke-block or a
+      // run-until request (even if the request turns out to be
+      // invalid). A part larger than memory (poke-block) or than the
+      // maximum condition count (run-until) is discarded and the
+      // request is rejected.
+      if (msg.type == PokeBlock or msg.type == RunUntil)
+	{
+	  uint64_t size = msg.value, limit = harts_.front()->memorySize();
+	  if (msg.type == RunUntil)
+	    {
+	      size = 24 * uint64_t(msg.resource);
+	      limit = 24 * uint64_t(WHISPER_RUN_MAX_CONDITIONS);
+	    }
+	  if (size > limit)
+	    {
+	      std::cerr << "Error: Request data too large (" << size
+			<< " bytes)\n";
+	      if (not discardBytes(channel, size))
+		return false;
+	      reply.type = Invalid;
+	      if (not channel.send(reply))
+		return false;
+	      continue;
+	    }
+	  inbound.resize(size);
+	  if (not channel.receive(inbound.data(), inbound.size()))
+	    return false;
+	}
+      else
+	inbound.clear();
+
+      if (binaryLog_)
+	writeBinaryCommand(binaryLog_, msg, inbound.data(), inbound.size());
+
+      if (checkHartId(msg, reply) and
+	  checkBoundHart(msg, bindHart, boundHart, reply))
 	{
           std::string timeStamp = std::to_string(msg.rank);
 
           uint32_t hartId = msg.hart;
 	  auto& hart = *(harts_.at(hartId));
 
-	  if (msg.type == Step or msg.type == Until)
+	  if (msg.type == Step or msg.type == StepBatch or msg.type == Until or
+	      msg.type == RunUntil)
 	    resetMemoryMappedReg = true;
 
+	  // Outstanding speculative steps can no longer be undone once
+	  // the state of the hart is changed by another command.
+	  bool keepsSpeculation = ( (msg.type == StepBatch and
+				     (msg.flags & Speculative)) or
+				    msg.type == Rollback or msg.type == Peek or
+				    msg.type == PeekBlock or msg.type == DumpRegs or
+				    msg.type == Checksum or
+				    msg.type == DisassembleLast );
+	  if (not keepsSpeculation)
+	    commitSpeculation(hart, commandLog, timeStamp);
+
+	  // Poke (memory, shared CSRs), reset (memory mapped registers)
+	  // and exception (store rollback) commands touch state shared
+	  // with other harts: Serialize them.
+	  std::unique_lock<std::mutex> lock(sharedMutex_, std::defer_lock);
+	  if (msg.type == Poke or msg.type == PokeBlock or msg.type == Reset or
+	      msg.type == Exception)
+	    lock.lock();
+
 	  switch (msg.type)
 	    {
 	    case Quit:
@@ -770,6 +1816,43 @@ Server<URV>::interact(int soc, FILE* traceFile, FILE* commandLog)
 			timeStamp.c_str());
 	      break;
 
+	    case PeekBlock:
+	      peekBlockCommand(msg, reply, payload);
+	      if (commandLog)
+		fprintf(commandLog, "hart=%d peek m %s %s # ts=%s\n", hartId,
+			(boost::format(hexForm) % msg.address).str().c_str(),
+			(boost::format(hexForm) % (msg.address + msg.value - 1)).str().c_str(),
+			timeStamp.c_str());
+	      break;
+
+	    case PokeBlock:
+	      if (pokeBlockCommand(msg, inbound, reply) and commandLog)
+		{
+		  // Log a word poke for each word overlapping the block.
+		  size_t wordSize = sizeof(URV);
+		  size_t end = msg.address + inbound.size();
+		  for (size_t addr = msg.address & ~(wordSize - 1);
+		       addr < end; addr += wordSize)
+		    {
+		      URV word = 0;
+		      hart.peekMemory(addr, word);
+		      fprintf(commandLog, "hart=%d poke m %s %s # ts=%s\n",
+			      hartId,
+			      (boost::format(hexForm) % addr).str().c_str(),
+			      (boost::format(hexForm) % word).str().c_str(),
+			      timeStamp.c_str());
+		    }
+		}
+	      break;
+
+	    case DumpRegs:
+	      dumpRegsCommand(msg, reply, payload);
+	      break;
+
+	    case Checksum:
+	      checksumCommand(msg, reply);
+	      break;
+
 	    case Step:
 	      stepCommand(msg, pendingChanges, reply, traceFile);
 	      if (commandLog)
@@ -777,6 +1860,45 @@ Server<URV>::interact(int soc, FILE* traceFile, FILE* commandLog)
                         hartId, hart.getInstructionCount(), timeStamp.c_str());
 	      break;
 
+	    case StepBatch:
+	      stepBatchCommand(msg, pendingChanges, reply, payload, traceFile);
+	      if (msg.flags & Speculative)
+		{
+		  // Logged once committed (some steps may be undone).
+		  if (hart.inDebugMode())
+		    commitSpeculation(hart, commandLog, timeStamp);
+		}
+	      else if (commandLog and reply.type == StepBatch)
+		fprintf(commandLog, "hart=%d step %" PRIu64 " # ts=%s\n",
+			hartId, reply.value, timeStamp.c_str());
+	      break;
+
+	    case Rollback:
+	      rollbackCommand(msg, pendingChanges, reply, commandLog);
+	      break;
+
+	    case RunUntil:
+	      runUntilCommand(msg, inbound, pendingChanges, reply, payload,
+			      traceFile);
+	      if (commandLog and reply.type == RunUntil)
+		fprintf(commandLog, "hart=%d step %" PRIu64 " # ts=%s\n",
+			hartId, reply.value, timeStamp.c_str());
+	      break;
+
+	    case Until:
+	      if (checkHart(msg, "until", reply))
+		{
+		  URV addr = static_cast<URV>(msg.address);
+		  if (not hart.untilAddress(addr, traceFile))
+		    reply.type = Invalid;
+		  pendingChanges.clear();
+		  if (commandLog)
+		    fprintf(commandLog, "hart=%d until %s # ts=%s\n", hartId,
+			    (boost::format(hexForm) % addr).str().c_str(),
+			    timeStamp.c_str());
+		}
+	      break;
+
 	    case ChangeCount:
 	      reply.type = ChangeCount;
 	      reply.value = pendingChanges.size();
@@ -785,22 +1907,34 @@ Server<URV>::interact(int soc, FILE* traceFile, FILE* commandLog)
 		uint32_t inst = 0;
 		hart.readInst(hart.lastPc(), inst);
 		reply.resource = inst;
-		std::string text;
-		hart.disassembleInst(inst, text);
-		uint32_t op0 = 0, op1 = 0, op2 = 0, op3 = 0;
-		const InstEntry& entry = hart.decode(inst, op0, op1, op2, op3);
-		if (entry.isBranch())
+		if (msg.flags & NoDisassembly)
 		  {
-		    if (hart.lastPc() + instructionSize(inst) != hart.peekPc())
-		      text += " (T)";
-		    else
-		      text += " (NT)";
+		    reply.buffer[0] = 0;
+		    break;
 		  }
-		strncpy(reply.buffer, text.c_str(), sizeof(reply.buffer) - 1);
-		reply.buffer[sizeof(reply.buffer) -1] = 0;
+		// Reuse the disassembly of the last step (or DisassembleLast)
+		// if it is of the same instruction and outcome.
+		StepScratch& scratch = scratch_.at(hart.localHartId());
+		std::string& text = scratch.text;
+		if (scratch.textSize == 0 or scratch.textInst != inst or
+		    scratch.textPc != hart.lastPc() or
+		    scratch.textNextPc != hart.peekPc())
+		  {
+		    text.clear();
+		    size_t size = disassembleAnnotateInst(hart, inst, false,
+							  false, false, text);
+		    rememberDisassembly(hart, inst, size);
+		  }
+		size_t size = std::min(scratch.textSize, sizeof(reply.buffer) - 1);
+		memcpy(reply.buffer, text.data(), size);
+		reply.buffer[size] = 0;
 	      }
 	      break;
 
+	    case DisassembleLast:
+	      disassembleLastCommand(msg, reply);
+	      break;
+
 	    case Change:
 	      if (pendingChanges.empty())
 		reply.type = Invalid;
@@ -913,8 +2047,15 @@ Server<URV>::interact(int soc, FILE* traceFile, FILE* commandLog)
 	    }
 	}
 
-      if (not sendMessage(soc, reply))
+      if (not channel.send(reply))
 	return false;
+
+      if (not payload.empty())
+	{
+	  if (not channel.send(payload.data(), payload.size()))
+	    return false;
+	  payload.clear();
+	}
     }
 
   return false;
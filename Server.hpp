@@ -18,12 +18,27 @@
 
 #pragma once
 
+#include <mutex>
 #include "Hart.hpp"
 
 
+struct WhisperShmRegion;
+
+
 namespace WdRiscv
 {
 
+  /// Write the header of a binary command log (see
+  /// WHISPER_BINARY_LOG_MAGIC) to the given file. Return true on
+  /// success.
+  bool writeBinaryLogHeader(FILE* file);
+
+  /// Append the given request followed by the given variable-length
+  /// data (if any) to the given binary command log file. Safe to call
+  /// from multiple threads. Return true on success.
+  bool writeBinaryCommand(FILE* file, const WhisperMessage& msg,
+			  const char* data = nullptr, size_t size = 0);
+
   /// Manage server mode.
   template <typename URV>
   class Server
@@ -39,11 +54,19 @@ namespace WdRiscv
     /// Server mode peek command.
     bool peekCommand(const WhisperMessage& req, WhisperMessage& reply);
 
-    // Server mode disassemble command.
-    void disassembleAnnotateInst(Hart<URV>& hart,
-                                 uint32_t inst, bool interrupted,
-				 bool hasPreTrigger, bool hasPostTrigger,
-				 std::string& text);
+    /// Set text to the disassembly of the given instruction annotated
+    /// with the branch outcome, the load/store address, and the
+    /// interrupt/trigger status. Return the length of the prefix of
+    /// text holding the disassembly and branch outcome only.
+    size_t disassembleAnnotateInst(Hart<URV>& hart,
+				   uint32_t inst, bool interrupted,
+				   bool hasPreTrigger, bool hasPostTrigger,
+				   std::string& text);
+
+    /// Record in the scratch of the given hart that the first size
+    /// characters of its scratch text hold the disassembly (with
+    /// branch outcome) of the given instruction at the last pc.
+    void rememberDisassembly(Hart<URV>& hart, uint32_t inst, size_t size);
 
     /// Server mode step command.
     bool stepCommand(const WhisperMessage& req, 
@@ -51,24 +74,130 @@ namespace WdRiscv
 		     WhisperMessage& reply,
 		     FILE* traceFile);
 
+    /// Server mode step-batch command: Step the target hart up to
+    /// req.value times putting in the payload vector (cleared on
+    /// entry) the serialized change records of all the stepped
+    /// instructions (see WhisperChangeRecord).
+    bool stepBatchCommand(const WhisperMessage& req,
+			  std::vector<WhisperMessage>& pendingChanges,
+			  WhisperMessage& reply,
+			  std::vector<char>& payload,
+			  FILE* traceFile);
+
+    /// Server mode run-until command: Run the target hart until one
+    /// of the conditions defined by the request and the given condition
+    /// records (received after the request) is met putting in the
+    /// payload vector (cleared on entry) the serialized change records
+    /// of the last executed instruction (see RunUntil in
+    /// WhisperMessage.h).
+    bool runUntilCommand(const WhisperMessage& req,
+			 const std::vector<char>& conditions,
+			 std::vector<WhisperMessage>& pendingChanges,
+			 WhisperMessage& reply, std::vector<char>& payload,
+			 FILE* traceFile);
+
+    /// Server mode disassemble-last command: Put in the reply the
+    /// address, opcode and annotated disassembly of the last
+    /// instruction stepped by the target hart.
+    bool disassembleLastCommand(const WhisperMessage& req,
+				WhisperMessage& reply);
+
+    /// Server mode rollback command: Undo the outstanding speculative
+    /// instructions of the target hart except for the oldest req.value
+    /// ones. Put the number of undone instructions in the reply. Log a
+    /// step command for the kept instructions.
+    bool rollbackCommand(const WhisperMessage& req,
+			 std::vector<WhisperMessage>& pendingChanges,
+			 WhisperMessage& reply, FILE* commandLog);
+
+    /// Commit the outstanding speculative instructions of the given
+    /// hart logging a step command for them (if any).
+    void commitSpeculation(Hart<URV>& hart, FILE* commandLog,
+			   const std::string& timeStamp);
+
+    /// Server mode peek-block command: Append to the payload vector
+    /// the bytes of the memory range defined by the request (see
+    /// PeekBlock in WhisperMessage.h).
+    bool peekBlockCommand(const WhisperMessage& req, WhisperMessage& reply,
+			  std::vector<char>& payload);
+
+    /// Server mode poke-block command: Write the given data bytes
+    /// (received after the request) into memory (see PokeBlock in
+    /// WhisperMessage.h).
+    bool pokeBlockCommand(const WhisperMessage& req,
+			  const std::vector<char>& data, WhisperMessage& reply);
+
+    /// Server mode dump-registers command: Append to the payload
+    /// vector a record for each register of the target hart (see
+    /// DumpRegs in WhisperMessage.h).
+    bool dumpRegsCommand(const WhisperMessage& req, WhisperMessage& reply,
+			 std::vector<char>& payload);
+
+    /// Server mode checksum command (see Checksum in WhisperMessage.h).
+    bool checksumCommand(const WhisperMessage& req, WhisperMessage& reply);
+
     /// Server mode exception command.
     bool exceptionCommand(const WhisperMessage& req, WhisperMessage& reply,
 			  std::string& text);
 
+    /// Enable/disable compact framing of messages (see
+    /// WHISPER_COMPACT_SIZE in WhisperMessage.h).
+    void enableCompactFraming(bool flag)
+    { compact_ = flag; }
+
     /// Server mode loop: Receive command and send reply till a quit
     /// command is received. Return true on successful termination (quit
-    /// received). Return false otherwise.
-    bool interact(int soc, FILE* traceFile, FILE* commandLog);
+    /// received). Return false otherwise. If bindHart is true, the
+    /// connection is bound to the target hart of its first request
+    /// unless another connection is already bound to that hart (the
+    /// request is then rejected and the connection remains unbound):
+    /// Requests of a bound connection for other harts are rejected
+    /// (reply type Invalid). Multiple connections, each bound to a
+    /// different hart, may be served concurrently, each from its own
+    /// thread. Ordering of memory accesses across harts is up to the
+    /// test-bench.
+    bool interact(int soc, FILE* traceFile, FILE* commandLog,
+		  bool bindHart = false);
+
+    /// Same as above but receive commands from and send replies to
+    /// the given shared memory region (see WhisperShm.h).
+    bool interact(WhisperShmRegion& region, FILE* traceFile,
+		  FILE* commandLog);
+
+    /// Execute the requests recorded in the given binary command log
+    /// file (see WHISPER_BINARY_LOG_MAGIC) discarding the replies.
+    /// Return true on success and false on failure.
+    bool replay(FILE* binaryLog, FILE* traceFile, FILE* commandLog);
+
+    /// Record each received request in the given binary command log
+    /// file (no recording if null). File must start with a header
+    /// (see writeBinaryLogHeader).
+    void setBinaryCommandLog(FILE* binaryLog)
+    { binaryLog_ = binaryLog; }
 
   protected:
 
+    /// Server mode loop over the given transport channel (socket or
+    /// shared memory). See interact for bindHart.
+    template <typename Channel>
+    bool interactWith(Channel& channel, FILE* traceFile, FILE* commandLog,
+		      bool bindHart = false);
+
+    /// Collect the changes (integer/fp register, CSR and memory)
+    /// caused by the last executed instruction of the given hart
+    /// into the changes vector (cleared on entry) in the order in
+    /// which they are reported to the test-bench.
+    void collectStepChanges(Hart<URV>&, std::vector<WhisperMessage>& changes);
+
     /// Process changes of a single-step command. Put the changes in the
     /// pendingChanges vector (which is cleared on entry). Put the
     /// number of change record in the reply parameter along with the
     /// instruction address, opcode and assembly text. Use hasPre
     /// (instruction tripped a "before" trigger), hasPost (tripped an
     /// "after" trigger) and interrupted (instruction encountered an
-    /// external interrupt) to annotate the assembly text.
+    /// external interrupt) to annotate the assembly text. Leave the
+    /// assembly text empty if the NoDisassembly bit is set in the
+    /// flags of the reply (copied from the request).
     void processStepCahnges(Hart<URV>&, uint32_t inst,
 			    std::vector<WhisperMessage>& pendingChanges,
 			    bool interrupted, bool hasPre, bool hasPost,
@@ -80,13 +209,70 @@ namespace WdRiscv
     /// false otherwise setting reply to invalid.
     bool checkHartId(const WhisperMessage& reg, WhisperMessage& reply);
 
+    /// Check if the target hart of a request received on a connection
+    /// served with bindHart (see interact) is the hart bound to that
+    /// connection (negative if none). Return true if it is or if
+    /// bindHart is false, and false otherwise setting reply to
+    /// invalid.
+    bool checkBoundHart(const WhisperMessage& req, bool bindHart,
+			int boundHart, WhisperMessage& reply);
+
+    /// Bind the calling connection to the hart with the given id.
+    /// Return false if the id is out of bounds or if another
+    /// connection is already bound to that hart.
+    bool claimHart(unsigned hartId);
+
     /// Check if target hart is valid and is started. Return true if
     /// it is, and false otherwise setting reply to invalid.  Complain
     /// about command receiven in non-started state.
     bool checkHart(const WhisperMessage& reg, const std::string& command,
                    WhisperMessage& reply);
 
+    /// Buffers reused from one step to the next when collecting the
+    /// changes of an instruction (see collectStepChanges).
+    struct StepScratch
+    {
+      std::vector<CsrNumber> csrs;
+      std::vector<unsigned> triggers;
+      std::vector< std::pair<URV, URV> > csrValues; // Address/value pairs.
+      std::vector<size_t> addresses;
+      std::vector<uint32_t> words;
+      std::string text;     // Instruction disassembly.
+
+      // Last stepped instruction (see DisassembleLast).
+      uint32_t lastInst = 0;
+      bool lastInterrupted = false;
+      bool lastHasPre = false;
+      bool lastHasPost = false;
+
+      // Disassembly with branch outcome of the instruction at textPc
+      // (next pc textNextPc): First textSize characters of text, zero
+      // if text does not hold it (see ChangeCount).
+      uint32_t textInst = 0;
+      URV textPc = 0;
+      URV textNextPc = 0;
+      size_t textSize = 0;
+
+      // Undo records of outstanding speculative instructions (see
+      // Speculative in WhisperMessage.h). Only the first undoCount
+      // entries are valid: Entries are reused to avoid allocation.
+      std::vector<typename Hart<URV>::UndoRecord> undoLog;
+      size_t undoCount = 0;
+
+      // Stop conditions of the last RunUntil command.
+      typename Hart<URV>::RunConditions runConditions;
+    };
+
     std::vector< Hart<URV>* >& harts_;
+    std::vector<StepScratch> scratch_;  // One entry per hart.
+    std::vector<bool> boundHarts_;      // Harts bound to a connection.
+    bool compact_ = false;
+    FILE* binaryLog_ = nullptr;
+
+    // Serialize commands changing state shared by the harts outside
+    // of instruction execution when connections are served
+    // concurrently (one per hart).
+    std::mutex sharedMutex_;
   };
 
 }
@@ -0,0 +1,1039 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstring>
+#include <chrono>
+#include <iostream>
+#include <unistd.h>
+#include <zlib.h>
+#include "Trace.hpp"
+
+
+using namespace WdRiscv;
+
+
+/// Magic string at the beginning of a binary trace file.
+static const char binaryTraceMagic[8] = { 'W', 'H', 'I', 'S', 'P', 'E', 'R',
+					  'T' };
+
+/// Version of the binary trace format.
+static const uint8_t binaryTraceVersion = 1;
+
+/// Size of the buffer of a binary trace writer.
+static const size_t binaryTraceBufferSize = 64*1024;
+
+
+/// Flags of a binary trace record (see BinaryTraceWriter).
+enum BinaryTraceFlags
+  {
+    BtIntReg      = 1,
+    BtFpReg       = 2,
+    BtCsrs        = 4,
+    BtMem         = 8,
+    BtInterrupted = 0x10,
+    BtLdSt        = 0x20,
+    BtPcJump      = 0x40,   // Pc is not that of the next sequential inst.
+    BtTagJump     = 0x80,   // Tag is not one plus previous tag.
+    BtHart        = 0x100,  // Hart differs from that of previous record.
+    BtCompressed  = 0x200,
+    BtReset       = 0x400   // Encoding state reset before this record.
+  };
+
+
+static const char hexDigits[] = "0123456789abcdef";
+
+
+/// Write at p the hexadecimal digits of the given value zero-padded
+/// to the given width (at most 16, like %0<width>x). Return pointer
+/// past the last written character.
+static inline
+char*
+putHex(char* p, uint64_t value, unsigned width)
+{
+  char digits[16];
+  unsigned n = 0;
+  do
+    {
+      digits[n++] = hexDigits[value & 0xf];
+      value >>= 4;
+    }
+  while (value);
+  while (n < width)
+    digits[n++] = '0';
+  while (n)
+    *p++ = digits[--n];
+  return p;
+}
+
+
+/// Write at p the decimal digits of the given value. Return pointer
+/// past the last written character.
+static inline
+char*
+putDec(char* p, uint64_t value)
+{
+  char digits[20];
+  unsigned n = 0;
+  do
+    {
+      digits[n++] = char('0' + value % 10);
+      value /= 10;
+    }
+  while (value);
+  while (n)
+    *p++ = digits[--n];
+  return p;
+}
+
+
+/// Write at p the given string of the given length. Return pointer
+/// past the last written character.
+static inline
+char*
+putStr(char* p, const char* str, size_t len)
+{
+  memcpy(p, str, len);
+  return p + len;
+}
+
+
+/// Text of the constant parts of a trace line.
+struct TraceLineText
+{
+  const char* assembly;
+  size_t assemblyLen;
+  char opcode[8];   // Right-justified in 8 columns (like %8s).
+  char annotation[48];
+  size_t annotationLen;
+};
+
+
+/// Write at p a trace line (without the end of line) of the given
+/// record for the given resource. Return pointer past the last written
+/// character. There must be room for 96 characters plus the assembly
+/// and annotation lengths.
+static
+char*
+formatLine(char* p, const TraceRecord& rec, const TraceLineText& text,
+	   char resource, uint64_t addr, uint64_t value, unsigned xlen)
+{
+  // Common prefix: "#tag hart pc opcode resource "
+  *p++ = '#';
+  p = putDec(p, rec.tag);
+  *p++ = ' ';
+  p = putDec(p, rec.hartId);
+  *p++ = ' ';
+  p = putHex(p, xlen == 64 ? rec.pc : uint32_t(rec.pc), xlen == 64 ? 16 : 8);
+  *p++ = ' ';
+  p = putStr(p, text.opcode, sizeof(text.opcode));
+  *p++ = ' ';
+  *p++ = resource;
+  *p++ = ' ';
+
+  if (xlen == 64)
+    {
+      p = putHex(p, addr, 16);
+      *p++ = ' ';
+      p = putHex(p, value, 16);
+    }
+  else if (resource == 'f')
+    {
+      p = putHex(p, uint32_t(addr), 2);
+      *p++ = ' ';
+      p = putHex(p, value, 16);
+    }
+  else
+    {
+      uint32_t addr32 = addr, value32 = value;
+      if (resource == 'r')
+	{
+	  p = putHex(p, addr32, 2);
+	  p = putStr(p, "         ", 9);
+	}
+      else if (resource == 'c' and (addr32 >> 16) == 0)
+	{
+	  p = putHex(p, addr32, 4);
+	  p = putStr(p, "       ", 7);
+	}
+      else
+	{
+	  p = putHex(p, addr32, 8);
+	  p = putStr(p, "   ", 3);
+	}
+      p = putHex(p, value32, 8);
+    }
+
+  *p++ = ' ';
+  *p++ = ' ';
+  p = putStr(p, text.assembly, text.assemblyLen);
+  p = putStr(p, text.annotation, text.annotationLen);
+  return p;
+}
+
+
+void
+WdRiscv::appendTraceRecord(std::string& out, const TraceRecord& rec,
+			   const char* assembly, unsigned xlen)
+{
+  TraceLineText text;
+  text.assembly = assembly;
+  text.assemblyLen = strlen(assembly);
+
+  char* cursor = text.annotation;
+  if (rec.interrupted)
+    cursor = putStr(cursor, " (interrupted)", 14);
+  if (rec.hasLdSt)
+    {
+      cursor = putStr(cursor, " [0x", 4);
+      cursor = putHex(cursor, rec.ldStAddr, 1);
+      *cursor++ = ']';
+    }
+  text.annotationLen = cursor - text.annotation;
+
+  memset(text.opcode, ' ', sizeof(text.opcode));
+  if (rec.instSize == 4)
+    putHex(text.opcode, rec.inst, 8);
+  else
+    putHex(text.opcode + 4, rec.inst & 0xffff, 4);
+
+  // Reserve room for all the lines of the record.
+  unsigned lines = ((rec.intReg > 0) + (rec.fpReg >= 0) + rec.csrCount +
+		    (rec.memSize > 0));
+  lines = lines ? lines : 1;
+  size_t lineRoom = 96 + text.assemblyLen + text.annotationLen + 4;
+  size_t size = out.size();
+  out.resize(size + lines*lineRoom);
+  char* begin = &out[size];
+  char* p = begin;
+
+  bool pending = false;  // True if a printed line need to be terminated.
+
+  if (rec.intReg > 0)
+    {
+      p = formatLine(p, rec, text, 'r', rec.intReg, rec.intValue, xlen);
+      pending = true;
+    }
+
+  if (rec.fpReg >= 0)
+    {
+      if (pending) p = putStr(p, "  +\n", 4);
+      p = formatLine(p, rec, text, 'f', rec.fpReg, rec.fpValue, xlen);
+      pending = true;
+    }
+
+  for (unsigned i = 0; i < rec.csrCount; ++i)
+    {
+      if (pending) p = putStr(p, "  +\n", 4);
+      p = formatLine(p, rec, text, 'c', rec.csrs[i][0], rec.csrs[i][1], xlen);
+      pending = true;
+    }
+
+  if (rec.memSize > 0)
+    {
+      if (pending) p = putStr(p, "  +\n", 4);
+      p = formatLine(p, rec, text, 'm', rec.memAddr, rec.memValue, xlen);
+      pending = true;
+    }
+
+  if (not pending)
+    {
+      // No diffs: Generate an x0 record.
+      p = formatLine(p, rec, text, 'r', 0, 0, xlen);
+    }
+  *p++ = '\n';
+
+  out.resize(size + (p - begin));
+}
+
+
+void
+WdRiscv::printTraceRecord(FILE* out, const TraceRecord& rec,
+			  const char* assembly, unsigned xlen)
+{
+  static thread_local std::string buffer;
+  buffer.clear();
+  appendTraceRecord(buffer, rec, assembly, xlen);
+  fwrite(buffer.data(), 1, buffer.size(), out);
+}
+
+
+static inline
+void
+putVarint(std::string& buffer, uint64_t value)
+{
+  while (value >= 0x80)
+    {
+      buffer.push_back(char(value | 0x80));
+      value >>= 7;
+    }
+  buffer.push_back(char(value));
+}
+
+
+/// Zig-zag encode a signed delta so that small magnitudes produce
+/// short varints.
+static inline
+void
+putDelta(std::string& buffer, uint64_t value, uint64_t prev)
+{
+  int64_t delta = int64_t(value - prev);
+  putVarint(buffer, (uint64_t(delta) << 1) ^ uint64_t(delta >> 63));
+}
+
+
+void
+BinaryTraceEncoder::encodeHeader(std::string& buffer, unsigned xlen,
+				 uint64_t isa)
+{
+  buffer.append(binaryTraceMagic, sizeof(binaryTraceMagic));
+  buffer.push_back(char(binaryTraceVersion));
+  buffer.push_back(char(xlen));
+  putVarint(buffer, isa);
+}
+
+
+void
+BinaryTraceEncoder::reset()
+{
+  harts_.clear();
+  lastHart_ = 0;
+  pendingReset_ = true;
+}
+
+
+void
+BinaryTraceEncoder::encode(const TraceRecord& rec, std::string& buffer)
+{
+  if (rec.hartId >= harts_.size())
+    harts_.resize(rec.hartId + 1);
+  HartState& state = harts_.at(rec.hartId);
+
+  unsigned flags = 0;
+  if (rec.intReg > 0)                 flags |= BtIntReg;
+  if (rec.fpReg >= 0)                 flags |= BtFpReg;
+  if (rec.csrCount)                   flags |= BtCsrs;
+  if (rec.memSize)                    flags |= BtMem;
+  if (rec.interrupted)                flags |= BtInterrupted;
+  if (rec.hasLdSt)                    flags |= BtLdSt;
+  if (rec.pc != state.nextPc)         flags |= BtPcJump;
+  if (rec.tag != state.tag + 1)       flags |= BtTagJump;
+  if (rec.hartId != lastHart_)        flags |= BtHart;
+  if (rec.instSize != 4)              flags |= BtCompressed;
+  if (pendingReset_)                  flags |= BtReset;
+  pendingReset_ = false;
+
+  putVarint(buffer, flags);
+  if (flags & BtHart)
+    putVarint(buffer, rec.hartId);
+  if (flags & BtTagJump)
+    putDelta(buffer, rec.tag, state.tag + 1);
+  if (flags & BtPcJump)
+    putDelta(buffer, rec.pc, state.nextPc);
+  putVarint(buffer, rec.instSize == 4 ? rec.inst : rec.inst & 0xffff);
+
+  if (flags & BtIntReg)
+    {
+      buffer.push_back(char(rec.intReg));
+      putVarint(buffer, rec.intValue);
+    }
+
+  if (flags & BtFpReg)
+    {
+      buffer.push_back(char(rec.fpReg));
+      putVarint(buffer, rec.fpValue);
+    }
+
+  if (flags & BtCsrs)
+    {
+      // CSR numbers are sorted: Store increments.
+      putVarint(buffer, rec.csrCount);
+      uint64_t prev = 0;
+      for (unsigned i = 0; i < rec.csrCount; ++i)
+	{
+	  putVarint(buffer, rec.csrs[i][0] - prev);
+	  putVarint(buffer, rec.csrs[i][1]);
+	  prev = rec.csrs[i][0];
+	}
+    }
+
+  // Load/store address precedes memory address: A store address is
+  // usually the same as the memory address encoding the latter in a
+  // single byte.
+  if (flags & BtLdSt)
+    {
+      putDelta(buffer, rec.ldStAddr, state.addr);
+      state.addr = rec.ldStAddr;
+    }
+
+  if (flags & BtMem)
+    {
+      buffer.push_back(char(rec.memSize));
+      putDelta(buffer, rec.memAddr, state.addr);
+      putVarint(buffer, rec.memValue);
+      state.addr = rec.memAddr;
+    }
+
+  state.tag = rec.tag;
+  state.nextPc = rec.pc + rec.instSize;
+  lastHart_ = rec.hartId;
+}
+
+
+BinaryTraceWriter::BinaryTraceWriter(FILE* out, unsigned xlen, uint64_t isa)
+  : out_(out)
+{
+  buffer_.reserve(binaryTraceBufferSize + 1024);
+  BinaryTraceEncoder::encodeHeader(buffer_, xlen, isa);
+}
+
+
+BinaryTraceWriter::~BinaryTraceWriter()
+{
+  flush();
+}
+
+
+void
+BinaryTraceWriter::write(const TraceRecord& rec)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  encoder_.encode(rec, buffer_);
+
+  if (buffer_.size() >= binaryTraceBufferSize)
+    {
+      fwrite(buffer_.data(), 1, buffer_.size(), out_);
+      buffer_.clear();
+    }
+}
+
+
+void
+BinaryTraceWriter::flush()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (not buffer_.empty())
+    fwrite(buffer_.data(), 1, buffer_.size(), out_);
+  buffer_.clear();
+  fflush(out_);
+}
+
+
+static const char columnTraceMagic[8] = { 'W', 'H', 'I', 'S', 'P', 'E', 'R',
+					 'C' };
+
+static const uint8_t columnTraceVersion = 1;
+
+/// Name and element size of each column of a columnar trace.
+static const struct { const char* name; unsigned size; } columnTraceSchema[] =
+  {
+    { "pc", 8 }, { "inst_id", 2 }, { "rd", 1 }, { "rd_value", 8 },
+    { "mem_addr", 8 }, { "mem_size", 1 }, { "hart", 2 }
+  };
+
+
+/// Append to the given buffer the given number of least significant
+/// bytes of value in little endian order.
+static inline
+void
+putLittleEndian(std::string& buffer, uint64_t value, unsigned size)
+{
+  char bytes[8];
+  for (unsigned i = 0; i < size; ++i, value >>= 8)
+    bytes[i] = char(value);
+  buffer.append(bytes, size);
+}
+
+
+ColumnTraceWriter::ColumnTraceWriter(FILE* out, unsigned groupRows)
+  : out_(out), groupRows_(groupRows ? groupRows : 1)
+{
+  static_assert(sizeof(columnTraceSchema)/sizeof(columnTraceSchema[0]) ==
+		ColumnCount, "Column count mismatch");
+
+  std::string header(columnTraceMagic, sizeof(columnTraceMagic));
+  header.push_back(char(columnTraceVersion));
+  header.push_back(char(ColumnCount));
+  for (const auto& column : columnTraceSchema)
+    {
+      header.push_back(char(column.size));
+      header.append(column.name);
+      header.push_back('\0');
+    }
+  fwrite(header.data(), 1, header.size(), out_);
+
+  for (unsigned i = 0; i < ColumnCount; ++i)
+    columns_[i].reserve(size_t(groupRows_) * columnTraceSchema[i].size);
+}
+
+
+ColumnTraceWriter::~ColumnTraceWriter()
+{
+  flush();
+}
+
+
+void
+ColumnTraceWriter::write(const TraceRecord& rec, unsigned instId,
+			 uint64_t memAddr, unsigned memSize)
+{
+  unsigned rd = 0;
+  uint64_t rdValue = 0;
+  if (rec.intReg > 0)
+    {
+      rd = rec.intReg;
+      rdValue = rec.intValue;
+    }
+  else if (rec.fpReg >= 0)
+    {
+      rd = 32 + rec.fpReg;
+      rdValue = rec.fpValue;
+    }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  putLittleEndian(columns_[0], rec.pc, 8);
+  putLittleEndian(columns_[1], instId, 2);
+  putLittleEndian(columns_[2], rd, 1);
+  putLittleEndian(columns_[3], rdValue, 8);
+  putLittleEndian(columns_[4], memAddr, 8);
+  putLittleEndian(columns_[5], memSize, 1);
+  putLittleEndian(columns_[6], rec.hartId, 2);
+
+  if (++rows_ >= groupRows_)
+    writeGroup();
+}
+
+
+void
+ColumnTraceWriter::writeGroup()
+{
+  if (rows_ == 0)
+    return;
+
+  std::string group;
+  putLittleEndian(group, rows_, 4);
+  fwrite(group.data(), 1, group.size(), out_);
+
+  for (auto& column : columns_)
+    {
+      uLongf size = compressBound(column.size());
+      compressed_.resize(size);
+      auto dest = reinterpret_cast<Bytef*>(&compressed_[0]);
+      auto source = reinterpret_cast<const Bytef*>(column.data());
+      if (compress(dest, &size, source, column.size()) != Z_OK)
+	{
+	  std::cerr << "Failed to compress columnar trace data\n";
+	  size = 0;
+	}
+      group.clear();
+      putLittleEndian(group, size, 4);
+      fwrite(group.data(), 1, group.size(), out_);
+      fwrite(compressed_.data(), 1, size, out_);
+      column.clear();
+    }
+
+  rows_ = 0;
+}
+
+
+void
+ColumnTraceWriter::flush()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  writeGroup();
+  fflush(out_);
+}
+
+
+/// Read a varint from the given file into value. Return true on
+/// success and false on end of file or on a malformed varint.
+static inline
+bool
+getVarint(gzFile in, uint64_t& value)
+{
+  value = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7)
+    {
+      int c = gzgetc(in);
+      if (c == EOF)
+	return false;
+      value |= uint64_t(c & 0x7f) << shift;
+      if ((c & 0x80) == 0)
+	return true;
+    }
+  return false;
+}
+
+
+static inline
+bool
+getDelta(gzFile in, uint64_t& value, uint64_t prev)
+{
+  uint64_t zz = 0;
+  if (not getVarint(in, zz))
+    return false;
+  int64_t delta = int64_t(zz >> 1) ^ -int64_t(zz & 1);
+  value = prev + uint64_t(delta);
+  return true;
+}
+
+
+bool
+BinaryTraceReader::readHeader()
+{
+  char magic[sizeof(binaryTraceMagic)];
+  if (gzread(in_, magic, sizeof(magic)) != int(sizeof(magic)) or
+      memcmp(magic, binaryTraceMagic, sizeof(magic)) != 0)
+    return false;
+
+  int version = gzgetc(in_);
+  int xlen = gzgetc(in_);
+  if (version != binaryTraceVersion or (xlen != 32 and xlen != 64))
+    return false;
+
+  xlen_ = xlen;
+  return getVarint(in_, isa_);
+}
+
+
+bool
+BinaryTraceReader::read(TraceRecord& rec, bool& error)
+{
+  error = false;
+
+  uint64_t flags = 0;
+  if (not getVarint(in_, flags))
+    return false;   // End of file.
+
+  // Any failure after this point is an error.
+  error = true;
+
+  if (flags & BtReset)
+    {
+      harts_.clear();
+      lastHart_ = 0;
+    }
+
+  uint64_t hartId = lastHart_;
+  if ((flags & BtHart) and not getVarint(in_, hartId))
+    return false;
+  if (hartId >= 1024)
+    return false;
+
+  if (hartId >= harts_.size())
+    harts_.resize(hartId + 1);
+  HartState& state = harts_.at(hartId);
+
+  rec.clearChanges();
+  rec.hartId = hartId;
+  rec.interrupted = flags & BtInterrupted;
+  rec.instSize = (flags & BtCompressed) ? 2 : 4;
+
+  rec.tag = state.tag + 1;
+  if ((flags & BtTagJump) and not getDelta(in_, rec.tag, state.tag + 1))
+    return false;
+
+  rec.pc = state.nextPc;
+  if ((flags & BtPcJump) and not getDelta(in_, rec.pc, state.nextPc))
+    return false;
+
+  uint64_t value = 0;
+  if (not getVarint(in_, value))
+    return false;
+  rec.inst = value;
+
+  if (flags & BtIntReg)
+    {
+      int reg = gzgetc(in_);
+      if (reg <= 0 or reg >= 32 or not getVarint(in_, rec.intValue))
+	return false;
+      rec.intReg = reg;
+    }
+
+  if (flags & BtFpReg)
+    {
+      int reg = gzgetc(in_);
+      if (reg < 0 or reg >= 32 or not getVarint(in_, rec.fpValue))
+	return false;
+      rec.fpReg = reg;
+    }
+
+  if (flags & BtCsrs)
+    {
+      uint64_t count = 0;
+      if (not getVarint(in_, count) or count > TraceRecord::MaxCsrs)
+	return false;
+      uint64_t prev = 0;
+      for (unsigned i = 0; i < count; ++i)
+	{
+	  uint64_t inc = 0;
+	  if (not getVarint(in_, inc) or not getVarint(in_, rec.csrs[i][1]))
+	    return false;
+	  rec.csrs[i][0] = prev + inc;
+	  prev = rec.csrs[i][0];
+	}
+      rec.csrCount = count;
+    }
+
+  if (flags & BtLdSt)
+    {
+      if (not getDelta(in_, rec.ldStAddr, state.addr))
+	return false;
+      rec.hasLdSt = true;
+      state.addr = rec.ldStAddr;
+    }
+
+  if (flags & BtMem)
+    {
+      int size = gzgetc(in_);
+      if (size <= 0 or size > 8)
+	return false;
+      if (not getDelta(in_, rec.memAddr, state.addr) or
+	  not getVarint(in_, rec.memValue))
+	return false;
+      rec.memSize = size;
+      state.addr = rec.memAddr;
+    }
+
+  state.tag = rec.tag;
+  state.nextPc = rec.pc + rec.instSize;
+  lastHart_ = hartId;
+
+  error = false;
+  return true;
+}
+
+
+bool
+TraceIndex::read(const std::string& path)
+{
+  FILE* file = fopen(path.c_str(), "r");
+  if (not file)
+    {
+      std::cerr << "Failed to open trace index file '" << path
+		<< "' for input\n";
+      return false;
+    }
+
+  char format[16];
+  unsigned version = 0;
+  bool ok = (fscanf(file, "whisper-trace-index %u %15s %u 0x%" SCNx64 " %" SCNu64,
+		    &version, format, &xlen, &isa, &chunkSize) == 5);
+  ok = ok and version == 1 and (xlen == 32 or xlen == 64);
+  binary = strcmp(format, "binary") == 0;
+
+  uint64_t tag = 0, offset = 0;
+  while (ok and fscanf(file, "%" SCNu64 " %" SCNu64, &tag, &offset) == 2)
+    chunks.push_back(std::make_pair(tag, offset));
+
+  if (not ok)
+    std::cerr << "File " << path << " is not a valid trace index\n";
+  fclose(file);
+  return ok;
+}
+
+
+uint64_t
+TraceIndex::findOffset(uint64_t tag) const
+{
+  uint64_t offset = 0;
+  for (const auto& [chunkTag, chunkOffset] : chunks)
+    {
+      if (chunkTag > tag)
+	break;
+      offset = chunkOffset;
+    }
+  return offset;
+}
+
+
+TraceRing::TraceRing(size_t capacity)
+{
+  size_t size = 2;
+  while (size < capacity)
+    size *= 2;
+  slots_.resize(size);
+  mask_ = size - 1;
+}
+
+
+bool
+TraceRing::push(const TraceRecord& rec)
+{
+  size_t tail = tail_.load(std::memory_order_relaxed);
+  if (tail - cachedHead_ > mask_)
+    {
+      cachedHead_ = head_.load(std::memory_order_acquire);
+      if (tail - cachedHead_ > mask_)
+	return false;  // Full.
+    }
+
+  slots_[tail & mask_].copyFrom(rec);
+  tail_.store(tail + 1, std::memory_order_release);
+  return true;
+}
+
+
+const TraceRecord*
+TraceRing::front()
+{
+  size_t head = head_.load(std::memory_order_relaxed);
+  if (head == cachedTail_)
+    {
+      cachedTail_ = tail_.load(std::memory_order_acquire);
+      if (head == cachedTail_)
+	return nullptr;  // Empty.
+    }
+  return &slots_[head & mask_];
+}
+
+
+void
+TraceRing::pop()
+{
+  size_t head = head_.load(std::memory_order_relaxed);
+  head_.store(head + 1, std::memory_order_release);
+}
+
+
+AsyncTracer::AsyncTracer(size_t ringSize, bool block)
+  : ringSize_(ringSize), block_(block)
+{
+}
+
+
+AsyncTracer::~AsyncTracer()
+{
+  stop();
+}
+
+
+/// Open a gzip stream writing to the given file through a duplicate
+/// of its descriptor: Closing the stream leaves the file open. Return
+/// null on failure.
+static
+gzFile
+openGzip(FILE* file)
+{
+  fflush(file);
+  int fd = dup(fileno(file));
+  if (fd < 0)
+    return nullptr;
+  gzFile gz = gzdopen(fd, "wb");
+  if (not gz)
+    close(fd);
+  return gz;
+}
+
+
+int
+AsyncTracer::addOutput(FILE* file, bool binary, bool compress, unsigned xlen,
+		       uint64_t isa, uint64_t chunkSize,
+		       const std::string& indexPath)
+{
+  auto output = std::make_unique<Output>();
+  output->file = file;
+  output->binary = binary;
+
+  if (compress or chunkSize)
+    {
+      output->gz = openGzip(file);
+      if (not output->gz)
+	return -1;
+    }
+
+  if (chunkSize)
+    {
+      output->index = fopen(indexPath.c_str(), "w");
+      if (not output->index)
+	{
+	  std::cerr << "Failed to open trace index file '" << indexPath
+		    << "' for output\n";
+	  gzclose(output->gz);
+	  return -1;
+	}
+      output->chunkSize = chunkSize;
+      fprintf(output->index, "whisper-trace-index 1 %s %u 0x%" PRIx64
+	      " %" PRIu64 "\n", binary? "binary" : "text", xlen, isa,
+	      chunkSize);
+    }
+
+  if (binary)
+    BinaryTraceEncoder::encodeHeader(output->buffer, xlen, isa);
+
+  outputs_.push_back(std::move(output));
+  return int(outputs_.size() - 1);
+}
+
+
+void
+AsyncTracer::startChunk(unsigned ix, uint64_t tag)
+{
+  Output& output = *outputs_.at(ix);
+
+  if (output.chunked)
+    {
+      // Complete the current gzip member and start a new one.
+      writeOutput(ix);
+      gzclose(output.gz);
+      output.gz = openGzip(output.file);
+      output.encoder.reset();
+    }
+
+  off_t offset = lseek(fileno(output.file), 0, SEEK_CUR);
+  fprintf(output.index, "%" PRIu64 " %" PRIu64 "\n", tag, uint64_t(offset));
+  output.chunked = true;
+  output.nextChunkTag = (tag / output.chunkSize + 1) * output.chunkSize;
+}
+
+
+unsigned
+AsyncTracer::addSource(unsigned output, unsigned xlen, Disassembler disas)
+{
+  auto source = std::make_unique<Source>(ringSize_);
+  source->output = output;
+  source->xlen = xlen;
+  source->disas = disas;
+  sources_.push_back(std::move(source));
+  return sources_.size() - 1;
+}
+
+
+void
+AsyncTracer::start()
+{
+  if (thread_.joinable())
+    return;
+  stop_ = false;
+  thread_ = std::thread([this]() { run(); });
+}
+
+
+void
+AsyncTracer::stop()
+{
+  if (thread_.joinable())
+    {
+      stop_ = true;
+      thread_.join();
+
+      if (dropped_)
+	std::cerr << "Warning: " << dropped_ << " instruction trace records "
+		  << "dropped (trace ring full)\n";
+    }
+
+  for (size_t ix = 0; ix < outputs_.size(); ++ix)
+    {
+      writeOutput(ix);
+      Output& output = *outputs_.at(ix);
+      if (output.gz)
+	gzclose(output.gz);
+      output.gz = nullptr;
+      fflush(output.file);
+      if (output.index)
+	fclose(output.index);
+      output.index = nullptr;
+    }
+}
+
+
+void
+AsyncTracer::writeOutput(unsigned ix)
+{
+  Output& output = *outputs_.at(ix);
+  if (output.buffer.empty())
+    return;
+
+  if (output.failed)
+    ;  // Discard: Reader went away or disk is full.
+  else if (output.gz)
+    {
+      if (gzwrite(output.gz, output.buffer.data(), output.buffer.size()) == 0)
+	std::cerr << "Failed to write compressed trace\n";
+    }
+  else if (fwrite(output.buffer.data(), 1, output.buffer.size(),
+		  output.file) != output.buffer.size())
+    {
+      std::cerr << "Failed to write trace: " << strerror(errno)
+		<< " -- Discarding remaining trace records\n";
+      output.failed = true;
+    }
+  output.buffer.clear();
+}
+
+
+void
+AsyncTracer::run()
+{
+  // Records processed from a ring before moving to the next: Bounds
+  // the latency of the other harts sharing an output.
+  const unsigned batchSize = 256;
+
+  std::string text;
+
+  while (true)
+    {
+      // Sample the stop flag before draining: Records pushed before
+      // stop was requested are all written.
+      bool stopping = stop_;
+      uint64_t count = 0;
+
+      for (auto& sourcePtr : sources_)
+	{
+	  Source& source = *sourcePtr;
+	  Output& output = *outputs_.at(source.output);
+	  for (unsigned i = 0; i < batchSize; ++i)
+	    {
+	      const TraceRecord* rec = source.ring.front();
+	      if (not rec)
+		break;
+	      if (output.chunkSize and (rec->tag >= output.nextChunkTag or
+					not output.chunked))
+		startChunk(source.output, rec->tag);
+	      if (output.binary)
+		output.encoder.encode(*rec, output.buffer);
+	      else
+		{
+		  source.disas(*rec, text);
+		  appendTraceRecord(output.buffer, *rec, text.c_str(),
+				    source.xlen);
+		}
+	      source.ring.pop();
+	      count++;
+	    }
+	  if (output.buffer.size() >= output.batchSize)
+	    writeOutput(source.output);
+	}
+
+      if (count == 0)
+	{
+	  if (stopping)
+	    break;
+
+	  // Idle: Make the output visible and wait for records.
+	  for (size_t ix = 0; ix < outputs_.size(); ++ix)
+	    writeOutput(ix);
+	  std::this_thread::sleep_for(std::chrono::microseconds(100));
+	}
+    }
+}
@@ -0,0 +1,669 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+struct gzFile_s;
+
+
+namespace WdRiscv
+{
+
+  /// Changes made by an executed instruction as reported in the
+  /// instruction trace (see Hart::collectTraceRecord). A record holds
+  /// everything needed to reproduce the text trace lines of the
+  /// instruction except for the disassembly which can be regenerated
+  /// from the opcode.
+  struct TraceRecord
+  {
+    /// Maximum number of CSR changes kept in a record. Extra changes
+    /// are dropped and counted in droppedCsrs.
+    enum { MaxCsrs = 32 };
+
+    uint64_t tag = 0;             // Instruction rank.
+    uint64_t pc = 0;              // Instruction address.
+    uint32_t inst = 0;            // Instruction opcode.
+    unsigned instSize = 4;        // Instruction size in bytes: 2 or 4.
+    unsigned hartId = 0;
+    bool interrupted = false;     // Instruction interrupted.
+
+    bool hasLdSt = false;         // True if ldStAddr is valid.
+    uint64_t ldStAddr = 0;        // Load/store address.
+
+    int intReg = -1;              // Written integer register or -1 if none.
+    uint64_t intValue = 0;
+
+    int fpReg = -1;               // Written fp register or -1 if none.
+    uint64_t fpValue = 0;
+
+    /// Changed CSRs as number/value pairs sorted by number. Trigger
+    /// registers are numbered (trigger << 16) | tdata-csr-number.
+    unsigned csrCount = 0;
+    uint64_t csrs[MaxCsrs][2];
+    unsigned droppedCsrs = 0;     // Changed CSRs not kept (no room).
+
+    unsigned memSize = 0;         // Memory write size or 0 if no write.
+    uint64_t memAddr = 0;
+    uint64_t memValue = 0;
+
+    /// Copy given record into this one skipping unused CSR entries.
+    void copyFrom(const TraceRecord& other)
+    {
+      tag = other.tag; pc = other.pc; inst = other.inst;
+      instSize = other.instSize; hartId = other.hartId;
+      interrupted = other.interrupted; hasLdSt = other.hasLdSt;
+      ldStAddr = other.ldStAddr; intReg = other.intReg;
+      intValue = other.intValue; fpReg = other.fpReg;
+      fpValue = other.fpValue; csrCount = other.csrCount;
+      droppedCsrs = other.droppedCsrs;
+      for (unsigned i = 0; i < csrCount; ++i)
+	{ csrs[i][0] = other.csrs[i][0]; csrs[i][1] = other.csrs[i][1]; }
+      memSize = other.memSize; memAddr = other.memAddr;
+      memValue = other.memValue;
+    }
+
+    /// Add a changed CSR keeping the CSRs sorted by number. Replace the
+    /// value if number is already present. Keep the MaxCsrs smallest
+    /// numbers if there is no room counting the other in droppedCsrs.
+    void addCsr(uint64_t number, uint64_t value)
+    {
+      unsigned ix = 0;
+      while (ix < csrCount and csrs[ix][0] < number)
+	ix++;
+      if (ix < csrCount and csrs[ix][0] == number)
+	{
+	  csrs[ix][1] = value;
+	  return;
+	}
+      if (ix >= MaxCsrs)
+	{
+	  droppedCsrs++;
+	  return;
+	}
+      if (csrCount == MaxCsrs)
+	droppedCsrs++;  // Largest number pushed out.
+      unsigned last = csrCount < MaxCsrs ? csrCount : MaxCsrs - 1;
+      for (unsigned i = last; i > ix; --i)
+	{ csrs[i][0] = csrs[i-1][0]; csrs[i][1] = csrs[i-1][1]; }
+      csrs[ix][0] = number;
+      csrs[ix][1] = value;
+      if (csrCount < MaxCsrs)
+	csrCount++;
+    }
+
+    /// Mark this record as having no changes.
+    void clearChanges()
+    {
+      hasLdSt = false; intReg = -1; fpReg = -1; csrCount = 0; memSize = 0;
+      interrupted = false; droppedCsrs = 0;
+    }
+  };
+
+
+  /// Print to the given file the text trace lines of the given record
+  /// (the --logfile format) using the given disassembly text. The
+  /// format of the numbers is that of a hart with the given register
+  /// width (32 or 64).
+  void printTraceRecord(FILE* out, const TraceRecord& rec,
+			const char* assembly, unsigned xlen);
+
+  /// Same as printTraceRecord but append the text to the given buffer.
+  void appendTraceRecord(std::string& buffer, const TraceRecord& rec,
+			 const char* assembly, unsigned xlen);
+
+
+  /// Changes made by an executed instruction as kept by the flight
+  /// recorder: The subset of a TraceRecord (no CSR changes, no
+  /// load/store address) cheap enough to collect after every
+  /// instruction in fast mode.
+  struct FlightRecord
+  {
+    uint64_t tag = 0;             // Instruction rank.
+    uint64_t pc = 0;              // Instruction address.
+    uint64_t intValue = 0;
+    uint64_t fpValue = 0;
+    uint64_t memAddr = 0;
+    uint64_t memValue = 0;
+    uint32_t inst = 0;            // Instruction opcode.
+    int8_t intReg = -1;           // Written integer register or -1 if none.
+    int8_t fpReg = -1;            // Written fp register or -1 if none.
+    uint8_t memSize = 0;          // Memory write size or 0 if no write.
+
+    /// Fill the given trace record (for printing) from this record.
+    void toTraceRecord(TraceRecord& rec, unsigned hartId) const
+    {
+      rec.clearChanges();
+      rec.tag = tag; rec.pc = pc; rec.inst = inst;
+      rec.instSize = (inst & 3) == 3 ? 4 : 2;
+      rec.hartId = hartId;
+      rec.intReg = intReg; rec.intValue = intValue;
+      rec.fpReg = fpReg; rec.fpValue = fpValue;
+      rec.memSize = memSize; rec.memAddr = memAddr; rec.memValue = memValue;
+    }
+  };
+
+
+  /// Fixed-size ring of the most recent flight records of a hart
+  /// (see Hart::enableFlightRecorder). Once the ring is full, a new
+  /// record overwrites the oldest one.
+  class FlightRecorder
+  {
+  public:
+
+    /// Keep the given number of most recent records discarding the
+    /// current content. A count of zero disables recording.
+    void resize(size_t count)
+    {
+      size_t slots = 1;
+      while (slots < count)
+	slots *= 2;
+      ring_.assign(count ? slots : 0, FlightRecord());
+      mask_ = slots - 1;
+      limit_ = count;
+      total_ = 0;
+    }
+
+    /// Return the maximum number of records kept (zero if recording
+    /// is disabled).
+    size_t capacity() const
+    { return limit_; }
+
+    /// Return the number of records currently kept.
+    size_t size() const
+    { return total_ < limit_ ? total_ : limit_; }
+
+    /// Return the slot of a new record.
+    FlightRecord& next()
+    { return ring_[total_++ & mask_]; }
+
+    /// Return the ith kept record, 0 being the oldest.
+    const FlightRecord& at(size_t i) const
+    { return ring_[(total_ - size() + i) & mask_]; }
+
+    /// Discard all records.
+    void clear()
+    { total_ = 0; }
+
+  private:
+
+    std::vector<FlightRecord> ring_;
+    size_t mask_ = 0;
+    size_t limit_ = 0;
+    uint64_t total_ = 0;    // Count of records ever recorded.
+  };
+
+
+  /// Memoized disassembly text of executed instructions: A direct
+  /// mapped cache indexed by instruction address (like the decode
+  /// cache of a hart) and tagged with address and opcode, so that an
+  /// instruction executed many times is disassembled once. Slots are
+  /// allocated on first use.
+  class DisasCache
+  {
+  public:
+
+    /// Define a cache with the given number of slots (rounded up to
+    /// a power of 2).
+    DisasCache(size_t count = 64*1024)
+    {
+      size_t slots = 1;
+      while (slots < count)
+	slots *= 2;
+      mask_ = slots - 1;
+    }
+
+    /// Return the text slot of the instruction with the given address
+    /// and opcode. Set hit to true if the slot already holds the
+    /// disassembly of that instruction. Otherwise, set hit to false
+    /// and claim the slot: The caller must fill the returned string.
+    std::string& slot(uint64_t addr, uint32_t inst, bool& hit)
+    {
+      if (entries_.empty())
+	entries_.resize(mask_ + 1);
+      Entry& entry = entries_[(addr >> 1) & mask_];
+      hit = entry.valid and entry.addr == addr and entry.inst == inst;
+      entry.valid = true;
+      entry.addr = addr;
+      entry.inst = inst;
+      return entry.text;
+    }
+
+    /// Invalidate the entries overlapping the given memory range
+    /// (e.g. after a store to that range).
+    void invalidate(uint64_t addr, unsigned size)
+    {
+      if (entries_.empty())
+	return;
+
+      // Check the location before the address in case it contains a
+      // 4-byte instruction overlapping the range.
+      size += 3;
+      addr -= 3;
+      for (unsigned i = 0; i < size; i += 2)
+	{
+	  Entry& entry = entries_[((addr + i) >> 1) & mask_];
+	  if ((entry.addr >> 1) == ((addr + i) >> 1))
+	    entry.valid = false;
+	}
+    }
+
+    /// Invalidate all the entries.
+    void clear()
+    {
+      for (auto& entry : entries_)
+	entry.valid = false;
+    }
+
+  private:
+
+    struct Entry
+    {
+      uint64_t addr = 0;
+      uint32_t inst = 0;
+      bool valid = false;
+      std::string text;
+    };
+
+    std::vector<Entry> entries_;
+    size_t mask_ = 0;
+  };
+
+
+  /// Encode instruction trace records in binary form. A binary trace
+  /// file starts with a header (magic string, format version,
+  /// register width and MISA value of the traced harts) followed by
+  /// variable-length records: A record starts with a varint of
+  /// presence flags and stores the instruction rank and address as
+  /// deltas from the previous record of the same hart (nothing is
+  /// stored in the common case of sequential execution), the opcode
+  /// as a varint, and the register, CSR and memory changes as varints
+  /// (memory and load/store addresses as deltas from the last address
+  /// of the same hart).
+  class BinaryTraceEncoder
+  {
+  public:
+
+    /// Append to the given buffer the file header for traced harts
+    /// of the given register width and MISA value.
+    static void encodeHeader(std::string& buffer, unsigned xlen, uint64_t isa);
+
+    /// Append to the given buffer the encoding of the given record.
+    void encode(const TraceRecord& rec, std::string& buffer);
+
+    /// Forget the previous records: The next record is encoded
+    /// without reference to earlier ones and is flagged so that a
+    /// reader starting at that record (e.g. at a chunk boundary, see
+    /// TraceIndex) or reading through it decodes it correctly.
+    void reset();
+
+  private:
+
+    /// Encoding state (previous record) of each hart.
+    struct HartState
+    {
+      uint64_t tag = 0;
+      uint64_t nextPc = 0;
+      uint64_t addr = 0;
+    };
+
+    std::vector<HartState> harts_;
+    unsigned lastHart_ = 0;
+    bool pendingReset_ = false;
+  };
+
+
+  /// Write instruction trace records to a file in binary form (see
+  /// BinaryTraceEncoder). Records are buffered: The buffer is flushed
+  /// when full and on flush/destruction.
+  class BinaryTraceWriter
+  {
+  public:
+
+    /// Constructor: Write the file header. Isa is the MISA value of
+    /// the traced harts (needed to disassemble the opcodes). File is
+    /// not closed by this object.
+    BinaryTraceWriter(FILE* out, unsigned xlen, uint64_t isa);
+
+    ~BinaryTraceWriter();
+
+    /// Append given record to the file. Safe to call from multiple
+    /// threads.
+    void write(const TraceRecord& rec);
+
+    /// Write buffered records to the file.
+    void flush();
+
+  private:
+
+    BinaryTraceWriter(const BinaryTraceWriter&) = delete;
+    void operator= (const BinaryTraceWriter&) = delete;
+
+    FILE* out_ = nullptr;
+    std::string buffer_;
+    std::mutex mutex_;
+    BinaryTraceEncoder encoder_;
+  };
+
+
+  /// Write retired instruction data in columnar form for bulk
+  /// analysis. The columns are: pc (8 bytes), inst_id (2 bytes, see
+  /// InstId), rd (1 byte: 0 if no register written, n for integer
+  /// register xn, and 32+n for fp register fn), rd_value (8 bytes),
+  /// mem_addr (8 bytes), mem_size (1 byte: data size of a load or
+  /// store, 0 if none) and hart (2 bytes). All numbers are little
+  /// endian.
+  ///
+  /// The file starts with a schema header: The magic string
+  /// "WHISPERC", a version byte, a column count byte, then for each
+  /// column a byte holding the element size followed by the column
+  /// name terminated by a null byte. The header is followed by row
+  /// groups of up to groupRows rows: A group starts with the 4-byte
+  /// row count followed, for each column in schema order, by the
+  /// 4-byte size of the column data compressed with zlib and by the
+  /// compressed data. A reader can thus skip the columns it does not
+  /// need.
+  class ColumnTraceWriter
+  {
+  public:
+
+    /// Constructor: Write the schema header. File is not closed by
+    /// this object.
+    ColumnTraceWriter(FILE* out, unsigned groupRows = 64*1024);
+
+    ~ColumnTraceWriter();
+
+    /// Append a row for the given record. InstId is the instruction
+    /// id of the record opcode. MemAddr/memSize are the address and
+    /// size of the data accessed by a load or a store (size is 0 if
+    /// none). Safe to call from multiple threads.
+    void write(const TraceRecord& rec, unsigned instId, uint64_t memAddr,
+	       unsigned memSize);
+
+    /// Write buffered rows (as a possibly partial row group) to the
+    /// file.
+    void flush();
+
+  private:
+
+    ColumnTraceWriter(const ColumnTraceWriter&) = delete;
+    void operator= (const ColumnTraceWriter&) = delete;
+
+    /// Compress and write the buffered rows. Mutex must be held.
+    void writeGroup();
+
+    enum { ColumnCount = 7 };
+
+    FILE* out_ = nullptr;
+    unsigned groupRows_ = 0;
+    unsigned rows_ = 0;                   // Buffered rows.
+    std::string columns_[ColumnCount];    // Buffered (raw) column data.
+    std::string compressed_;              // Scratch for compression.
+    std::mutex mutex_;
+  };
+
+
+  /// Read the records of a binary instruction trace file (see
+  /// BinaryTraceWriter). File may be gzip compressed.
+  class BinaryTraceReader
+  {
+  public:
+
+    /// Constructor. File is not closed by this object.
+    BinaryTraceReader(gzFile_s* in)
+      : in_(in)
+    { }
+
+    /// Read and check the file header. Return true on success and
+    /// false if the file is not a binary trace file.
+    bool readHeader();
+
+    /// Use given register width and MISA value instead of reading the
+    /// header: Used when reading starts at a chunk (see TraceIndex).
+    void setFormat(unsigned xlen, uint64_t isa)
+    { xlen_ = xlen; isa_ = isa; }
+
+    /// Register width (32 or 64) of the traced harts. Valid after a
+    /// successful readHeader.
+    unsigned xlen() const
+    { return xlen_; }
+
+    /// MISA value of the traced harts. Valid after a successful
+    /// readHeader.
+    uint64_t isa() const
+    { return isa_; }
+
+    /// Read next record into rec. Return true on success and false on
+    /// end of file. Set error to true if the file is corrupt.
+    bool read(TraceRecord& rec, bool& error);
+
+  private:
+
+    gzFile_s* in_ = nullptr;
+    unsigned xlen_ = 0;
+    uint64_t isa_ = 0;
+
+    struct HartState
+    {
+      uint64_t tag = 0;
+      uint64_t nextPc = 0;
+      uint64_t addr = 0;
+    };
+
+    std::vector<HartState> harts_;
+    unsigned lastHart_ = 0;
+  };
+
+
+  /// Index of a chunked trace file: A chunked trace file (text or
+  /// binary) is a sequence of gzip members (chunks), a new member
+  /// starting with the first record whose tag reaches the next
+  /// multiple of the chunk size. The index file (trace file path
+  /// followed by ".idx") is a text file with a header line
+  ///    whisper-trace-index <version> <text|binary> <xlen> <isa> <chunk-size>
+  /// followed by a line per chunk
+  ///    <first-tag> <file-offset>
+  /// A reader can start decompressing at the offset of any chunk.
+  struct TraceIndex
+  {
+    bool binary = false;
+    unsigned xlen = 32;
+    uint64_t isa = 0;
+    uint64_t chunkSize = 0;
+    std::vector< std::pair<uint64_t, uint64_t> > chunks;  // Tag/offset pairs.
+
+    /// Read the index in the given file. Return true on success and
+    /// false on failure.
+    bool read(const std::string& path);
+
+    /// Return the file offset of the last chunk starting at or before
+    /// the given tag (0 if none).
+    uint64_t findOffset(uint64_t tag) const;
+  };
+
+
+  /// Bounded lock-free single-producer single-consumer ring of trace
+  /// records.
+  class TraceRing
+  {
+  public:
+
+    /// Constructor: Capacity (in records) is rounded up to a power of
+    /// 2.
+    explicit TraceRing(size_t capacity);
+
+    /// Producer side: Append given record. Return false if ring is
+    /// full.
+    bool push(const TraceRecord& rec);
+
+    /// Consumer side: Return the oldest record or null if ring is
+    /// empty. Record remains valid until the next pop.
+    const TraceRecord* front();
+
+    /// Consumer side: Remove the oldest record. Ring must not be empty.
+    void pop();
+
+  private:
+
+    std::vector<TraceRecord> slots_;
+    size_t mask_ = 0;
+
+    // Head and tail counters are on separate cache lines to avoid
+    // false sharing between producer and consumer.
+    alignas(64) std::atomic<size_t> head_ = 0;  // Next slot to read.
+    size_t cachedTail_ = 0;                     // Consumer copy of tail.
+    alignas(64) std::atomic<size_t> tail_ = 0;  // Next slot to write.
+    size_t cachedHead_ = 0;                     // Producer copy of head.
+  };
+
+
+  /// Asynchronous instruction trace: Each traced hart (source) pushes
+  /// its trace records into its own ring (see TraceRing) and a
+  /// background thread disassembles, formats (text or binary),
+  /// optionally compresses (gzip) and writes them to the output file
+  /// of the source. Hart execution overlaps trace formatting and I/O.
+  class AsyncTracer
+  {
+  public:
+
+    /// Produce in the given string the disassembly of the instruction
+    /// of the given record. Called from the background thread.
+    typedef std::function<void(const TraceRecord&, std::string&)> Disassembler;
+
+    /// Constructor. Each source gets a ring of ringSize records. A
+    /// source pushing into a full ring waits for space if block is
+    /// true; otherwise the record is dropped (see droppedCount).
+    AsyncTracer(size_t ringSize, bool block);
+
+    /// Destructor: Stop (see stop).
+    ~AsyncTracer();
+
+    /// Define an output file returning its index. Output is binary
+    /// (see BinaryTraceEncoder) if binary is true and text otherwise.
+    /// Output is gzip compressed if compress is true. Xlen and isa are
+    /// those of the traced harts. File is not closed by this object.
+    /// If chunkSize is not zero, output is compressed in chunks of
+    /// chunkSize instructions and a chunk index is written to the
+    /// given index file (see TraceIndex). Return -1 on failure.
+    int addOutput(FILE* file, bool binary, bool compress, unsigned xlen,
+		  uint64_t isa, uint64_t chunkSize = 0,
+		  const std::string& indexPath = std::string());
+
+    /// Write the data of the given output to its file in batches of
+    /// at least the given number of bytes (default 64K). Pending data
+    /// is also written whenever the rings are empty. Writes to a file
+    /// that blocks (such as a pipe or a socket read by a slow
+    /// consumer) stall the background thread which in turn stalls the
+    /// sources once their rings fill up (or drops records if not
+    /// blocking).
+    void setOutputBatch(unsigned output, size_t bytes)
+    { outputs_.at(output)->batchSize = bytes; }
+
+    /// Define a source writing to the given output and return its
+    /// index. Text records are disassembled with given function.
+    /// Must be called before start.
+    unsigned addSource(unsigned output, unsigned xlen, Disassembler disas);
+
+    /// Start the background thread.
+    void start();
+
+    /// Write all pushed records, stop the background thread and flush
+    /// the output files.
+    void stop();
+
+    /// Push given record into the ring of the given source.
+    void push(unsigned source, const TraceRecord& rec)
+    {
+      Source& src = *sources_[source];
+      if (src.ring.push(rec))
+	return;
+      if (not block_)
+	{
+	  dropped_++;
+	  return;
+	}
+      while (not src.ring.push(rec))
+	std::this_thread::yield();
+    }
+
+    /// Return number of records dropped because of a full ring.
+    uint64_t droppedCount() const
+    { return dropped_; }
+
+  private:
+
+    AsyncTracer(const AsyncTracer&) = delete;
+    void operator= (const AsyncTracer&) = delete;
+
+    /// Background thread: Drain the rings until stopped.
+    void run();
+
+    /// Write the buffered data of given output to its file.
+    void writeOutput(unsigned ix);
+
+    /// Start a new chunk of the given output at a record with the
+    /// given tag.
+    void startChunk(unsigned ix, uint64_t tag);
+
+    struct Output
+    {
+      FILE* file = nullptr;
+      gzFile_s* gz = nullptr;
+      bool binary = false;
+      BinaryTraceEncoder encoder;
+      std::string buffer;
+      size_t batchSize = 64*1024;  // Write threshold of buffer.
+      bool failed = false;         // True after a write error.
+
+      uint64_t chunkSize = 0;     // Zero if not chunked.
+      uint64_t nextChunkTag = 0;  // First tag of next chunk.
+      bool chunked = false;       // True once first chunk is indexed.
+      FILE* index = nullptr;
+    };
+
+    struct Source
+    {
+      Source(size_t ringSize)
+	: ring(ringSize)
+      { }
+
+      TraceRing ring;
+      unsigned output = 0;
+      unsigned xlen = 32;
+      Disassembler disas;
+    };
+
+    std::vector< std::unique_ptr<Output> > outputs_;
+    std::vector< std::unique_ptr<Source> > sources_;
+    size_t ringSize_;
+    bool block_;
+    std::atomic<uint64_t> dropped_ = 0;
+    std::atomic<bool> stop_ = false;
+    std::thread thread_;
+  };
+}
@@ -154,7 +154,7 @@ Triggers<URV>::ldStAddrTriggerHit(URV address, TriggerTiming timing,
 
       trigger.setLocalHit(true);
 
-      if (updateChainHitBit(trigger))
+      if (updateChainHitBit(trigger) and not takeTraceAction(trigger))
 	hit = true;
     }
   return hit;
@@ -177,7 +177,7 @@ Triggers<URV>::ldStDataTriggerHit(URV value, TriggerTiming timing, bool isLoad,
 
       trigger.setLocalHit(true);
 
-      if (updateChainHitBit(trigger))
+      if (updateChainHitBit(trigger) and not takeTraceAction(trigger))
 	hit = true;
     }
 
@@ -201,7 +201,7 @@ Triggers<URV>::instAddrTriggerHit(URV address, TriggerTiming timing,
 
       trigger.setLocalHit(true);
 
-      if (updateChainHitBit(trigger))
+      if (updateChainHitBit(trigger) and not takeTraceAction(trigger))
 	hit = true;
     }
   return hit;
@@ -224,7 +224,7 @@ Triggers<URV>::instOpcodeTriggerHit(URV opcode, TriggerTiming timing,
 
       trigger.setLocalHit(true);
 
-      if (updateChainHitBit(trigger))
+      if (updateChainHitBit(trigger) and not takeTraceAction(trigger))
 	hit = true;
     }
 
@@ -249,14 +249,38 @@ Triggers<URV>::icountTriggerHit(bool interruptEnabled)
       if (not trig.instCountdown())
 	continue;
 
-      hit = true;
       trig.setHit(true);
       trig.setLocalHit(true);
+      if (not takeTraceAction(trig))
+	hit = true;
     }
   return hit;
 }
 
 
+template <typename URV>
+bool
+Triggers<URV>::takeTraceAction(Trigger<URV>& trigger)
+{
+  if (not traceActions_)
+    return false;
+
+  auto action = trigger.getAction();
+  if (action != Trigger<URV>::Action::StartTrace and
+      action != Trigger<URV>::Action::StopTrace)
+    return false;
+
+  traceOn_ = action == Trigger<URV>::Action::StartTrace;
+
+  size_t beginChain = 0, endChain = 0;
+  trigger.getChainBounds(beginChain, endChain);
+  for (size_t i = beginChain; i < endChain; ++i)
+    triggers_.at(i).setChainHit(false);
+
+  return true;
+}
+
+
 template <typename URV>
 bool
 Triggers<URV>::config(unsigned trigger, URV reset1, URV reset2, URV reset3,
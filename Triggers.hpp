@@ -687,6 +687,18 @@ namespace WdRiscv
     /// Reset all triggers.
     void reset();
 
+    /// Enable/disable the start-trace and stop-trace trigger
+    /// actions. When enabled, tracing is initially off and a tripped
+    /// trigger with a start-trace (stop-trace) action turns it on
+    /// (off) instead of causing a breakpoint.
+    void enableTraceActions(bool flag)
+    { traceActions_ = flag; traceOn_ = not flag; }
+
+    /// Return false if tracing was turned off by trace-action
+    /// triggers and true otherwise.
+    bool isTraceOn() const
+    { return traceOn_; }
+
   protected:
 
     /// If all the triggers in the chain of the given trigger have
@@ -698,9 +710,18 @@ namespace WdRiscv
     /// Define the chain bounds of each trigger.
     void defineChainBounds();
 
+    /// If trace actions are enabled and the action of the given
+    /// tripped trigger is start-trace or stop-trace, then turn tracing
+    /// on/off, clear the tripped state of the trigger chain (so that
+    /// no breakpoint is taken), and return true. Otherwise return
+    /// false.
+    bool takeTraceAction(Trigger<URV>& trigger);
+
   private:
 
     std::vector< Trigger<URV> > triggers_;
     bool chainPairs_ = false;
+    bool traceActions_ = false;  // Honor start/stop trace actions.
+    bool traceOn_ = true;        // Trace state set by trace actions.
   };
 }
@@ -0,0 +1,536 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <iostream>
+#include <memory>
+#include <algorithm>
+#include <cstring>
+#include "WhisperApi.h"
+#include "HartConfig.hpp"
+#include "Server.hpp"
+
+
+namespace WdRiscv
+{
+
+  /// Server exposing the change collection used by the step commands.
+  template <typename URV>
+  class ApiServer : public Server<URV>
+  {
+  public:
+
+    ApiServer(std::vector< Hart<URV>* >& harts)
+      : Server<URV>(harts)
+    { }
+
+    using Server<URV>::collectStepChanges;
+  };
+
+
+  /// Memory, harts and scratch buffers of a session of the C API.
+  template <typename URV>
+  class ApiSession
+  {
+  public:
+
+    /// Create hartCount harts sharing a memory sized according to the
+    /// given configuration.
+    ApiSession(unsigned hartCount, const HartConfig& config)
+      : memory(memorySize(config), pageSize(config))
+    {
+      memory.setHartCount(hartCount);
+      for (unsigned i = 0; i < hartCount; ++i)
+	{
+	  autoDeleteHarts.push_back(std::make_unique<Hart<URV>>(i, memory, 32));
+	  harts.push_back(autoDeleteHarts.back().get());
+	}
+      server = std::make_unique<ApiServer<URV>>(harts);
+      changes.reserve(64);
+    }
+
+    /// Configure the harts and the memory. Return true on success and
+    /// false on failure.
+    bool configure(const HartConfig& config)
+    {
+      if (not config.configHarts(harts, false))
+	return false;
+      if (not config.applyMemoryConfig(*harts.at(0), false))
+	return false;
+      for (size_t i = 1; i < harts.size(); ++i)
+	harts.at(i)->copyMemRegionConfig(*harts.at(0));
+
+      // Same as server mode.
+      for (auto hart : harts)
+	{
+	  hart->enableTriggers(true);
+	  hart->enablePerformanceCounters(true);
+	  hart->reset();
+	}
+      return true;
+    }
+
+    /// Append to records the change records of the last instruction
+    /// (opcode inst) executed by the given hart. Return false if they
+    /// do not fit.
+    bool appendInstRecords(Hart<URV>& hart, uint32_t inst,
+			   WhisperChangeRecord* records, size_t capacity,
+			   size_t& count)
+    {
+      server->collectStepChanges(hart, changes);
+      hart.clearTraceData();
+      if (count + 1 + changes.size() > capacity)
+	return false;
+
+      records[count++] = { ChangeCount, inst, hart.lastPc(), changes.size() };
+      for (const auto& msg : changes)
+	records[count++] = { Change, msg.resource, msg.address, msg.value };
+      return true;
+    }
+
+    Memory memory;
+    std::vector< std::unique_ptr<Hart<URV>> > autoDeleteHarts;
+    std::vector< Hart<URV>* > harts;
+    std::unique_ptr< ApiServer<URV> > server;
+    std::vector<WhisperMessage> changes;
+    typename Hart<URV>::RunConditions conditions;
+
+  private:
+
+    static size_t memorySize(const HartConfig& config)
+    {
+      size_t size = size_t(1) << 32;  // 4 gigs
+      if (size == 0)
+	size = size_t(1) << 31;  // 2 gigs
+      config.getMemorySize(size);
+      return size;
+    }
+
+    static size_t pageSize(const HartConfig& config)
+    {
+      size_t size = 4*1024;
+      config.getPageSize(size);
+      return size;
+    }
+  };
+}
+
+
+using namespace WdRiscv;
+
+
+struct WhisperSession
+{
+  unsigned xlen = 32;
+  FILE* traceFile = nullptr;
+  std::unique_ptr< ApiSession<uint32_t> > session32;
+  std::unique_ptr< ApiSession<uint64_t> > session64;
+};
+
+
+/// Invoke the given function on the session of the given handle and
+/// on the hart with the given id. Return 0 if the function returns
+/// true and -1 if it returns false, if the handle/hart-id is not
+/// valid or if an exception is thrown (exceptions must not cross the C
+/// interface).
+template <typename Func>
+static
+int
+dispatch(WhisperSession* handle, unsigned hartId, Func func)
+{
+  if (not handle)
+    return -1;
+
+  try
+    {
+      if (handle->xlen == 32)
+	{
+	  auto& session = *handle->session32;
+	  if (hartId >= session.harts.size())
+	    return -1;
+	  return func(session, *session.harts.at(hartId))? 0 : -1;
+	}
+      auto& session = *handle->session64;
+      if (hartId >= session.harts.size())
+	return -1;
+      return func(session, *session.harts.at(hartId))? 0 : -1;
+    }
+  catch (const std::exception& e)
+    {
+      std::cerr << "Error: " << e.what() << '\n';
+    }
+  catch (...)
+    {
+      std::cerr << "Error: Unexpected exception\n";
+    }
+  return -1;
+}
+
+
+/// Same as above but invoke the function on every hart stopping at
+/// the first failure.
+template <typename Func>
+static
+int
+dispatchAll(WhisperSession* handle, Func func)
+{
+  if (not handle)
+    return -1;
+  size_t count = (handle->xlen == 32? handle->session32->harts.size() :
+		  handle->session64->harts.size());
+  for (unsigned i = 0; i < count; ++i)
+    if (dispatch(handle, i, func) != 0)
+      return -1;
+  return 0;
+}
+
+
+/// Return true if the given hart can be stepped. Complain otherwise.
+template <typename URV>
+static
+bool
+checkSteppable(Hart<URV>& hart)
+{
+  if (not hart.isStarted())
+    {
+      std::cerr << "Error: Step of a non-started hart\n";
+      return false;
+    }
+  if (hart.inDebugMode() and not hart.inDebugStepMode())
+    {
+      std::cerr << "Error: Step while in debug-halt mode\n";
+      return false;
+    }
+  return true;
+}
+
+
+extern "C" {
+
+WhisperSession*
+whisperCreate(unsigned xlen, unsigned hartCount, const char* configFile)
+{
+  if (xlen != 32 and xlen != 64)
+    {
+      std::cerr << "Invalid register width: " << xlen
+		<< " -- expecting 32 or 64\n";
+      return nullptr;
+    }
+  if (hartCount == 0 or hartCount > 64)
+    {
+      std::cerr << "Unreasonable hart count: " << hartCount << '\n';
+      return nullptr;
+    }
+
+  try
+    {
+      HartConfig config;
+      if (configFile and not config.loadConfigFile(configFile))
+	return nullptr;
+
+      auto handle = std::make_unique<WhisperSession>();
+      handle->xlen = xlen;
+
+      bool ok = false;
+      if (xlen == 32)
+	{
+	  handle->session32 = std::make_unique<ApiSession<uint32_t>>(hartCount,
+								     config);
+	  ok = handle->session32->configure(config);
+	}
+      else
+	{
+	  handle->session64 = std::make_unique<ApiSession<uint64_t>>(hartCount,
+								     config);
+	  ok = handle->session64->configure(config);
+	}
+
+      return ok? handle.release() : nullptr;
+    }
+  catch (const std::exception& e)
+    {
+      std::cerr << "Error: " << e.what() << '\n';
+    }
+  catch (...)
+    {
+      std::cerr << "Error: Unexpected exception\n";
+    }
+  return nullptr;
+}
+
+
+void
+whisperDestroy(WhisperSession* handle)
+{
+  if (not handle)
+    return;
+  if (handle->traceFile)
+    fclose(handle->traceFile);
+  delete handle;
+}
+
+
+int
+whisperSetTraceFile(WhisperSession* handle, const char* path)
+{
+  if (not handle)
+    return -1;
+
+  if (handle->traceFile)
+    fclose(handle->traceFile);
+  handle->traceFile = nullptr;
+
+  if (not path)
+    return 0;
+
+  handle->traceFile = fopen(path, "w");
+  if (not handle->traceFile)
+    {
+      std::cerr << "Failed to open trace file '" << path << "' for output\n";
+      return -1;
+    }
+  return 0;
+}
+
+
+int
+whisperLoadElf(WhisperSession* handle, const char* path)
+{
+  std::string file = path? path : "";
+  return dispatchAll(handle, [&file] (auto&, auto& hart) {
+				size_t entryPoint = 0;
+				return hart.loadElfFile(file, entryPoint);
+			      });
+}
+
+
+int
+whisperLoadHex(WhisperSession* handle, const char* path)
+{
+  std::string file = path? path : "";
+  return dispatch(handle, 0, [&file] (auto&, auto& hart) {
+			       return hart.loadHexFile(file);
+			     });
+}
+
+
+int
+whisperSetToHost(WhisperSession* handle, uint64_t address)
+{
+  return dispatchAll(handle, [address] (auto&, auto& hart) {
+				hart.setToHostAddress(address);
+				return true;
+			      });
+}
+
+
+int
+whisperReset(WhisperSession* handle, unsigned hartId)
+{
+  return dispatch(handle, hartId, [] (auto&, auto& hart) {
+				    hart.reset();
+				    return true;
+				  });
+}
+
+
+int
+whisperPeek(WhisperSession* handle, unsigned hartId, char resource,
+	    uint64_t address, uint64_t* value)
+{
+  if (not value)
+    return -1;
+
+  return dispatch(handle, hartId, [=] (auto& session, auto& hart) {
+				    if (resource == 'p')
+				      {
+					*value = hart.peekPc();
+					return true;
+				      }
+				    WhisperMessage req(hartId, Peek, resource,
+						       address);
+				    WhisperMessage reply;
+				    session.server->peekCommand(req, reply);
+				    *value = reply.value;
+				    return reply.type != Invalid;
+				  });
+}
+
+
+int
+whisperPoke(WhisperSession* handle, unsigned hartId, char resource,
+	    uint64_t address, uint64_t value)
+{
+  return dispatch(handle, hartId, [=] (auto& session, auto&) {
+				    WhisperMessage req(hartId, Poke, resource,
+						       address, value);
+				    WhisperMessage reply;
+				    session.server->pokeCommand(req, reply);
+				    return reply.type != Invalid;
+				  });
+}
+
+
+int
+whisperStep(WhisperSession* handle, unsigned hartId,
+	    WhisperChangeRecord* records, size_t capacity,
+	    size_t* recordCount)
+{
+  if (not records or not recordCount)
+    return -1;
+  *recordCount = 0;
+
+  FILE* traceFile = handle? handle->traceFile : nullptr;
+  return dispatch(handle, hartId, [=] (auto& session, auto& hart) {
+				    if (not checkSteppable(hart))
+				      return false;
+				    uint32_t inst = 0;
+				    hart.readInst(hart.peekPc(), inst);
+				    // Same (decode cache) path as whisperStepBatch.
+				    hart.singleStep(traceFile, true);
+				    hart.flushTraceBuffer();
+				    return session.appendInstRecords(hart, inst,
+								     records,
+								     capacity,
+								     *recordCount);
+				  });
+}
+
+
+int
+whisperStepBatch(WhisperSession* handle, unsigned hartId, uint64_t count,
+		 WhisperChangeRecord* records, size_t capacity,
+		 size_t* recordCount, uint64_t* stepped)
+{
+  if (not records or not recordCount or not stepped)
+    return -1;
+  *recordCount = 0;
+  *stepped = 0;
+
+  FILE* traceFile = handle? handle->traceFile : nullptr;
+  return dispatch(handle, hartId, [=] (auto& session, auto& hart) {
+    if (not checkSteppable(hart))
+      return false;
+
+    while (*stepped < count and not hart.hasTargetProgramFinished() and
+	   *recordCount + WHISPER_API_INST_RECORDS <= capacity)
+      {
+	bool wasInDebug = hart.inDebugMode();
+
+	// Get instruction before execution (in case code is self-modifying).
+	uint32_t inst = 0;
+	hart.readInst(hart.peekPc(), inst);
+
+	hart.singleStep(traceFile, true);
+	++*stepped;
+
+	if (not session.appendInstRecords(hart, inst, records, capacity,
+					  *recordCount))
+	  return false;
+
+	// Stop if instruction put hart in debug mode.
+	if (hart.inDebugMode() and not wasInDebug)
+	  break;
+      }
+    hart.flushTraceBuffer();
+    return true;
+  });
+}
+
+
+int
+whisperRunUntil(WhisperSession* handle, unsigned hartId,
+		const WhisperChangeRecord* conditions, size_t conditionCount,
+		uint64_t maxCount, uint64_t* executed, unsigned* reason,
+		WhisperChangeRecord* records, size_t capacity,
+		size_t* recordCount)
+{
+  if (not executed or not reason or not records or not recordCount or
+      (conditionCount and not conditions))
+    return -1;
+  *executed = 0;
+  *recordCount = 0;
+
+  FILE* traceFile = handle? handle->traceFile : nullptr;
+  return dispatch(handle, hartId, [=] (auto& session, auto& hart) {
+    if (not checkSteppable(hart))
+      return false;
+
+    using URV = typename std::remove_reference<decltype(hart.peekPc())>::type;
+    using RunStop = typename Hart<URV>::RunStop;
+
+    auto& conds = session.conditions;
+    conds.reset(maxCount);
+    for (size_t i = 0; i < conditionCount; ++i)
+      {
+	const auto& cond = conditions[i];
+	if (not conds.add(cond.resource, cond.address, cond.value))
+	  return false;
+      }
+    conds.finish();
+
+    auto stop = hart.runUntil(conds, traceFile, *executed);
+    switch (stop)
+      {
+      case RunStop::Count:       *reason = RunStopCount;       break;
+      case RunStop::Pc:          *reason = RunStopPc;          break;
+      case RunStop::MemoryWrite: *reason = RunStopMemoryWrite; break;
+      case RunStop::CsrWrite:    *reason = RunStopCsrWrite;    break;
+      case RunStop::DebugMode:   *reason = RunStopDebugMode;   break;
+      case RunStop::Finished:    *reason = RunStopFinished;    break;
+      }
+
+    if (*executed == 0)
+      return true;
+
+    uint32_t inst = 0;
+    hart.readInst(hart.lastPc(), inst);
+    return session.appendInstRecords(hart, inst, records, capacity,
+				     *recordCount);
+  });
+}
+
+
+int
+whisperDisassemble(WhisperSession* handle, unsigned hartId, uint32_t inst,
+		   char* buffer, size_t size)
+{
+  if (not buffer or size == 0)
+    return -1;
+
+  return dispatch(handle, hartId, [=] (auto&, auto& hart) {
+				    std::string text;
+				    hart.disassembleInst(inst, text);
+				    strncpy(buffer, text.c_str(), size - 1);
+				    buffer[size - 1] = 0;
+				    return true;
+				  });
+}
+
+
+int
+whisperHasFinished(WhisperSession* handle, unsigned hartId)
+{
+  bool finished = false;
+  dispatch(handle, hartId, [&finished] (auto&, auto& hart) {
+			     finished = hart.hasTargetProgramFinished();
+			     return true;
+			   });
+  return finished? 1 : 0;
+}
+
+}
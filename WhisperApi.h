@@ -0,0 +1,125 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+// C interface of the whisper shared library (libwhisper.so, see the
+// GNUmakefile). A test-bench (e.g. a Verilator model or a
+// SystemVerilog DPI-C import) links with the library and drives the
+// simulated harts in-process: Requests are function calls and change
+// records are returned in caller-provided arrays in host byte order
+// (no serialization). The semantics of the step, step-batch and
+// run-until functions are those of the corresponding server requests
+// (see WhisperMessage.h). Functions returning int return 0 on success
+// and -1 on failure unless otherwise noted. A session must be driven
+// from one thread at a time.
+
+#include <stddef.h>
+#include <stdint.h>
+#include "WhisperMessage.h"
+
+
+// Minimum capacity (in records) of the record array passed to
+// whisperStep: Enough for the change records of any instruction.
+#define WHISPER_API_INST_RECORDS 64
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// Opaque simulation session.
+typedef struct WhisperSession WhisperSession;
+
+/// Create a session with the given register width (32 or 64) and
+/// hart count configured using the given JSON configuration file
+/// (null for the default configuration). Return null on failure.
+WhisperSession* whisperCreate(unsigned xlen, unsigned hartCount,
+			      const char* configFile);
+
+/// Destroy given session closing its trace file (if any).
+void whisperDestroy(WhisperSession* session);
+
+/// Trace executed instructions to the given file (null to stop
+/// tracing).
+int whisperSetTraceFile(WhisperSession* session, const char* path);
+
+/// Load the given ELF file into memory setting the pc of each hart to
+/// the file entry point.
+int whisperLoadElf(WhisperSession* session, const char* path);
+
+/// Load the given hex file into memory.
+int whisperLoadHex(WhisperSession* session, const char* path);
+
+/// Stop the target program when a store writes to the given address.
+int whisperSetToHost(WhisperSession* session, uint64_t address);
+
+/// Reset the given hart.
+int whisperReset(WhisperSession* session, unsigned hart);
+
+/// Set value to that of the given resource of the given hart:
+/// resource 'p' (pc), 'r' (integer register), 'f' (floating point
+/// register), 'c' (CSR) or 'm' (memory word of register width).
+int whisperPeek(WhisperSession* session, unsigned hart, char resource,
+		uint64_t address, uint64_t* value);
+
+/// Change the given resource (see whisperPeek) of the given hart.
+int whisperPoke(WhisperSession* session, unsigned hart, char resource,
+		uint64_t address, uint64_t value);
+
+/// Step the given hart once putting in records the change records of
+/// the executed instruction (as in a StepBatch reply) and their
+/// number in recordCount. Capacity (in records) must be at least
+/// WHISPER_API_INST_RECORDS.
+int whisperStep(WhisperSession* session, unsigned hart,
+		struct WhisperChangeRecord* records, size_t capacity,
+		size_t* recordCount);
+
+/// Step the given hart up to count times (as a StepBatch request).
+/// Set stepped to the number of executed instructions. Stepping also
+/// stops early when fewer than WHISPER_API_INST_RECORDS entries of
+/// records remain available.
+int whisperStepBatch(WhisperSession* session, unsigned hart, uint64_t count,
+		     struct WhisperChangeRecord* records, size_t capacity,
+		     size_t* recordCount, uint64_t* stepped);
+
+/// Run the given hart until one of the given conditions is met (as a
+/// RunUntil request with value set to maxCount). Set executed to the
+/// number of executed instructions, reason to the reason for stopping
+/// (see WhisperRunStop) and records to the change records of the last
+/// executed instruction. Capacity must be at least
+/// WHISPER_API_INST_RECORDS.
+int whisperRunUntil(WhisperSession* session, unsigned hart,
+		    const struct WhisperChangeRecord* conditions,
+		    size_t conditionCount, uint64_t maxCount,
+		    uint64_t* executed, unsigned* reason,
+		    struct WhisperChangeRecord* records, size_t capacity,
+		    size_t* recordCount);
+
+/// Put in buffer (truncating to size bytes including the terminating
+/// null) the disassembly of the given instruction.
+int whisperDisassemble(WhisperSession* session, unsigned hart, uint32_t inst,
+		       char* buffer, size_t size);
+
+/// Return 1 if the target program has finished on the given hart and
+/// 0 otherwise.
+int whisperHasFinished(WhisperSession* session, unsigned hart);
+
+#ifdef __cplusplus
+}
+#endif
@@ -21,9 +21,44 @@
 #include <stdint.h>
 
 
+// New message types must be added at the end to keep the numbering
+// of existing types (test-bench file defines.svh) intact.
 enum WhisperMessageType { Peek, Poke, Step, Until, Change, ChangeCount,
 			  Quit, Invalid, Reset, Exception, EnterDebug,
-			  ExitDebug, LoadFinished, CancelDiv, CancelLr };
+			  ExitDebug, LoadFinished, CancelDiv, CancelLr,
+			  StepBatch, DisassembleLast, Rollback, PeekBlock,
+			  PokeBlock, DumpRegs, Checksum, RunUntil };
+
+// Bits of the flags field of a Step or a ChangeCount request. With
+// NoDisassembly set, whisper leaves the buffer field of the reply
+// empty instead of filling it with the disassembly of the executed
+// instruction. The disassembly can later be obtained on demand with a
+// DisassembleLast request: whisper replies with the address (pc),
+// resource (opcode) and annotated disassembly (buffer) of the last
+// instruction stepped by the target hart.
+//
+// With Speculative set in the flags of a StepBatch request, whisper
+// also keeps enough information to undo each stepped instruction: The
+// test-bench may then run whisper ahead of the RTL and consume the
+// returned change records without further round trips. If an
+// asynchronous event (interrupt, exception, NMI) must be injected at
+// an earlier retirement, the test-bench sends a Rollback request with
+// value set to the number of speculative instructions to keep (counted
+// from the oldest): whisper undoes the remaining ones and replies with
+// value set to the number of instructions undone. Any request other
+// than a speculative StepBatch, a Rollback, a DisassembleLast or a
+// read-only request (Peek, PeekBlock, DumpRegs, Checksum) commits the
+// outstanding speculative instructions of the target hart (they can
+// no longer be undone). Entering debug mode also commits. The text
+// trace lines of speculative instructions are written once committed:
+// The lines of undone instructions are dropped. At most
+// WHISPER_SPECULATIVE_MAX instructions of a hart may be outstanding: A
+// speculative StepBatch that would exceed that limit is rejected
+// (reply type Invalid, no instruction stepped); the test-bench must
+// first commit (or roll back) older instructions.
+enum WhisperStepFlags { NoDisassembly = 1, Speculative = 2 };
+
+#define WHISPER_SPECULATIVE_MAX 16384
 
 // Be careful changing this: test-bench file (defines.svh) needs to be
 // updated.
@@ -60,3 +95,110 @@ struct WhisperMessage
   char buffer[128];
   char tag[20];
 };
+
+
+/// Size in bytes of the serialized integer fields (hart through value)
+/// of a WhisperMessage. A message is normally sent as
+/// sizeof(WhisperMessage) bytes. With compact framing (server option
+/// --compactframe) each message is instead preceded by a 4-byte length
+/// in network byte order and that length is either
+/// WHISPER_COMPACT_SIZE (buffer and tag omitted and taken as all zeros)
+/// or sizeof(WhisperMessage) (all fields present). Whisper sends the
+/// short form whenever buffer and tag are all zeros.
+#define WHISPER_COMPACT_SIZE 40
+
+
+/// Binary command log (see --bincommandlog): The file starts with the
+/// 8 bytes of WHISPER_BINARY_LOG_MAGIC followed by the requests
+/// received by whisper in the order in which they were received.
+/// Each request is recorded exactly as sent on the server socket
+/// (sizeof(WhisperMessage) bytes in network byte order) followed by
+/// its variable-length part (if any, see PokeBlock). Commands of an
+/// interactive session are converted to the equivalent requests. The
+/// log is replayed (see --replaybin) without any text parsing.
+#define WHISPER_BINARY_LOG_MAGIC "WhCmdLg1"
+
+
+/// Change record used in the variable-length payload of a StepBatch
+/// reply. A StepBatch request asks whisper to step the target hart
+/// value times. Whisper replies with a StepBatch message where value
+/// is the number of instructions actually stepped (stepping stops
+/// early if the target program finishes or if the hart enters debug
+/// mode) and address is the number of change records following the
+/// reply. Each stepped instruction contributes one ChangeCount record
+/// (address: pc, resource: opcode, value: number of records that
+/// follow for that instruction) followed by that many Change records
+/// (resource: 'r', 'f', 'c' or 'm', address and value as in a reply
+/// to a Change request). Records are sent as 24 bytes each with every
+/// field in network byte order. A request for more than
+/// WHISPER_STEP_BATCH_MAX instructions is rejected (reply type
+/// Invalid, no instruction stepped).
+struct WhisperChangeRecord
+{
+  uint32_t type;
+  uint32_t resource;
+  uint64_t address;
+  uint64_t value;
+};
+
+
+// Bulk commands (one round trip each):
+//
+// PeekBlock: Read value bytes of memory starting at address. Whisper
+// replies with value set to the number of bytes followed by that many
+// bytes (in memory order). The reply type is Invalid (and no bytes
+// follow) if any byte of the range cannot be read or if value exceeds
+// the memory size.
+//
+// PokeBlock: Write value bytes starting at address. The bytes (in
+// memory order) follow the request. Whisper replies with type Invalid
+// if any byte cannot be written or if value exceeds the memory size
+// (the bytes are then consumed and discarded).
+//
+// DumpRegs: Read the pc, the integer registers, the floating point
+// registers (if any) and the implemented CSRs. Whisper replies with
+// value set to the number of records followed by that many
+// WhisperChangeRecord records (type: Peek, resource: 'p', 'r', 'f' or
+// 'c', address: register number, value: register value).
+//
+// Checksum: Compute the CRC-64 (ECMA-182 polynomial, reflected, as in
+// xz) of the resource bytes of memory starting at address. The size
+// being the 32-bit resource field, a range is at most
+// WHISPER_CHECKSUM_MAX bytes: Check a larger memory in several
+// requests. Whisper replies with value set to the checksum and
+// resource set to 1 if that checksum matches the value of the request
+// and 0 otherwise. The reply type is Invalid if the range extends
+// past the end of memory or if any byte of the range cannot be read.
+#define WHISPER_CHECKSUM_MAX 0xffffffff
+
+
+// RunUntil: Run the target hart, without a round trip per
+// instruction, until any of the following: value instructions are
+// executed (no limit if value is zero), the pc reaches a breakpoint,
+// an instruction writes a watched memory range, an instruction writes
+// a watched CSR, the hart enters debug mode or the target program
+// finishes. At least one instruction is executed unless the program
+// has already finished. The conditions follow the request as
+// WhisperChangeRecord records (request resource: number of records,
+// record type: ignored): resource 'p' with address set to a
+// breakpoint pc, resource 'm' with address/value set to the
+// start/size of a watched memory range, resource 'c' with address set
+// to a watched CSR number or to WHISPER_RUN_ANY_CSR. Whisper replies
+// with a RunUntil message where value is the number of executed
+// instructions, resource is the reason for stopping (see
+// WhisperRunStop) and address is the number of change records
+// following the reply: these are the records of the last executed
+// instruction (as in a one-instruction StepBatch reply). At most
+// WHISPER_RUN_MAX_CONDITIONS records are accepted: Whisper replies
+// with type Invalid (the records are consumed and discarded) if there
+// are more.
+enum WhisperRunStop { RunStopCount, RunStopPc, RunStopMemoryWrite,
+		      RunStopCsrWrite, RunStopDebugMode, RunStopFinished };
+
+#define WHISPER_RUN_ANY_CSR 0xffffffff
+#define WHISPER_RUN_MAX_CONDITIONS 4096
+
+// Largest instruction count of a StepBatch request: Bounds the size of
+// the change records of a reply. Use RunUntil to run further without
+// per-instruction records.
+#define WHISPER_STEP_BATCH_MAX 65536
@@ -0,0 +1,316 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+// Shared memory transport for server mode (see --shmserver). Whisper
+// creates a POSIX shared memory object holding a WhisperShmRegion.
+// The region contains two single-producer/single-consumer byte
+// rings: the test-bench writes requests into the request ring and
+// whisper writes replies into the reply ring. The bytes carried by
+// the rings are exactly those that would be sent over the server
+// socket (serialized WhisperMessage objects and any variable-length
+// payloads), so message semantics are identical to the socket
+// transport.
+//
+// A reader/writer spins for a while waiting for data/space, then
+// yields the processor for a while (in case the peer shares the
+// processor) and then sleeps on a futex. While waiting, whisper
+// periodically checks that the test-bench has neither closed the
+// region nor exited (see whisperShmAttach) so that it does not wait
+// forever for a dead peer. This file may be included by C or C++
+// code. Only Linux is supported.
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+
+#define WHISPER_SHM_MAGIC      0x57687368u   // "Whsh"
+#define WHISPER_SHM_VERSION    1u
+#define WHISPER_SHM_RING_SIZE  (64*1024)     // Must be a power of 2.
+#define WHISPER_SHM_SPIN_COUNT  1024        // Spins before yielding.
+#define WHISPER_SHM_YIELD_COUNT 64          // Yields before sleeping.
+#define WHISPER_SHM_WAIT_MS     100         // Peer check period when sleeping.
+
+
+/// One direction of the shared memory transport. Head/tail are
+/// free-running byte counts. Producer and consumer fields are kept
+/// in separate cache lines.
+struct WhisperShmRing
+{
+  // Written by producer.
+  uint64_t head;             // Total bytes written.
+  uint32_t headSeq;          // Futex word: Bumped after each write.
+  uint32_t producerWaiting;  // Non-zero if producer is sleeping on tailSeq.
+  char pad0[48];
+
+  // Written by consumer.
+  uint64_t tail;             // Total bytes consumed.
+  uint32_t tailSeq;          // Futex word: Bumped after each read.
+  uint32_t consumerWaiting;  // Non-zero if consumer is sleeping on headSeq.
+  char pad1[48];
+
+  char data[WHISPER_SHM_RING_SIZE];
+};
+
+
+/// Layout of the shared memory object. The magic field is set last
+/// by whisper once the region is initialized. The test-bench sets
+/// the closed field (and wakes whisper) when it is done: whisper then
+/// treats the transport as closed (same as a closed socket). Whisper
+/// does the same if the process whose id is in the clientPid field
+/// (if non-zero) no longer exists.
+struct WhisperShmRegion
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t ringSize;
+  uint32_t closed;
+  uint32_t clientPid;  // Test-bench process id (see whisperShmAttach).
+  char pad[44];
+
+  struct WhisperShmRing request;  // Test-bench to whisper.
+  struct WhisperShmRing reply;    // Whisper to test-bench.
+};
+
+
+#ifdef __linux__
+
+/// Sleep until the given futex word changes from the given value.
+/// Sleep at most WHISPER_SHM_WAIT_MS milliseconds if timed is non-zero.
+static inline void
+whisperShmFutexWait(uint32_t* addr, uint32_t value, int timed)
+{
+  struct timespec timeout = { 0, WHISPER_SHM_WAIT_MS * 1000000L };
+  syscall(SYS_futex, addr, FUTEX_WAIT, value, timed ? &timeout : NULL,
+	  NULL, 0);
+}
+
+
+static inline void
+whisperShmFutexWake(uint32_t* addr)
+{
+  syscall(SYS_futex, addr, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+
+/// Back off while waiting for the peer: Spin, then yield. Return
+/// non-zero once it is time to sleep on the futex.
+static inline int
+whisperShmBackoff(unsigned* count)
+{
+  unsigned n = (*count)++;
+  if (n < WHISPER_SHM_SPIN_COUNT)
+    {
+#if defined(__x86_64__) || defined(__i386__)
+      __builtin_ia32_pause();
+#endif
+      return 0;
+    }
+  if (n < WHISPER_SHM_SPIN_COUNT + WHISPER_SHM_YIELD_COUNT)
+    {
+      sched_yield();
+      return 0;
+    }
+  return 1;
+}
+
+
+/// Initialize given region (whisper side). Region must be mapped.
+static inline void
+whisperShmInit(struct WhisperShmRegion* region)
+{
+  memset(region, 0, sizeof(*region));
+  region->version = WHISPER_SHM_VERSION;
+  region->ringSize = WHISPER_SHM_RING_SIZE;
+  __atomic_store_n(&region->magic, WHISPER_SHM_MAGIC, __ATOMIC_RELEASE);
+}
+
+
+/// Return non-zero if given region was initialized by whisper
+/// (test-bench side).
+static inline int
+whisperShmIsReady(struct WhisperShmRegion* region)
+{
+  return (__atomic_load_n(&region->magic, __ATOMIC_ACQUIRE) ==
+	  WHISPER_SHM_MAGIC);
+}
+
+
+/// Record the id of the calling process in the given region so that
+/// whisper stops waiting for it if it exits without closing the
+/// region (test-bench side). Call once the region is ready.
+static inline void
+whisperShmAttach(struct WhisperShmRegion* region)
+{
+  __atomic_store_n(&region->clientPid, (uint32_t) getpid(), __ATOMIC_SEQ_CST);
+}
+
+
+/// Return non-zero if the test-bench has closed the given region or
+/// has exited (whisper side). Return zero if region is null.
+static inline int
+whisperShmPeerGone(struct WhisperShmRegion* region)
+{
+  if (! region)
+    return 0;
+  if (__atomic_load_n(&region->closed, __ATOMIC_ACQUIRE))
+    return 1;
+  uint32_t pid = __atomic_load_n(&region->clientPid, __ATOMIC_ACQUIRE);
+  if (pid && kill((pid_t) pid, 0) != 0 && errno == ESRCH)
+    {
+      __atomic_store_n(&region->closed, 1, __ATOMIC_SEQ_CST);
+      return 1;
+    }
+  return 0;
+}
+
+
+/// Mark given region as closed waking up whisper if it is waiting
+/// for a request (test-bench side).
+static inline void
+whisperShmClose(struct WhisperShmRegion* region)
+{
+  __atomic_store_n(&region->closed, 1, __ATOMIC_SEQ_CST);
+  __atomic_fetch_add(&region->request.headSeq, 1, __ATOMIC_SEQ_CST);
+  whisperShmFutexWake(&region->request.headSeq);
+  __atomic_fetch_add(&region->reply.tailSeq, 1, __ATOMIC_SEQ_CST);
+  whisperShmFutexWake(&region->reply.tailSeq);
+}
+
+
+/// Write size bytes from data into the given ring blocking while the
+/// ring is full. Return 0 on success. Return -1 if the peer is gone
+/// (see whisperShmPeerGone) while waiting for space. Pass a null peer
+/// region to wait without checking.
+static inline int
+whisperShmWrite(struct WhisperShmRing* ring, const void* data, size_t size,
+		struct WhisperShmRegion* peer)
+{
+  const char* p = (const char*) data;
+  uint64_t head = ring->head;
+
+  while (size > 0)
+    {
+      uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+      uint64_t space = WHISPER_SHM_RING_SIZE - (head - tail);
+      unsigned spins = 0;
+      while (space == 0)
+	{
+	  if (whisperShmBackoff(&spins))
+	    {
+	      if (whisperShmPeerGone(peer))
+		return -1;
+	      __atomic_store_n(&ring->producerWaiting, 1, __ATOMIC_SEQ_CST);
+	      uint32_t seq = __atomic_load_n(&ring->tailSeq, __ATOMIC_SEQ_CST);
+	      if (__atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) == tail)
+		whisperShmFutexWait(&ring->tailSeq, seq, peer != NULL);
+	      __atomic_store_n(&ring->producerWaiting, 0, __ATOMIC_RELAXED);
+	    }
+	  tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	  space = WHISPER_SHM_RING_SIZE - (head - tail);
+	}
+
+      // Copy up to the end of the ring buffer (no wrap in a chunk).
+      size_t offset = head & (WHISPER_SHM_RING_SIZE - 1);
+      size_t chunk = WHISPER_SHM_RING_SIZE - offset;
+      if (chunk > space)
+	chunk = space;
+      if (chunk > size)
+	chunk = size;
+      memcpy(ring->data + offset, p, chunk);
+      p += chunk;
+      size -= chunk;
+      head += chunk;
+
+      __atomic_store_n(&ring->head, head, __ATOMIC_SEQ_CST);
+      __atomic_fetch_add(&ring->headSeq, 1, __ATOMIC_SEQ_CST);
+      if (__atomic_load_n(&ring->consumerWaiting, __ATOMIC_SEQ_CST))
+	whisperShmFutexWake(&ring->headSeq);
+    }
+
+  return 0;
+}
+
+
+/// Read size bytes from the given ring into data blocking while the
+/// ring is empty. Return 0 on success. Return -1 if the peer is gone
+/// (see whisperShmPeerGone) while waiting for data. Pass a null peer
+/// region to wait without checking.
+static inline int
+whisperShmRead(struct WhisperShmRing* ring, void* data, size_t size,
+	       struct WhisperShmRegion* peer)
+{
+  char* p = (char*) data;
+  uint64_t tail = ring->tail;
+
+  while (size > 0)
+    {
+      uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+      unsigned spins = 0;
+      while (head == tail)
+	{
+	  if (peer && __atomic_load_n(&peer->closed, __ATOMIC_ACQUIRE))
+	    return -1;
+	  if (whisperShmBackoff(&spins))
+	    {
+	      if (whisperShmPeerGone(peer))
+		return -1;
+	      __atomic_store_n(&ring->consumerWaiting, 1, __ATOMIC_SEQ_CST);
+	      uint32_t seq = __atomic_load_n(&ring->headSeq, __ATOMIC_SEQ_CST);
+	      if (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) == tail &&
+		  ! (peer && __atomic_load_n(&peer->closed, __ATOMIC_SEQ_CST)))
+		whisperShmFutexWait(&ring->headSeq, seq, peer != NULL);
+	      __atomic_store_n(&ring->consumerWaiting, 0, __ATOMIC_RELAXED);
+	    }
+	  head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	}
+
+      // Copy up to the end of the ring buffer (no wrap in a chunk).
+      uint64_t avail = head - tail;
+      size_t offset = tail & (WHISPER_SHM_RING_SIZE - 1);
+      size_t chunk = WHISPER_SHM_RING_SIZE - offset;
+      if (chunk > avail)
+	chunk = avail;
+      if (chunk > size)
+	chunk = size;
+      memcpy(p, ring->data + offset, chunk);
+      p += chunk;
+      size -= chunk;
+      tail += chunk;
+
+      __atomic_store_n(&ring->tail, tail, __ATOMIC_SEQ_CST);
+      __atomic_fetch_add(&ring->tailSeq, 1, __ATOMIC_SEQ_CST);
+      if (__atomic_load_n(&ring->producerWaiting, __ATOMIC_SEQ_CST))
+	whisperShmFutexWake(&ring->tailSeq);
+    }
+
+  return 0;
+}
+
+#endif
@@ -0,0 +1,144 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+// In-process stepping benchmark (C test driver of libwhisper.so):
+// Step the benchmark program through the C interface of WhisperApi.h
+// (whisperStep, whisperStepBatch) and through the socket server (Step
+// and Change requests) and report the number of steps per second of
+// each path. The socket path is skipped if no whisper program is
+// given.
+//
+// Usage: api-step [whisper-program [step-count]]
+
+#include "WhisperApi.h"
+#include "whisper-client.h"
+
+
+/// Create a session on the benchmark program (hex file at the given
+/// path). Return null on failure.
+static WhisperSession*
+createSession(const char* hexPath)
+{
+  WhisperSession* session = whisperCreate(32, 1, NULL);
+  if (!session)
+    return NULL;
+  if (whisperLoadHex(session, hexPath) != 0 ||
+      whisperPoke(session, 0, 'p', 0, BENCH_PROGRAM_PC) != 0)
+    {
+      whisperDestroy(session);
+      return NULL;
+    }
+  return session;
+}
+
+
+/// Step hart 0 of the given session count times with whisperStep.
+/// Return the number of steps per second or a negative value on
+/// failure.
+static double
+apiSteps(WhisperSession* session, uint64_t count)
+{
+  struct WhisperChangeRecord records[WHISPER_API_INST_RECORDS];
+  size_t recordCount = 0;
+  double start = benchSeconds();
+  for (uint64_t i = 0; i < count; ++i)
+    if (whisperStep(session, 0, records, WHISPER_API_INST_RECORDS,
+		    &recordCount) != 0)
+      return -1;
+  return count / (benchSeconds() - start);
+}
+
+
+/// Step hart 0 of the given session count times with
+/// whisperStepBatch in batches of up to 1024 instructions. Return the
+/// number of steps per second or a negative value on failure.
+static double
+apiBatchSteps(WhisperSession* session, uint64_t count)
+{
+  enum { Capacity = 1024 * 8 };
+  static struct WhisperChangeRecord records[Capacity];
+  size_t recordCount = 0;
+  double start = benchSeconds();
+  for (uint64_t done = 0; done < count; )
+    {
+      uint64_t batch = count - done < 1024 ? count - done : 1024;
+      uint64_t stepped = 0;
+      if (whisperStepBatch(session, 0, batch, records, Capacity,
+			   &recordCount, &stepped) != 0 || stepped == 0)
+	return -1;
+      done += stepped;
+    }
+  return count / (benchSeconds() - start);
+}
+
+
+int
+main(int argc, char* argv[])
+{
+  if (argc > 3)
+    {
+      fprintf(stderr, "Usage: %s [whisper-program [step-count]]\n", argv[0]);
+      return 1;
+    }
+
+  uint64_t count = argc > 2 ? strtoull(argv[2], NULL, 0) : 200000;
+
+  char hexPath[32];
+  if (benchWriteProgram(hexPath) != 0)
+    return 1;
+
+  WhisperSession* session = createSession(hexPath);
+  if (!session)
+    {
+      fprintf(stderr, "Failed to create whisper session\n");
+      unlink(hexPath);
+      return 1;
+    }
+  double step = apiSteps(session, count);
+  double batch = apiBatchSteps(session, count);
+  whisperDestroy(session);
+
+  double socket = 0;
+  if (argc > 1)
+    {
+      pid_t pid = 0;
+      int soc = benchStartServer(argv[1], hexPath, &pid);
+      if (soc >= 0)
+	{
+	  socket = benchSocketSteps(soc, count, NoDisassembly);
+	  benchStopServer(soc, pid);
+	}
+      else
+	socket = -1;
+    }
+  unlink(hexPath);
+
+  if (step < 0 || batch < 0 || socket < 0)
+    {
+      fprintf(stderr, "Stepping failed\n");
+      return 1;
+    }
+
+  printf("Steps: %llu\n", (unsigned long long) count);
+  printf("Steps/s whisperStep:      %12.0f\n", step);
+  printf("Steps/s whisperStepBatch: %12.0f\n", batch);
+  if (argc > 1)
+    printf("Steps/s socket server:    %12.0f (whisperStep speedup %.1f)\n",
+	   socket, step / socket);
+  return 0;
+}
@@ -0,0 +1,194 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+// Disassembler benchmark: Generate instructions with every encoder of
+// instforms.hpp over a range of operands, disassemble them with the
+// stream interface (disassembleInst into an std::ostream) and with
+// the caller-buffer interface (disassembleInst into a char buffer),
+// check that both produce the same text and report the number of
+// instructions disassembled per second by each.
+//
+// Usage: disas-speed [repeat-count]
+
+#include <iostream>
+#include <sstream>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include "HartConfig.hpp"
+#include "Hart.hpp"
+#include "instforms.hpp"
+
+
+using namespace WdRiscv;
+
+
+typedef bool (*Encoder)(uint32_t, uint32_t, uint32_t, uint32_t&);
+
+
+// Wrap the member encoders of the instruction form unions into
+// Encoder functions.
+#define C0(Form, method) \
+  [](uint32_t, uint32_t, uint32_t, uint32_t& inst) \
+  { Form x(0); bool ok = x.method(); inst = x.code; return ok; }
+
+#define C1(Form, method) \
+  [](uint32_t a, uint32_t, uint32_t, uint32_t& inst) \
+  { Form x(0); bool ok = x.method(a); inst = x.code; return ok; }
+
+#define C2(Form, method) \
+  [](uint32_t a, uint32_t b, uint32_t, uint32_t& inst) \
+  { Form x(0); bool ok = x.method(a, b); inst = x.code; return ok; }
+
+#define C3(Form, method) \
+  [](uint32_t a, uint32_t b, uint32_t c, uint32_t& inst) \
+  { Form x(0); bool ok = x.method(a, b, c); inst = x.code; return ok; }
+
+
+static const Encoder encoders[] = {
+  encodeLui, encodeAuipc, encodeJal, encodeJalr, encodeBeq, encodeBne,
+  encodeBlt, encodeBge, encodeBltu, encodeBgeu, encodeLb, encodeLh,
+  encodeLw, encodeLbu, encodeLhu, encodeSb, encodeSh, encodeSw,
+  encodeAddi, encodeSlti, encodeSltiu, encodeXori, encodeOri, encodeAndi,
+  encodeSlli, encodeSrli, encodeSrai, encodeAdd, encodeSub, encodeSll,
+  encodeSlt, encodeSltu, encodeXor, encodeSrl, encodeSra, encodeOr,
+  encodeAnd, encodeFence, encodeFencei, encodeEcall, encodeEbreak,
+  encodeCsrrw, encodeCsrrs, encodeCsrrc, encodeCsrrsi, encodeCsrrci,
+  encodeLwu, encodeLd, encodeFlw, encodeFld, encodeFsw, encodeFsd,
+  encodeSd, encodeAddiw, encodeSlliw, encodeSrliw, encodeSraiw,
+  encodeAddw, encodeSubw, encodeSllw, encodeSrlw, encodeSraw, encodeMul,
+  encodeMulh, encodeMulhsu, encodeMulhu, encodeDiv, encodeDivu, encodeRem,
+  encodeRemu, encodeMulw, encodeDivw, encodeDivuw, encodeRemw,
+  encodeRemuw, encodeCbeqz, encodeCbnez,
+
+  C3(IFormInst, encodeCsrrwi),
+  C2(CaiFormInst, encodeCsrli), C2(CaiFormInst, encodeCsrai),
+  C2(CaiFormInst, encodeCandi), C2(CaiFormInst, encodeCsub),
+  C2(CaiFormInst, encodeCxor), C2(CaiFormInst, encodeCor),
+  C2(CaiFormInst, encodeCand),
+  C2(CiFormInst, encodeCadd), C2(CiFormInst, encodeCaddi),
+  C1(CiFormInst, encodeCaddi16sp), C2(CiFormInst, encodeClui),
+  C2(CiFormInst, encodeClwsp), C2(CiFormInst, encodeCslli),
+  C0(CiFormInst, encodeCebreak), C1(CiFormInst, encodeCjalr),
+  C1(CiFormInst, encodeCjr),
+  C2(CiwFormInst, encodeCaddi4spn),
+  C1(CjFormInst, encodeCjal), C1(CjFormInst, encodeCj),
+  C2(CswspFormInst, encodeCswsp),
+  C3(CsFormInst, encodeCsw), C3(CsFormInst, encodeCsd)
+};
+
+
+/// Operand values tried for each encoder argument: Register numbers,
+/// small and large (positive and negative) immediates, CSR numbers.
+static const uint32_t operands[] = {
+  0, 1, 2, 8, 10, 15, 31, 4, 16, 64, 0x7ff, 0x300, 0x7a1, 0xb00, 0xfff,
+  0x12345, uint32_t(-4), uint32_t(-2048)
+};
+
+
+/// Fill insts with the instructions generated by every encoder over
+/// the operand values (keeping the arguments accepted by the
+/// encoder).
+static
+void
+generateInsts(std::vector<uint32_t>& insts)
+{
+  for (Encoder encoder : encoders)
+    for (uint32_t a : operands)
+      for (uint32_t b : operands)
+	for (uint32_t c : operands)
+	  {
+	    uint32_t inst = 0;
+	    if (encoder(a, b, c, inst))
+	      insts.push_back(inst);
+	  }
+}
+
+
+int
+main(int argc, char* argv[])
+{
+  unsigned repeat = argc > 1 ? strtoul(argv[1], nullptr, 0) : 20;
+  if (repeat == 0)
+    {
+      std::cerr << "Usage: " << argv[0] << " [repeat-count]\n";
+      return 1;
+    }
+
+  Memory memory(size_t(1) << 32, 4*1024);
+  Hart<uint64_t> hart(0, memory, 32);
+  std::vector< Hart<uint64_t>* > harts = { &hart };
+  HartConfig config;
+  if (not config.configHarts(harts, false))
+    return 1;
+  hart.reset();
+
+  std::vector<uint32_t> insts;
+  generateInsts(insts);
+
+  std::vector<DecodedInst> decoded(insts.size());
+  for (size_t i = 0; i < insts.size(); ++i)
+    hart.decode(0x1000, insts[i], decoded[i]);
+
+  // Check that both interfaces produce the same text.
+  int errors = 0;
+  std::ostringstream oss;
+  char buffer[128];
+  for (const auto& di : decoded)
+    {
+      oss.str("");
+      hart.disassembleInst(di, oss);
+      hart.disassembleInst(di, buffer, sizeof(buffer));
+      if (oss.str() != buffer)
+	{
+	  std::cerr << "Error: Disassembly of 0x" << std::hex << di.inst()
+		    << std::dec << " differs: stream: \"" << oss.str()
+		    << "\" buffer: \"" << buffer << "\"\n";
+	  errors++;
+	}
+    }
+
+  // Time the stream interface.
+  size_t length = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned r = 0; r < repeat; ++r)
+    for (const auto& di : decoded)
+      {
+	oss.str("");
+	hart.disassembleInst(di, oss);
+	length += oss.tellp();
+      }
+  std::chrono::duration<double> streamTime = std::chrono::steady_clock::now() - start;
+
+  // Time the buffer interface.
+  start = std::chrono::steady_clock::now();
+  for (unsigned r = 0; r < repeat; ++r)
+    for (const auto& di : decoded)
+      length += hart.disassembleInst(di, buffer, sizeof(buffer));
+  std::chrono::duration<double> bufferTime = std::chrono::steady_clock::now() - start;
+
+  double total = double(decoded.size()) * repeat;
+  std::cout << "Encoders: " << sizeof(encoders)/sizeof(encoders[0])
+	    << "  Instructions: " << decoded.size()
+	    << "  Characters: " << length / (2*repeat) << '\n';
+  std::cout << "Stream inst/s: " << uint64_t(total / streamTime.count())
+	    << "  Buffer inst/s: " << uint64_t(total / bufferTime.count())
+	    << "  Speedup: " << streamTime.count() / bufferTime.count() << '\n';
+
+  return errors ? 1 : 0;
+}
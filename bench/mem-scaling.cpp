@@ -0,0 +1,208 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+// Multi-hart scaling benchmark: Run a store-heavy loop on 1, 2, 4, 8
+// and 16 harts sharing one memory, each hart in its own host thread,
+// and report the aggregate simulation rate. With per-hart memory
+// bookkeeping kept in separate cache lines, the rate should scale
+// nearly linearly with the hart count (up to the host core count).
+//
+// Usage: mem-scaling [iterations [hart-count ...]]
+
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include "HartConfig.hpp"
+#include "Hart.hpp"
+#include "instforms.hpp"
+
+
+using namespace WdRiscv;
+
+
+static const uint32_t codeAddr   = 0x1000;   // Loop (shared by all harts).
+static const uint32_t toHostAddr = 0x2000;   // Store here stops a hart.
+static const uint32_t dataAddr   = 0x100000; // Data page of hart 0.
+static const unsigned instsPerIter = 6;      // Instructions in loop body.
+
+
+/// Write the benchmark loop at codeAddr using the given hart: Four
+/// stores, a decrement of the iteration count in a1 and a branch back,
+/// then a store to the to-host address (in a2) ending the run.
+static
+bool
+writeProgram(Hart<uint32_t>& hart)
+{
+  const unsigned t0 = 5, a0 = 10, a1 = 11, a2 = 12;
+  uint32_t code[7];
+  bool ok = ( encodeSw(a0, t0, 0, code[0]) and
+	      encodeSw(a0, t0, 4, code[1]) and
+	      encodeSw(a0, t0, 8, code[2]) and
+	      encodeSw(a0, t0, 12, code[3]) and
+	      encodeAddi(a1, a1, uint32_t(-1), code[4]) and
+	      encodeBne(a1, 0, uint32_t(-20), code[5]) and
+	      encodeSw(a2, t0, 0, code[6]) );
+  for (unsigned i = 0; ok and i < 7; ++i)
+    ok = hart.pokeMemory(codeAddr + 4*i, code[i]);
+  return ok;
+}
+
+
+/// Discard what is written to the standard error stream (the stop and
+/// rate messages of Hart::run) from construction to destruction so
+/// that it does not interleave with the result table.
+class SilenceStderr
+{
+public:
+
+  SilenceStderr()
+  {
+    fflush(stderr);
+    saved_ = dup(STDERR_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    if (null >= 0)
+      {
+	dup2(null, STDERR_FILENO);
+	close(null);
+      }
+  }
+
+  ~SilenceStderr()
+  {
+    fflush(stderr);
+    if (saved_ >= 0)
+      {
+	dup2(saved_, STDERR_FILENO);
+	close(saved_);
+      }
+  }
+
+private:
+
+  int saved_ = -1;
+};
+
+
+/// Run the loop for the given number of iterations on each of count
+/// harts. Return the elapsed time in seconds or a negative value on
+/// failure.
+static
+double
+runHarts(unsigned count, uint64_t iterations)
+{
+  Memory memory(size_t(1) << 32, 4*1024);
+  memory.setHartCount(count);
+
+  std::vector< std::unique_ptr<Hart<uint32_t>> > autoDeleteHarts;
+  std::vector< Hart<uint32_t>* > harts;
+  for (unsigned i = 0; i < count; ++i)
+    {
+      autoDeleteHarts.push_back(std::make_unique<Hart<uint32_t>>(i, memory, 32));
+      harts.push_back(autoDeleteHarts.back().get());
+    }
+
+  HartConfig config;
+  if (not config.configHarts(harts, false) or
+      not config.applyMemoryConfig(*harts.at(0), false))
+    return -1;
+  for (unsigned i = 1; i < count; ++i)
+    harts.at(i)->copyMemRegionConfig(*harts.at(0));
+
+  if (not writeProgram(*harts.at(0)))
+    return -1;
+
+  for (unsigned i = 0; i < count; ++i)
+    {
+      Hart<uint32_t>& hart = *harts.at(i);
+      hart.reset();
+      hart.setToHostAddress(toHostAddr);
+      hart.pokePc(codeAddr);
+      hart.pokeIntReg(5, 1);                          // t0: Non-zero.
+      hart.pokeIntReg(10, dataAddr + 4096*i);         // a0: Private page.
+      hart.pokeIntReg(11, uint32_t(iterations));      // a1: Loop count.
+      hart.pokeIntReg(12, toHostAddr);                // a2: To-host.
+    }
+
+  std::chrono::duration<double> elapsed;
+
+  {
+    SilenceStderr silence;
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for (auto hart : harts)
+      threads.emplace_back([hart] () { hart->run(nullptr); });
+    for (auto& thread : threads)
+      thread.join();
+
+    elapsed = std::chrono::steady_clock::now() - start;
+  }
+
+  for (auto hart : harts)
+    if (hart->getInstructionCount() < iterations * instsPerIter)
+      {
+	std::cerr << "Hart " << hart->localHartId() << " stopped early\n";
+	return -1;
+      }
+
+  return elapsed.count();
+}
+
+
+int
+main(int argc, char* argv[])
+{
+  uint64_t iterations = 2000000;
+  if (argc > 1)
+    iterations = strtoull(argv[1], nullptr, 0);
+
+  std::vector<unsigned> counts;
+  for (int i = 2; i < argc; ++i)
+    counts.push_back(unsigned(strtoul(argv[i], nullptr, 0)));
+  if (counts.empty())
+    counts = { 1, 2, 4, 8, 16 };
+
+  std::cout << "Host threads: " << std::thread::hardware_concurrency()
+	    << "  Instructions per hart: " << iterations * instsPerIter << '\n';
+  std::cout << "harts   seconds   total-MIPS   per-hart-MIPS   speedup\n";
+
+  double base = 0;
+  for (unsigned count : counts)
+    {
+      double seconds = runHarts(count, iterations);
+      if (seconds < 0)
+	{
+	  std::cerr << "Benchmark failed with " << count << " harts\n";
+	  return 1;
+	}
+      double mips = double(iterations * instsPerIter) * count / seconds / 1e6;
+      if (base == 0)
+	base = mips / count;
+      char line[128];
+      snprintf(line, sizeof(line), "%5u %9.3f %12.1f %15.1f %9.2f\n", count,
+	       seconds, mips, mips / count, mips / base);
+      std::cout << line;
+    }
+
+  return 0;
+}
@@ -0,0 +1,65 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+// Server step benchmark: Start a whisper server, step it over a
+// loopback socket (one Step request per instruction followed by a
+// Change request per change record) and report the number of steps
+// per second with and without the disassembly of each instruction in
+// the reply.
+//
+// Usage: server-step whisper-program [step-count]
+
+#include "whisper-client.h"
+
+
+int
+main(int argc, char* argv[])
+{
+  if (argc < 2 || argc > 3)
+    {
+      fprintf(stderr, "Usage: %s whisper-program [step-count]\n", argv[0]);
+      return 1;
+    }
+
+  uint64_t count = argc > 2 ? strtoull(argv[2], NULL, 0) : 200000;
+
+  char hexPath[32];
+  if (benchWriteProgram(hexPath) != 0)
+    return 1;
+
+  pid_t pid = 0;
+  int soc = benchStartServer(argv[1], hexPath, &pid);
+  unlink(hexPath);
+  if (soc < 0)
+    return 1;
+
+  double withText = benchSocketSteps(soc, count, 0);
+  double noText = benchSocketSteps(soc, count, NoDisassembly);
+  benchStopServer(soc, pid);
+
+  if (withText < 0 || noText < 0)
+    {
+      fprintf(stderr, "Unexpected reply from whisper server\n");
+      return 1;
+    }
+
+  printf("Steps: %llu\n", (unsigned long long) count);
+  printf("Steps/s with disassembly:    %12.0f\n", withText);
+  printf("Steps/s without disassembly: %12.0f\n", noText);
+  return 0;
+}
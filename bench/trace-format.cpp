@@ -0,0 +1,290 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+// Trace throughput benchmark: Format a set of pseudo-random trace
+// records (integer, floating point, CSR and memory changes, 32 and 64
+// bit) with appendTraceRecord and with a reference formatter using
+// printf format strings (the formatter appendTraceRecord replaced),
+// check that both produce identical text and report the number of
+// trace lines per second of each.
+//
+// Usage: trace-format [record-count [repeat-count]]
+
+#include <cinttypes>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "Trace.hpp"
+
+
+using namespace WdRiscv;
+
+
+/// Append to the given buffer the text produced by the given printf
+/// format and arguments.
+static
+void
+appendFormat(std::string& buffer, const char* format, ...)
+  __attribute__((format(printf, 2, 3)));
+
+
+static
+void
+appendFormat(std::string& buffer, const char* format, ...)
+{
+  size_t size = buffer.size();
+  size_t room = 256;
+  buffer.resize(size + room);
+
+  va_list ap;
+  va_start(ap, format);
+  int n = vsnprintf(&buffer[size], room, format, ap);
+  va_end(ap);
+
+  if (n < 0)
+    n = 0;
+  else if (size_t(n) >= room)
+    {
+      buffer.resize(size + n + 1);
+      va_start(ap, format);
+      vsnprintf(&buffer[size], n + 1, format, ap);
+      va_end(ap);
+    }
+  buffer.resize(size + n);
+}
+
+
+static
+void
+refLine(std::string& out, const TraceRecord& rec, const char* opcode,
+	char resource, uint64_t addr, uint64_t value, const char* assembly,
+	const char* annotation, unsigned xlen)
+{
+  if (xlen == 64)
+    {
+      appendFormat(out, "#%" PRId64 " %d %016" PRIx64 " %8s %c %016" PRIx64 " %016" PRIx64 "  %s%s",
+		   rec.tag, rec.hartId, rec.pc, opcode, resource, addr, value,
+		   assembly, annotation);
+      return;
+    }
+
+  uint32_t pc = rec.pc, addr32 = addr, value32 = value;
+
+  if (resource == 'r')
+    appendFormat(out, "#%" PRId64 " %d %08x %8s r %02x         %08x  %s%s",
+		 rec.tag, rec.hartId, pc, opcode, addr32, value32, assembly,
+		 annotation);
+  else if (resource == 'c' and (addr32 >> 16) == 0)
+    appendFormat(out, "#%" PRId64 " %d %08x %8s c %04x       %08x  %s%s",
+		 rec.tag, rec.hartId, pc, opcode, addr32, value32, assembly,
+		 annotation);
+  else
+    appendFormat(out, "#%" PRId64 " %d %08x %8s %c %08x   %08x  %s%s",
+		 rec.tag, rec.hartId, pc, opcode, resource, addr32, value32,
+		 assembly, annotation);
+}
+
+
+/// Reference formatter: Same output as appendTraceRecord.
+static
+void
+refTraceRecord(std::string& out, const TraceRecord& rec,
+	       const char* assembly, unsigned xlen)
+{
+  char annotation[64];
+  char* cursor = annotation;
+  *cursor = 0;
+  if (rec.interrupted)
+    cursor += sprintf(cursor, " (interrupted)");
+  if (rec.hasLdSt)
+    sprintf(cursor, " [0x%" PRIx64 "]", rec.ldStAddr);
+
+  char opcode[16];
+  if (rec.instSize == 4)
+    sprintf(opcode, "%08x", rec.inst);
+  else
+    sprintf(opcode, "%04x", rec.inst & 0xffff);
+
+  bool pending = false;
+
+  if (rec.intReg > 0)
+    {
+      refLine(out, rec, opcode, 'r', rec.intReg, rec.intValue, assembly,
+	      annotation, xlen);
+      pending = true;
+    }
+
+  if (rec.fpReg >= 0)
+    {
+      if (pending) out += "  +\n";
+      if (xlen == 64)
+	appendFormat(out, "#%" PRId64 " %d %016" PRIx64 " %8s f %016" PRIx64 " %016" PRIx64 "  %s%s",
+		     rec.tag, rec.hartId, rec.pc, opcode, uint64_t(rec.fpReg),
+		     rec.fpValue, assembly, annotation);
+      else
+	appendFormat(out, "#%" PRId64 " %d %08x %8s f %02x %016" PRIx64 "  %s%s",
+		     rec.tag, rec.hartId, uint32_t(rec.pc), opcode, rec.fpReg,
+		     rec.fpValue, assembly, annotation);
+      pending = true;
+    }
+
+  for (unsigned i = 0; i < rec.csrCount; ++i)
+    {
+      if (pending) out += "  +\n";
+      refLine(out, rec, opcode, 'c', rec.csrs[i][0], rec.csrs[i][1],
+	      assembly, annotation, xlen);
+      pending = true;
+    }
+
+  if (rec.memSize > 0)
+    {
+      if (pending) out += "  +\n";
+      refLine(out, rec, opcode, 'm', rec.memAddr, rec.memValue, assembly,
+	      annotation, xlen);
+      pending = true;
+    }
+
+  if (not pending)
+    refLine(out, rec, opcode, 'r', 0, 0, assembly, annotation, xlen);
+  out += '\n';
+}
+
+
+/// Fill records with pseudo-random records of the given register
+/// width.
+static
+void
+makeRecords(std::vector<TraceRecord>& records, size_t count, unsigned xlen)
+{
+  std::mt19937_64 gen(xlen);
+  uint64_t mask = xlen == 64 ? ~uint64_t(0) : 0xffffffff;
+
+  records.resize(count);
+  for (size_t i = 0; i < count; ++i)
+    {
+      TraceRecord& rec = records[i];
+      uint64_t bits = gen();
+      rec.clearChanges();
+      rec.tag = i + 1;
+      rec.hartId = bits & 1;
+      rec.pc = gen() & mask & ~uint64_t(1);
+      rec.instSize = (bits & 2) ? 2 : 4;
+      rec.inst = uint32_t(gen());
+      rec.interrupted = (bits & 0x3c) == 0;
+      switch ((bits >> 8) & 7)
+	{
+	case 0:  // No change (x0 line).
+	  break;
+	case 1:  // Floating point.
+	  rec.fpReg = (bits >> 16) & 31;
+	  rec.fpValue = gen();
+	  break;
+	case 2:  // CSRs (including trigger components).
+	  rec.addCsr((bits >> 16) & 0xfff, gen() & mask);
+	  rec.addCsr(0x7a1 | (((bits >> 28) & 3) << 16), gen() & mask);
+	  break;
+	case 3:  // Store.
+	  rec.memSize = 4;
+	  rec.memAddr = gen() & mask;
+	  rec.memValue = gen() & mask;
+	  rec.hasLdSt = true;
+	  rec.ldStAddr = rec.memAddr;
+	  break;
+	case 4:  // Load.
+	  rec.intReg = 1 + ((bits >> 16) % 31);
+	  rec.intValue = gen() & mask;
+	  rec.hasLdSt = true;
+	  rec.ldStAddr = gen() & mask;
+	  break;
+	default: // Integer register.
+	  rec.intReg = 1 + ((bits >> 16) % 31);
+	  rec.intValue = gen() & mask;
+	  break;
+	}
+    }
+}
+
+
+/// Format all the records repeat times using the given formatter
+/// keeping the output of the last repetition in out. Return the
+/// elapsed time in seconds.
+template <typename Formatter>
+static
+double
+timeFormatter(Formatter formatter, const std::vector<TraceRecord>& records,
+	      unsigned xlen, unsigned repeat, std::string& out)
+{
+  const char* assembly = "addi     x11, x11, 0x1";
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned r = 0; r < repeat; ++r)
+    {
+      out.clear();
+      for (const auto& rec : records)
+	formatter(out, rec, assembly, xlen);
+    }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+
+int
+main(int argc, char* argv[])
+{
+  size_t count = argc > 1 ? strtoull(argv[1], nullptr, 0) : 100000;
+  unsigned repeat = argc > 2 ? strtoul(argv[2], nullptr, 0) : 20;
+  if (count == 0 or repeat == 0)
+    {
+      std::cerr << "Usage: " << argv[0] << " [record-count [repeat-count]]\n";
+      return 1;
+    }
+
+  int errors = 0;
+  printf("xlen   lines   printf-lines/s   buffer-lines/s   speedup\n");
+  for (unsigned xlen : { 32u, 64u })
+    {
+      std::vector<TraceRecord> records;
+      makeRecords(records, count, xlen);
+
+      std::string refText, text;
+      double refTime = timeFormatter(refTraceRecord, records, xlen, repeat,
+				     refText);
+      double time = timeFormatter(appendTraceRecord, records, xlen, repeat,
+				  text);
+      if (text != refText)
+	{
+	  std::cerr << "Error: xlen=" << xlen << " trace text differs from "
+		    << "the reference formatter\n";
+	  errors++;
+	}
+
+      size_t lines = 0;
+      for (char c : text)
+	lines += c == '\n';
+      double total = double(lines) * repeat;
+      printf("%4u %7zu %16.0f %16.0f %9.2f\n", xlen, lines, total / refTime,
+	     total / time, refTime / time);
+    }
+
+  return errors ? 1 : 0;
+}
@@ -0,0 +1,296 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+// Minimal socket client of the whisper server used by the benchmark
+// programs: Start a whisper server process on a small looping
+// program, connect to it over the loopback interface and exchange
+// messages (see WhisperMessage.h) with it.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "WhisperMessage.h"
+
+
+// Address of the benchmark program.
+#define BENCH_PROGRAM_PC 0x1000
+
+// Benchmark program: An endless loop incrementing a register and
+// storing it to memory.
+//   loop: addi a1, a1, 1
+//         sw   a1, 256(zero)
+//         j    loop
+#define BENCH_PROGRAM_HEX "@1000\n93 85 15 00 23 20 b0 10 6f f0 9f ff\n"
+
+
+/// Return the current time in seconds.
+static inline double
+benchSeconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/// Write the benchmark program (hex format) into a temporary file
+/// putting its path in hexPath (at least 32 bytes). Return 0 on
+/// success and -1 on failure.
+static inline int
+benchWriteProgram(char* hexPath)
+{
+  strcpy(hexPath, "/tmp/whisper-benchXXXXXX");
+  int fd = mkstemp(hexPath);
+  if (fd < 0)
+    {
+      perror("mkstemp");
+      return -1;
+    }
+  size_t len = strlen(BENCH_PROGRAM_HEX);
+  int ok = write(fd, BENCH_PROGRAM_HEX, len) == (ssize_t) len;
+  close(fd);
+  return ok ? 0 : -1;
+}
+
+
+/// Serialize msg into buffer (sizeof(*msg) bytes) in network byte order.
+static inline void
+benchSerialize(const struct WhisperMessage* msg, char* buffer)
+{
+  uint32_t words[10] = { msg->hart, msg->type, msg->resource, msg->flags,
+			 (uint32_t) (msg->rank >> 32), (uint32_t) msg->rank,
+			 (uint32_t) (msg->address >> 32), (uint32_t) msg->address,
+			 (uint32_t) (msg->value >> 32), (uint32_t) msg->value };
+  memset(buffer, 0, sizeof(*msg));
+  for (unsigned i = 0; i < 10; ++i)
+    {
+      uint32_t x = htonl(words[i]);
+      memcpy(buffer + 4*i, &x, sizeof(x));
+    }
+  memcpy(buffer + 40, msg->buffer, sizeof(msg->buffer));
+  memcpy(buffer + 40 + sizeof(msg->buffer), msg->tag, sizeof(msg->tag));
+}
+
+
+/// Inverse of benchSerialize.
+static inline void
+benchDeserialize(const char* buffer, struct WhisperMessage* msg)
+{
+  uint32_t words[10];
+  for (unsigned i = 0; i < 10; ++i)
+    {
+      memcpy(&words[i], buffer + 4*i, sizeof(words[i]));
+      words[i] = ntohl(words[i]);
+    }
+  msg->hart = words[0];
+  msg->type = words[1];
+  msg->resource = words[2];
+  msg->flags = words[3];
+  msg->rank = ((uint64_t) words[4] << 32) | words[5];
+  msg->address = ((uint64_t) words[6] << 32) | words[7];
+  msg->value = ((uint64_t) words[8] << 32) | words[9];
+  memcpy(msg->buffer, buffer + 40, sizeof(msg->buffer));
+  memcpy(msg->tag, buffer + 40 + sizeof(msg->buffer), sizeof(msg->tag));
+}
+
+
+/// Send/receive exactly size bytes. Return 0 on success and -1 on
+/// failure.
+static inline int
+benchSendAll(int soc, const void* data, size_t size)
+{
+  const char* p = (const char*) data;
+  while (size)
+    {
+      ssize_t n = send(soc, p, size, 0);
+      if (n <= 0)
+	return -1;
+      p += n;
+      size -= n;
+    }
+  return 0;
+}
+
+
+static inline int
+benchReceiveAll(int soc, void* data, size_t size)
+{
+  char* p = (char*) data;
+  while (size)
+    {
+      ssize_t n = recv(soc, p, size, 0);
+      if (n <= 0)
+	return -1;
+      p += n;
+      size -= n;
+    }
+  return 0;
+}
+
+
+/// Send the given request and replace it with the reply. Return 0 on
+/// success and -1 on failure.
+static inline int
+benchRequest(int soc, struct WhisperMessage* msg)
+{
+  char buffer[sizeof(struct WhisperMessage)];
+  benchSerialize(msg, buffer);
+  if (benchSendAll(soc, buffer, sizeof(buffer)) != 0 ||
+      benchReceiveAll(soc, buffer, sizeof(buffer)) != 0)
+    return -1;
+  benchDeserialize(buffer, msg);
+  return 0;
+}
+
+
+/// Start a whisper server (program at the given path) on the given
+/// hex file and connect to it. Set pid to the process id of the
+/// server. Return the connected socket or -1 on failure.
+static inline int
+benchStartServer(const char* whisper, const char* hexPath, pid_t* pid)
+{
+  char serverFile[32] = "/tmp/whisper-serverXXXXXX";
+  int fd = mkstemp(serverFile);
+  if (fd < 0)
+    {
+      perror("mkstemp");
+      return -1;
+    }
+  close(fd);
+
+  *pid = fork();
+  if (*pid < 0)
+    {
+      perror("fork");
+      return -1;
+    }
+  if (*pid == 0)
+    {
+      char pc[32];
+      snprintf(pc, sizeof(pc), "0x%x", BENCH_PROGRAM_PC);
+      execl(whisper, whisper, "--hex", hexPath, "--startpc", pc,
+	    "--server", serverFile, (char*) NULL);
+      perror(whisper);
+      _exit(1);
+    }
+
+  // Wait for the server to write its port number.
+  unsigned port = 0;
+  for (unsigned i = 0; i < 1000 && port == 0; ++i)
+    {
+      FILE* file = fopen(serverFile, "r");
+      if (file)
+	{
+	  char host[256];
+	  if (fscanf(file, "%255s %u", host, &port) != 2)
+	    port = 0;
+	  fclose(file);
+	}
+      if (port == 0)
+	{
+	  if (waitpid(*pid, NULL, WNOHANG) != 0)
+	    break;
+	  usleep(10000);
+	}
+    }
+  unlink(serverFile);
+  if (port == 0)
+    {
+      fprintf(stderr, "Failed to start whisper server %s\n", whisper);
+      kill(*pid, SIGTERM);
+      waitpid(*pid, NULL, 0);
+      return -1;
+    }
+
+  int soc = socket(AF_INET, SOCK_STREAM, 0);
+  if (soc < 0)
+    {
+      perror("socket");
+      return -1;
+    }
+  int one = 1;
+  setsockopt(soc, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(soc, (struct sockaddr*) &addr, sizeof(addr)) < 0)
+    {
+      perror("connect");
+      close(soc);
+      return -1;
+    }
+  return soc;
+}
+
+
+/// Send a quit request on the given socket and wait for the server
+/// process to exit.
+static inline void
+benchStopServer(int soc, pid_t pid)
+{
+  struct WhisperMessage msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.type = Quit;
+  char buffer[sizeof(msg)];
+  benchSerialize(&msg, buffer);
+  benchSendAll(soc, buffer, sizeof(buffer));
+  close(soc);
+  waitpid(pid, NULL, 0);
+}
+
+
+/// Step hart 0 of the server count times using one Step request per
+/// instruction followed by a Change request per change record (the
+/// classic test-bench protocol). Return the number of steps per
+/// second or a negative value on failure.
+static inline double
+benchSocketSteps(int soc, uint64_t count, uint32_t flags)
+{
+  struct WhisperMessage msg;
+  double start = benchSeconds();
+  for (uint64_t i = 0; i < count; ++i)
+    {
+      memset(&msg, 0, sizeof(msg));
+      msg.type = Step;
+      msg.flags = flags;
+      if (benchRequest(soc, &msg) != 0 || msg.type != ChangeCount)
+	return -1;
+      for (uint64_t changes = msg.value; changes; --changes)
+	{
+	  memset(&msg, 0, sizeof(msg));
+	  msg.type = Change;
+	  if (benchRequest(soc, &msg) != 0 || msg.type != Change)
+	    return -1;
+	}
+    }
+  return count / (benchSeconds() - start);
+}
@@ -16,9 +16,9 @@
 // this program. If not, see <https://www.gnu.org/licenses/>.
 //
 
-#include <iomanip>
+#include <cstring>
 #include <iostream>
-#include <sstream>
+#include <type_traits>
 #include "Hart.hpp"
 #include "instforms.hpp"
 
@@ -26,8 +26,140 @@
 using namespace WdRiscv;
 
 
+namespace
+{
+
+  /// Integer register operand of a disassembled instruction.
+  struct XReg
+  {
+    unsigned ix;
+  };
+
+
+  /// Floating point register operand of a disassembled instruction.
+  struct FReg
+  {
+    unsigned ix;
+  };
+
+
+  /// Number printed in hexadecimal (without a 0x prefix). Like
+  /// std::hex, a signed number is printed as its unsigned
+  /// counterpart of the same width.
+  struct Hex
+  {
+    template <typename T>
+    explicit Hex(T v)
+      : value(typename std::make_unsigned<T>::type(v))
+    { }
+
+    uint64_t value;
+  };
+
+
+  /// Text left-justified in a field of the given width.
+  struct Field
+  {
+    const char* text;
+    unsigned width;
+  };
+
+
+  /// Disassembly text accumulated in a caller-provided character
+  /// buffer: No heap allocation and no locale. Text that does not fit
+  /// is dropped. The buffer is always null-terminated.
+  class DisasBuffer
+  {
+  public:
+
+    /// Use the given buffer of the given size (at least 1). Register
+    /// operands are printed using ABI names if abiNames is true.
+    DisasBuffer(char* buffer, size_t size, bool abiNames)
+      : cur_(buffer), end_(buffer + size - 1), abiNames_(abiNames)
+    { *cur_ = 0; }
+
+    /// Return the end of the text.
+    const char* end() const
+    { return cur_; }
+
+    DisasBuffer& operator<<(char c)
+    {
+      if (cur_ < end_)
+	{
+	  *cur_++ = c;
+	  *cur_ = 0;
+	}
+      return *this;
+    }
+
+    DisasBuffer& operator<<(const char* text)
+    {
+      while (*text and cur_ < end_)
+	*cur_++ = *text++;
+      *cur_ = 0;
+      return *this;
+    }
+
+    DisasBuffer& operator<<(const std::string& text)
+    { return *this << text.c_str(); }
+
+    DisasBuffer& operator<<(XReg reg)
+    { return *this << IntRegs<uint64_t>::staticRegName(reg.ix, abiNames_); }
+
+    DisasBuffer& operator<<(FReg reg)
+    { return *this << FpRegs<double>::staticRegName(reg.ix, abiNames_); }
+
+    DisasBuffer& operator<<(Field field)
+    {
+      *this << field.text;
+      for (size_t len = strlen(field.text); len < field.width; ++len)
+	*this << ' ';
+      return *this;
+    }
+
+    /// Print the given number in decimal.
+    DisasBuffer& operator<<(uint32_t value)
+    {
+      char digits[12];
+      char* p = digits + sizeof(digits);
+      *--p = 0;
+      do
+	{
+	  *--p = char('0' + value % 10);
+	  value /= 10;
+	}
+      while (value);
+      return *this << p;
+    }
+
+    DisasBuffer& operator<<(Hex hex)
+    {
+      static const char hexDigits[] = "0123456789abcdef";
+      char digits[20];
+      char* p = digits + sizeof(digits);
+      *--p = 0;
+      uint64_t value = hex.value;
+      do
+	{
+	  *--p = hexDigits[value & 0xf];
+	  value >>= 4;
+	}
+      while (value);
+      return *this << p;
+    }
+
+  private:
+
+    char* cur_;
+    char* end_;     // Last character of buffer (reserved for null).
+    bool abiNames_;
+  };
+
+}
+
+
 static
-std::string
+const char*
 roundingModeString(RoundingMode mode)
 {
   switch (mode)
@@ -48,63 +180,59 @@ roundingModeString(RoundingMode mode)
 
 /// Helper to disassemble method. Print on the given stream given
 /// instruction which is of the form: inst rd, rs1, rs2
-template <typename URV>
 static
 void
-printRdRs1Rs2(const Hart<URV>& hart, std::ostream& stream, const char* inst,
+printRdRs1Rs2(DisasBuffer& stream, const char* inst,
 	      const DecodedInst& di)
 {
   unsigned rd = di.op0(), rs1 = di.op1(), rs2 = di.op2();
 
   // Print instruction in a 9 character field.
-  stream << std::left << std::setw(9) << inst;
+  stream << Field{inst, 9};
 
-  stream << hart.intRegName(rd) << ", " << hart.intRegName(rs1) << ", "
-	 << hart.intRegName(rs2);
+  stream << XReg{rd} << ", " << XReg{rs1} << ", "
+	 << XReg{rs2};
 }
 
 
 /// Helper to disassemble method. Print on the given stream given
 /// 2-operand floating point instruction.
-template <typename URV>
 static
 void
-printFp2(const Hart<URV>& hart, std::ostream& stream, const char* inst,
+printFp2(DisasBuffer& stream, const char* inst,
 	 const DecodedInst& di)
 {
-  stream << std::left << std::setw(9) << inst << hart.fpRegName(di.op0())
-	 << ", " << hart.fpRegName(di.op1());
+  stream << Field{inst, 9} << FReg{di.op0()}
+	 << ", " << FReg{di.op1()};
 }
 
 
 /// Helper to disassemble method. Print on the given stream given
 /// 3-operand floating point instruction.
-template <typename URV>
 static
 void
-printFp3(const Hart<URV>& hart, std::ostream& stream, const char* inst,
+printFp3(DisasBuffer& stream, const char* inst,
 	 const DecodedInst& di)
 {
-  stream << std::left << std::setw(9) << inst << hart.fpRegName(di.op0())
-	 << ", " << hart.fpRegName(di.op1())
-	 << ", " << hart.fpRegName(di.op3());
+  stream << Field{inst, 9} << FReg{di.op0()}
+	 << ", " << FReg{di.op1()}
+	 << ", " << FReg{di.op3()};
 }
 
 
 /// Helper to disassemble method. Print on the given stream given
 /// instruction which is of the form: inst rd, rs1
-template <typename URV>
 static
 void
-printRdRs1(const Hart<URV>& hart, std::ostream& stream, const char* inst,
+printRdRs1(DisasBuffer& stream, const char* inst,
 	   const DecodedInst& di)
 {
   unsigned rd = di.op0(), rs1 = di.op1();
 
   // Print instruction in a 9 character field.
-  stream << std::left << std::setw(9) << inst;
+  stream << Field{inst, 9};
 
-  stream << hart.intRegName(rd) << ", " << hart.intRegName(rs1);
+  stream << XReg{rd} << ", " << XReg{rs1};
 }
 
 
@@ -113,14 +241,14 @@ printRdRs1(const Hart<URV>& hart, std::ostream& stream, const char* inst,
 template <typename URV>
 static
 void
-printCsr(Hart<URV>& hart, std::ostream& stream, const char* inst,
+printCsr(Hart<URV>& hart, DisasBuffer& stream, const char* inst,
 	 const DecodedInst& di)
 {
   unsigned rd = di.op0(), csrn = di.op2();
 
-  stream << std::left << std::setw(9) << inst;
+  stream << Field{inst, 9};
 
-  stream << hart.intRegName(rd) << ", ";
+  stream << XReg{rd} << ", ";
 
   auto csr = hart.findCsr(CsrNumber(csrn));
   if (csr)
@@ -129,24 +257,23 @@ printCsr(Hart<URV>& hart, std::ostream& stream, const char* inst,
     stream << "illegal";
 
   if (di.ithOperandType(1) == OperandType::Imm)
-    stream << ", 0x" << std::hex << di.op1() << std::dec;
+    stream << ", 0x" << Hex(di.op1());
   else
-    stream << ", " << hart.intRegName(di.op1());
+    stream << ", " << XReg{di.op1()};
 }
 
 
 /// Helper to disassemble method. Print on the given stream given
 /// instruction which is of the form:  inst reg1, imm(reg2)
-template <typename URV>
 static
 void
-printLdSt(const Hart<URV>& hart, std::ostream& stream, const char* inst,
+printLdSt(DisasBuffer& stream, const char* inst,
 	  const DecodedInst& di)
 {
   unsigned rd = di.op0(), rs1 = di.op1();
   int32_t imm = di.op2As<int32_t>();
 
-  stream << std::left << std::setw(8) << inst << ' ';
+  stream << Field{inst, 8} << ' ';
 
   const char* sign = imm < 0? "-" : "";
   if (imm < 0)
@@ -155,24 +282,23 @@ printLdSt(const Hart<URV>& hart, std::ostream& stream, const char* inst,
   // Keep least sig 12 bits.
   imm = imm & 0xfff;
 
-  stream << hart.intRegName(rd) << ", " << sign << "0x"
-	 << std::hex << imm << "(" << hart.intRegName(rs1) << ")" << std::dec;
+  stream << XReg{rd} << ", " << sign << "0x"
+	 << Hex(imm) << "(" << XReg{rs1} << ")";
 }
 
 
 /// Helper to disassemble method. Print on the given stream given
 /// instruction which is of the form: inst reg1, imm(reg2) where inst
 /// is a floating point ld/st instruction.
-template <typename URV>
 static
 void
-printFpLdSt(const Hart<URV>& hart, std::ostream& stream, const char* inst,
+printFpLdSt(DisasBuffer& stream, const char* inst,
 	    const DecodedInst& di)
 {
   unsigned rd = di.op0(), rs1 = di.op1();
   int32_t imm = di.op2As<int32_t>();
 
-  stream << std::left << std::setw(8) << inst << ' ';
+  stream << Field{inst, 8} << ' ';
 
   const char* sign = imm < 0? "-" : "";
   if (imm < 0)
@@ -181,104 +307,98 @@ printFpLdSt(const Hart<URV>& hart, std::ostream& stream, const char* inst,
   // Keep least sig 12 bits.
   imm = imm & 0xfff;
 
-  stream << hart.fpRegName(rd) << ", " << sign << "0x" << std::hex << imm
-	 << std::dec << "(" << hart.intRegName(rs1) << ")";
+  stream << FReg{rd} << ", " << sign << "0x" << Hex(imm) << "(" << XReg{rs1} << ")";
 }
 
 
 /// Helper to disassemble method. Print on the given stream given
 /// instruction which is of the form: inst reg, reg, imm where inst is
 /// a shift instruction.
-template <typename URV>
 static
 void
-printShiftImm(const Hart<URV>& hart, std::ostream& stream, const char* inst,
+printShiftImm(DisasBuffer& stream, const char* inst,
 	      const DecodedInst& di)
 {
   unsigned rd = di.op0(), rs1 = di.op1();
   int32_t imm = di.op2As<int32_t>();
 
-  stream << std::left << std::setw(8) << inst << ' ';
-  stream << hart.intRegName(rd) << ", " << hart.intRegName(rs1)
-	 << ", 0x" << std::hex << imm << std::dec;
+  stream << Field{inst, 8} << ' ';
+  stream << XReg{rd} << ", " << XReg{rs1}
+	 << ", 0x" << Hex(imm);
 }
 
 
 /// Helper to disassemble method. Print on the given stream given
 /// instruction which is of the form: inst reg, reg, imm where imm is
 /// a 12 bit constant.
-template <typename URV>
 static
 void
-printRegRegImm12(const Hart<URV>& hart, std::ostream& stream, const char* inst,
+printRegRegImm12(DisasBuffer& stream, const char* inst,
 		 const DecodedInst& di)
 {
   unsigned rd = di.op0(), rs1 = di.op1();
   int32_t imm = di.op2As<int32_t>();
 
-  stream << std::left << std::setw(8) << inst << ' ';
+  stream << Field{inst, 8} << ' ';
 
-  stream << hart.intRegName(rd) << ", " << hart.intRegName(rs1) << ", ";
+  stream << XReg{rd} << ", " << XReg{rs1} << ", ";
 
   if (imm < 0)
-    stream << "-0x" << std::hex << ((-imm) & 0xfff) << std::dec;
+    stream << "-0x" << Hex(((-imm) & 0xfff));
   else
-    stream << "0x" << std::hex << (imm & 0xfff) << std::dec;
+    stream << "0x" << Hex((imm & 0xfff));
 }
 
 
 /// Helper to disassemble method. Print on the given stream given
 /// instruction which is of the form: inst reg, reg, uimm where uimm is
 /// a 12 bit constant.
-template <typename URV>
 static
 void
-printRegRegUimm12(const Hart<URV>& hart, std::ostream& stream, const char* inst,
+printRegRegUimm12(DisasBuffer& stream, const char* inst,
 		  const DecodedInst& di)
 {
   uint32_t rd = di.op0(), rs1 = di.op1(), imm = di.op2();
 
-  stream << std::left << std::setw(8) << inst << ' ';
-  stream << hart.intRegName(rd) << ", " << hart.intRegName(rs1) << ", ";
-  stream << "0x" << std::hex << (imm & 0xfff) << std::dec;
+  stream << Field{inst, 8} << ' ';
+  stream << XReg{rd} << ", " << XReg{rs1} << ", ";
+  stream << "0x" << Hex((imm & 0xfff));
 }
 
 
 /// Helper to disassemble method. Print on the given stream given
 /// instruction which is of the form: inst reg, imm where inst is a
 /// compressed instruction.
-template <typename URV>
 static
 void
-printRegImm(const Hart<URV>& hart, std::ostream& stream, const char* inst,
+printRegImm(DisasBuffer& stream, const char* inst,
 	    unsigned rs1, int32_t imm)
 {
   // Print instruction in a 8 character field.
-  stream << std::left << std::setw(8) << inst << ' ';
+  stream << Field{inst, 8} << ' ';
 
-  stream << hart.intRegName(rs1) << ", ";
+  stream << XReg{rs1} << ", ";
 
   if (imm < 0)
-    stream << "-0x" << std::hex << (-imm) << std::dec;
+    stream << "-0x" << Hex((-imm));
   else
-    stream << "0x" << std::hex << imm << std::dec;
+    stream << "0x" << Hex(imm);
 }
 
 
 /// Helper to disassemble method. Print on the given stream given 3
 /// operand branch instruction which is of the form: inst reg, reg,
 /// imm where imm is a 12 bit constant.
-template <typename URV>
 static
 void
-printBranch3(const Hart<URV>& hart, std::ostream& stream, const char* inst,
+printBranch3(DisasBuffer& stream, const char* inst,
 	     const DecodedInst& di)
 {
   unsigned rs1 = di.op0(), rs2 = di.op1();
 
-  stream << std::left << std::setw(8) << inst << ' ';
+  stream << Field{inst, 8} << ' ';
 
-  stream << hart.intRegName(rs1) << ", " << hart.intRegName(rs2) << ", . ";
+  stream << XReg{rs1} << ", " << XReg{rs2} << ", . ";
 
   char sign = '+';
   int32_t imm = di.op2As<int32_t>();
@@ -288,24 +408,23 @@ printBranch3(const Hart<URV>& hart, std::ostream& stream, const char* inst,
       imm = -imm;
     }
       
-  stream << sign << " 0x" << std::hex << imm << std::dec;
+  stream << sign << " 0x" << Hex(imm);
 }
 
 
 /// Helper to disassemble method. Print on the given stream given
 /// 2 operand  branch instruction which is of the form: inst reg, imm.
-template <typename URV>
 static
 void
-printBranch2(const Hart<URV>& hart, std::ostream& stream, const char* inst,
+printBranch2(DisasBuffer& stream, const char* inst,
 	     const DecodedInst& di)
 {
   unsigned rs1 = di.op0();
   int32_t imm = di.op2As<int32_t>();
 
-  stream << std::left << std::setw(8) << inst << ' ';
+  stream << Field{inst, 8} << ' ';
 
-  stream << hart.intRegName(rs1) << ", . ";
+  stream << XReg{rs1} << ", . ";
 
   char sign = '+';
   if (imm < 0)
@@ -313,15 +432,14 @@ printBranch2(const Hart<URV>& hart, std::ostream& stream, const char* inst,
       sign = '-';
       imm = -imm;
     }
-  stream << sign << " 0x" << std::hex << imm << std::dec;
+  stream << sign << " 0x" << Hex(imm);
 }
 
 
 /// Helper to disassemble method.
-template <typename URV>
 static
 void
-printAmo(const Hart<URV>& hart, std::ostream& stream, const char* inst,
+printAmo(DisasBuffer& stream, const char* inst,
 	 const DecodedInst& di)
 {
   unsigned rd = di.op0(), rs1 = di.op1(), rs2 = di.op2();
@@ -335,16 +453,15 @@ printAmo(const Hart<URV>& hart, std::ostream& stream, const char* inst,
   if (rl)
     stream << ".rl";
 
-  stream << ' ' << hart.intRegName(rd) << ", " << hart.intRegName(rs2) << ", ("
-	 << hart.intRegName(rs1) << ")";
+  stream << ' ' << XReg{rd} << ", " << XReg{rs2} << ", ("
+	 << XReg{rs1} << ")";
 }
 
 
 /// Helper to disassemble method.
-template <typename URV>
 static
 void
-printLr(const Hart<URV>& hart, std::ostream& stream, const char* inst,
+printLr(DisasBuffer& stream, const char* inst,
 	const DecodedInst& di)
 {
   unsigned rd = di.op0(), rs1 = di.op1();
@@ -358,15 +475,14 @@ printLr(const Hart<URV>& hart, std::ostream& stream, const char* inst,
   if (rl)
     stream << ".rl";
 
-  stream << ' ' << hart.intRegName(rd) << ", (" << hart.intRegName(rs1) << ")";
+  stream << ' ' << XReg{rd} << ", (" << XReg{rs1} << ")";
 }
 
 
 /// Helper to disassemble method.
-template <typename URV>
 static
 void
-printSc(const Hart<URV>& hart, std::ostream& stream, const char* inst,
+printSc(DisasBuffer& stream, const char* inst,
 	const DecodedInst& di)
 {
   unsigned rd = di.op0(), rs1 = di.op1(), rs2 = di.op2();
@@ -380,57 +496,54 @@ printSc(const Hart<URV>& hart, std::ostream& stream, const char* inst,
   if (rl)
     stream << ".rl";
 
-  stream << ' ' << hart.intRegName(rd) << ", " << hart.intRegName(rs2)
-	 << ", (" << hart.intRegName(rs1) << ")";
+  stream << ' ' << XReg{rd} << ", " << XReg{rs2}
+	 << ", (" << XReg{rs1} << ")";
 }
 
 
 /// Helper to disassemble methods. Print a floating point instruction
 /// with 4 operands and the rounding mode.
-template <typename URV>
 static
 void
-printFp4Rm(const Hart<URV>& hart, std::ostream& stream, const char* inst,
+printFp4Rm(DisasBuffer& stream, const char* inst,
 	   const DecodedInst& di)
 {
   // Print instruction in a 8 character field.
-  stream << std::left << std::setw(8) << inst << ' ';
+  stream << Field{inst, 8} << ' ';
 
-  stream << hart.fpRegName(di.op0()) << ", " << hart.fpRegName(di.op1())
-	 << ", " << hart.fpRegName(di.op2()) << hart.fpRegName(di.op3())
+  stream << FReg{di.op0()} << ", " << FReg{di.op1()}
+	 << ", " << FReg{di.op2()} << FReg{di.op3()}
 	 << ", " << roundingModeString(di.roundingMode());
 }
 
 
 /// Helper to disassemble methods. Print a floating point instruction
 /// with 3 operands and the rounding mode.
-template <typename URV>
 static
 void
-printFp3Rm(const Hart<URV>& hart, std::ostream& stream, const char* inst,
+printFp3Rm(DisasBuffer& stream, const char* inst,
 	   const DecodedInst& di)
 {
   // Print instruction in a 8 character field.
-  stream << std::left << std::setw(8) << inst << ' ';
+  stream << Field{inst, 8} << ' ';
 
-  stream << hart.fpRegName(di.op0()) << ", " << hart.fpRegName(di.op1())
-	 << ", " << hart.fpRegName(di.op2())
+  stream << FReg{di.op0()} << ", " << FReg{di.op1()}
+	 << ", " << FReg{di.op2()}
 	 << ", " << roundingModeString(di.roundingMode());
 }
 
 
 /// Helper to disassemble methods. Print a floating point instruction
 /// with 2 operands and the rounding mode.
-template <typename URV>
 static
 void
-printFp2Rm(const Hart<URV>& hart, std::ostream& stream, const char* inst,
+printFp2Rm(DisasBuffer& stream, const char* inst,
 	   const DecodedInst& di)
 {
   // Print instruction in a 8 character field.
-  stream << std::left << std::setw(8) << inst << ' ';
+  stream << Field{inst, 8} << ' ';
 
-  stream << hart.fpRegName(di.op0()) << ", " << hart.fpRegName(di.op1())
+  stream << FReg{di.op0()} << ", " << FReg{di.op1()}
 	 <<  ", " << roundingModeString(di.roundingMode());
 }
 
@@ -449,11 +562,9 @@ template <typename URV>
 void
 Hart<URV>::disassembleInst(uint32_t inst, std::string& str)
 {
-  str.clear();
-
-  std::ostringstream oss;
-  disassembleInst(inst, oss);
-  str = oss.str();
+  DecodedInst di;
+  decode(pc_, inst, di);
+  disassembleInst(di, str);
 }
 
 
@@ -461,6 +572,18 @@ template <typename URV>
 void
 Hart<URV>::disassembleInst(const DecodedInst& di, std::ostream& out)
 {
+  char buffer[128];
+  disassembleInst(di, buffer, sizeof(buffer));
+  out << buffer;
+}
+
+
+template <typename URV>
+size_t
+Hart<URV>::disassembleInst(const DecodedInst& di, char* buffer, size_t size)
+{
+  DisasBuffer out(buffer, size, abiNames_);
+
   InstId id = di.instEntry()->instId();
   switch(id)
     {
@@ -469,12 +592,12 @@ Hart<URV>::disassembleInst(const DecodedInst& di, std::ostream& out)
       break;
 
     case InstId::lui:
-      printRegImm(*this, out, "lui", di.op0(), di.op1As<int32_t>() >> 12);
+      printRegImm(out, "lui", di.op0(), di.op1As<int32_t>() >> 12);
       break;
 
     case InstId::auipc:
-      out << "auipc    " << intRegName(di.op0())
-	  << ", 0x" << std::hex << ((di.op1() >> 12) & 0xfffff) << std::dec;
+      out << "auipc    " << XReg{di.op0()}
+	  << ", 0x" << Hex(((di.op1() >> 12) & 0xfffff));
       break;
 
     case InstId::jal:
@@ -482,148 +605,148 @@ Hart<URV>::disassembleInst(const DecodedInst& di, std::ostream& out)
 	if (di.op0() == 0)
 	  out << "j        ";
 	else
-	  out << "jal      " << intRegName(di.op0()) << ", ";
+	  out << "jal      " << XReg{di.op0()} << ", ";
 	char sign = '+';
 	int32_t imm = di.op1As<int32_t>();
 	if (imm < 0) { sign = '-'; imm = -imm; }
-	out << ". " << sign << " 0x" << std::hex << (imm & 0xfffff) << std::dec;
+	out << ". " << sign << " 0x" << Hex((imm & 0xfffff));
       }
       break;
 
     case InstId::jalr:
-      printLdSt(*this, out, "jalr", di);
+      printLdSt(out, "jalr", di);
       break;
 
     case InstId::beq:
-      printBranch3(*this, out, "beq",  di);
+      printBranch3(out, "beq",  di);
       break;
 
     case InstId::bne:
-      printBranch3(*this, out, "bne",  di);
+      printBranch3(out, "bne",  di);
       break;
 
     case InstId::blt:
-      printBranch3(*this, out, "blt",  di);
+      printBranch3(out, "blt",  di);
       break;
 
     case InstId::bge:
-      printBranch3(*this, out, "bge",  di);
+      printBranch3(out, "bge",  di);
       break;
 
     case InstId::bltu:
-      printBranch3(*this, out, "bltu",  di);
+      printBranch3(out, "bltu",  di);
       break;
 
     case InstId::bgeu:
-      printBranch3(*this, out, "bgeu",  di);
+      printBranch3(out, "bgeu",  di);
       break;
 
     case InstId::lb:
-      printLdSt(*this, out, "lb",  di);
+      printLdSt(out, "lb",  di);
       break;
 
     case InstId::lh:
-      printLdSt(*this, out, "lh",  di);
+      printLdSt(out, "lh",  di);
       break;
 
     case InstId::lw:
-      printLdSt(*this, out, "lw",  di);
+      printLdSt(out, "lw",  di);
       break;
 
     case InstId::lbu:
-      printLdSt(*this, out, "lbu",  di);
+      printLdSt(out, "lbu",  di);
       break;
 
     case InstId::lhu:
-      printLdSt(*this, out, "lhu",  di);
+      printLdSt(out, "lhu",  di);
       break;
 
     case InstId::sb:
-      printLdSt(*this, out, "sb", di);
+      printLdSt(out, "sb", di);
       break;
 
     case InstId::sh:
-      printLdSt(*this, out, "sh", di);
+      printLdSt(out, "sh", di);
       break;
 
     case InstId::sw:
-      printLdSt(*this, out, "sw", di);
+      printLdSt(out, "sw", di);
       break;
 
     case InstId::addi:
-      printRegRegImm12(*this, out, "addi", di);
+      printRegRegImm12(out, "addi", di);
       break;
 
     case InstId::slti:
-      printRegRegImm12(*this, out, "slti", di);
+      printRegRegImm12(out, "slti", di);
       break;
 
     case InstId::sltiu:
-      printRegRegUimm12(*this, out, "sltiu", di);
+      printRegRegUimm12(out, "sltiu", di);
       break;
 
     case InstId::xori:
-      printRegRegImm12(*this, out, "xori", di);
+      printRegRegImm12(out, "xori", di);
       break;
 
     case InstId::ori:
-      printRegRegImm12(*this, out, "ori", di);
+      printRegRegImm12(out, "ori", di);
       break;
 
     case InstId::andi:
-      printRegRegImm12(*this, out, "andi", di);
+      printRegRegImm12(out, "andi", di);
       break;
 
     case InstId::slli:
-      printShiftImm(*this, out, "slli", di);
+      printShiftImm(out, "slli", di);
       break;
 
     case InstId::srli:
-      printShiftImm(*this, out, "srli", di);
+      printShiftImm(out, "srli", di);
       break;
 
     case InstId::srai:
-      printShiftImm(*this, out, "srai", di);
+      printShiftImm(out, "srai", di);
       break;
 
     case InstId::add:
-      printRdRs1Rs2(*this, out, "add", di);
+      printRdRs1Rs2(out, "add", di);
       break;
 
     case InstId::sub:
-      printRdRs1Rs2(*this, out, "sub", di);
+      printRdRs1Rs2(out, "sub", di);
       break;
 
     case InstId::sll:
-      printRdRs1Rs2(*this, out, "sll", di);
+      printRdRs1Rs2(out, "sll", di);
       break;
 
     case InstId::slt:
-      printRdRs1Rs2(*this, out, "slt", di);
+      printRdRs1Rs2(out, "slt", di);
       break;
 
     case InstId::sltu:
-      printRdRs1Rs2(*this, out, "sltu", di);
+      printRdRs1Rs2(out, "sltu", di);
       break;
 
     case InstId::xor_:
-      printRdRs1Rs2(*this, out, "xor", di);
+      printRdRs1Rs2(out, "xor", di);
       break;
 
     case InstId::srl:
-      printRdRs1Rs2(*this, out, "srl", di);
+      printRdRs1Rs2(out, "srl", di);
       break;
 
     case InstId::sra:
-      printRdRs1Rs2(*this, out, "sra", di);
+      printRdRs1Rs2(out, "sra", di);
       break;
 
     case InstId::or_:
-      printRdRs1Rs2(*this, out, "or", di);
+      printRdRs1Rs2(out, "or", di);
       break;
 
     case InstId::and_:
-      printRdRs1Rs2(*this, out, "and", di);
+      printRdRs1Rs2(out, "and", di);
       break;
 
     case InstId::fence:
@@ -667,475 +790,475 @@ Hart<URV>::disassembleInst(const DecodedInst& di, std::ostream& out)
       break;
 
     case InstId::lwu:
-      printLdSt(*this, out, "lwu", di);
+      printLdSt(out, "lwu", di);
       break;
 
     case InstId::ld:
-      printLdSt(*this, out, "ld", di);
+      printLdSt(out, "ld", di);
       break;
 
     case InstId::sd:
-      printLdSt(*this, out, "sd", di);
+      printLdSt(out, "sd", di);
       break;
 
     case InstId::addiw:
-      printRegRegImm12(*this, out, "addiw", di);
+      printRegRegImm12(out, "addiw", di);
       break;
 
     case InstId::slliw:
-      printShiftImm(*this, out, "slliw", di);
+      printShiftImm(out, "slliw", di);
       break;
 
     case InstId::srliw:
-      printShiftImm(*this, out, "srliw", di);
+      printShiftImm(out, "srliw", di);
       break;
 
     case InstId::sraiw:
-      printShiftImm(*this, out, "sraiw", di);
+      printShiftImm(out, "sraiw", di);
       break;
 
     case InstId::addw:
-      printRdRs1Rs2(*this, out, "addw", di);
+      printRdRs1Rs2(out, "addw", di);
       break;
 
     case InstId::subw:
-      printRdRs1Rs2(*this, out, "subw", di);
+      printRdRs1Rs2(out, "subw", di);
       break;
 
     case InstId::sllw:
-      printRdRs1Rs2(*this, out, "sllw", di);
+      printRdRs1Rs2(out, "sllw", di);
       break;
 
     case InstId::srlw:
-      printRdRs1Rs2(*this, out, "srlw", di);
+      printRdRs1Rs2(out, "srlw", di);
       break;
 
     case InstId::sraw:
-      printRdRs1Rs2(*this, out, "sraw", di);
+      printRdRs1Rs2(out, "sraw", di);
       break;
 
     case InstId::mul:
-      printRdRs1Rs2(*this, out, "mul", di);
+      printRdRs1Rs2(out, "mul", di);
       break;
 
     case InstId::mulh:
-      printRdRs1Rs2(*this, out, "mulh", di);
+      printRdRs1Rs2(out, "mulh", di);
       break;
 
     case InstId::mulhsu:
-      printRdRs1Rs2(*this, out, "mulhsu", di);
+      printRdRs1Rs2(out, "mulhsu", di);
       break;
 
     case InstId::mulhu:
-      printRdRs1Rs2(*this, out, "mulhu", di);
+      printRdRs1Rs2(out, "mulhu", di);
       break;
 
     case InstId::div:
-      printRdRs1Rs2(*this, out, "div", di);
+      printRdRs1Rs2(out, "div", di);
       break;
 
     case InstId::divu:
-      printRdRs1Rs2(*this, out, "divu", di);
+      printRdRs1Rs2(out, "divu", di);
       break;
 
     case InstId::rem:
-      printRdRs1Rs2(*this, out, "rem", di);
+      printRdRs1Rs2(out, "rem", di);
       break;
 
     case InstId::remu:
-      printRdRs1Rs2(*this, out, "remu", di);
+      printRdRs1Rs2(out, "remu", di);
       break;
 
     case InstId::mulw:
-      printRdRs1Rs2(*this, out, "mulw", di);
+      printRdRs1Rs2(out, "mulw", di);
       break;
 
     case InstId::divw:
-      printRdRs1Rs2(*this, out, "divw", di);
+      printRdRs1Rs2(out, "divw", di);
       break;
 
     case InstId::divuw:
-      printRdRs1Rs2(*this, out, "divuw", di);
+      printRdRs1Rs2(out, "divuw", di);
       break;
 
     case InstId::remw:
-      printRdRs1Rs2(*this, out, "remw", di);
+      printRdRs1Rs2(out, "remw", di);
       break;
 
     case InstId::remuw:
-      printRdRs1Rs2(*this, out, "remuw", di);
+      printRdRs1Rs2(out, "remuw", di);
       break;
 
     case InstId::lr_w:
-      printLr(*this, out, "lr.w", di);
+      printLr(out, "lr.w", di);
       break;
 
     case InstId::sc_w:
-      printSc(*this, out, "sc.w", di);
+      printSc(out, "sc.w", di);
       break;
 
     case InstId::amoswap_w:
-      printAmo(*this, out, "amoswap.w", di);
+      printAmo(out, "amoswap.w", di);
       break;
 
     case InstId::amoadd_w:
-      printAmo(*this, out, "amoadd.w", di);
+      printAmo(out, "amoadd.w", di);
       break;
 
     case InstId::amoxor_w:
-      printAmo(*this, out, "amoxor.w", di);
+      printAmo(out, "amoxor.w", di);
       break;
 
     case InstId::amoand_w:
-      printAmo(*this, out, "amoand.w", di);
+      printAmo(out, "amoand.w", di);
       break;
 
     case InstId::amoor_w:
-      printAmo(*this, out, "amoor.w", di);
+      printAmo(out, "amoor.w", di);
       break;
 
     case InstId::amomin_w:
-      printAmo(*this, out, "amomin.w", di);
+      printAmo(out, "amomin.w", di);
       break;
 
     case InstId::amomax_w:
-      printAmo(*this, out, "amomax.w", di);
+      printAmo(out, "amomax.w", di);
       break;
 
     case InstId::amominu_w:
-      printAmo(*this, out, "amominu.w", di);
+      printAmo(out, "amominu.w", di);
       break;
 
     case InstId::amomaxu_w:
-      printAmo(*this, out, "amomaxu.w", di);
+      printAmo(out, "amomaxu.w", di);
       break;
 
     case InstId::lr_d:
-      printLr(*this, out, "lr.d", di);
+      printLr(out, "lr.d", di);
       break;
 
     case InstId::sc_d:
-      printSc(*this, out, "sc.d", di);
+      printSc(out, "sc.d", di);
       break;
 
     case InstId::amoswap_d:
-      printAmo(*this, out, "amoswap.d", di);
+      printAmo(out, "amoswap.d", di);
       break;
 
     case InstId::amoadd_d:
-      printAmo(*this, out, "amoadd.d", di);
+      printAmo(out, "amoadd.d", di);
       break;
 
     case InstId::amoxor_d:
-      printAmo(*this, out, "amoxor.d", di);
+      printAmo(out, "amoxor.d", di);
       break;
 
     case InstId::amoand_d:
-      printAmo(*this, out, "amoand.d", di);
+      printAmo(out, "amoand.d", di);
       break;
 
     case InstId::amoor_d:
-      printAmo(*this, out, "amoor.d", di);
+      printAmo(out, "amoor.d", di);
       break;
 
     case InstId::amomin_d:
-      printAmo(*this, out, "amomin.d", di);
+      printAmo(out, "amomin.d", di);
       break;
 
     case InstId::amomax_d:
-      printAmo(*this, out, "amomax.d", di);
+      printAmo(out, "amomax.d", di);
       break;
 
     case InstId::amominu_d:
-      printAmo(*this, out, "amominu.d", di);
+      printAmo(out, "amominu.d", di);
       break;
 
     case InstId::amomaxu_d:
-      printAmo(*this, out, "amomaxu.d", di);
+      printAmo(out, "amomaxu.d", di);
       break;
 
     case InstId::flw:
-      printFpLdSt(*this, out, "flw", di);
+      printFpLdSt(out, "flw", di);
       break;
 
     case InstId::fsw:
-      printFpLdSt(*this, out, "fsw", di);
+      printFpLdSt(out, "fsw", di);
       break;
 
     case InstId::fmadd_s:
-      printFp4Rm(*this, out, "fmadd.s", di);
+      printFp4Rm(out, "fmadd.s", di);
       break;
 
     case InstId::fmsub_s:
-      printFp4Rm(*this, out, "fmsub.s", di);
+      printFp4Rm(out, "fmsub.s", di);
       break;
 
     case InstId::fnmsub_s:
-      printFp4Rm(*this, out, "fnmsub.s", di);
+      printFp4Rm(out, "fnmsub.s", di);
       break;
 
     case InstId::fnmadd_s:
-      printFp4Rm(*this, out, "fnmadd.s", di);
+      printFp4Rm(out, "fnmadd.s", di);
       break;
 
     case InstId::fadd_s:
-      printFp2Rm(*this, out, "fadd.s", di);
+      printFp2Rm(out, "fadd.s", di);
       break;
 
     case InstId::fsub_s:
-      printFp2Rm(*this, out, "fsub.s", di);
+      printFp2Rm(out, "fsub.s", di);
       break;
 
     case InstId::fmul_s:
-      printFp2Rm(*this, out, "fmul.s", di);
+      printFp2Rm(out, "fmul.s", di);
       break;
 
     case InstId::fdiv_s:
-      printFp2Rm(*this, out, "fdiv.s", di);
+      printFp2Rm(out, "fdiv.s", di);
       break;
 
     case InstId::fsqrt_s:
-      printFp2(*this, out, "fsqrt.s", di);
+      printFp2(out, "fsqrt.s", di);
       break;
 
     case InstId::fsgnj_s:
-      printFp2(*this, out, "fsgnj.s", di);
+      printFp2(out, "fsgnj.s", di);
       break;
 
     case InstId::fsgnjn_s:
-      printFp2(*this, out, "fsgnjn.s", di);
+      printFp2(out, "fsgnjn.s", di);
       break;
 
     case InstId::fsgnjx_s:
-      printFp2(*this, out, "fsgnjx.s", di);
+      printFp2(out, "fsgnjx.s", di);
       break;
 
     case InstId::fmin_s:
-      printFp3(*this, out, "fmin.s", di);
+      printFp3(out, "fmin.s", di);
       break;
 
     case InstId::fmax_s:
-      printFp3(*this, out, "fmax.s", di);
+      printFp3(out, "fmax.s", di);
       break;
 
     case InstId::fcvt_w_s:
-      out << "fcvt.w.s "  << intRegName(di.op0()) << ", "
-	  << fpRegName(di.op1()) << ", "
+      out << "fcvt.w.s "  << XReg{di.op0()} << ", "
+	  << FReg{di.op1()} << ", "
 	  << roundingModeString(di.roundingMode());
       break;
 
     case InstId::fcvt_wu_s:
-      out << "fcvt.wu.s " << intRegName(di.op0()) << ", "
-	  << fpRegName(di.op1()) << ", "
+      out << "fcvt.wu.s " << XReg{di.op0()} << ", "
+	  << FReg{di.op1()} << ", "
 	  << roundingModeString(di.roundingMode());
       break;
 
     case InstId::fmv_x_w:
-      out << "fmv.x.w  " << intRegName(di.op0()) << ", " << fpRegName(di.op1());
+      out << "fmv.x.w  " << XReg{di.op0()} << ", " << FReg{di.op1()};
       break;
 
     case InstId::feq_s:
-      out << "feq.s    " << intRegName(di.op0()) << ", " << fpRegName(di.op1())
-	  << ", " << fpRegName(di.op2());
+      out << "feq.s    " << XReg{di.op0()} << ", " << FReg{di.op1()}
+	  << ", " << FReg{di.op2()};
       break;
 
     case InstId::flt_s:
-      out << "flt.s    " << intRegName(di.op0()) << ", " << fpRegName(di.op1())
-	  << ", " << fpRegName(di.op2());
+      out << "flt.s    " << XReg{di.op0()} << ", " << FReg{di.op1()}
+	  << ", " << FReg{di.op2()};
       break;
 
     case InstId::fle_s:
-      out << "fle.s    " << intRegName(di.op0()) << ", " << fpRegName(di.op1())
-	  << ", " << fpRegName(di.op2());
+      out << "fle.s    " << XReg{di.op0()} << ", " << FReg{di.op1()}
+	  << ", " << FReg{di.op2()};
       break;
 
     case InstId::fclass_s:
-      out << "fclass.s " << intRegName(di.op0()) << ", " << fpRegName(di.op1());
+      out << "fclass.s " << XReg{di.op0()} << ", " << FReg{di.op1()};
       break;
 
     case InstId::fcvt_s_w:
-      out << "fcvt.s.w " << ", " << fpRegName(di.op0()) << ", "
-	  << intRegName(di.op1()) << ", "
+      out << "fcvt.s.w " << ", " << FReg{di.op0()} << ", "
+	  << XReg{di.op1()} << ", "
 	  << roundingModeString(di.roundingMode());
       break;
 
     case InstId::fcvt_s_wu:
-      out << "fcvt.s.wu " << fpRegName(di.op0()) << ", "
-	  << intRegName(di.op1()) << ", "
+      out << "fcvt.s.wu " << FReg{di.op0()} << ", "
+	  << XReg{di.op1()} << ", "
 	  << roundingModeString(di.roundingMode());
       break;
 
     case InstId::fmv_w_x:
-      out << "fmv.w.x  "<< ", " << fpRegName(di.op0())
-	  << ", " << intRegName(di.op1());
+      out << "fmv.w.x  "<< ", " << FReg{di.op0()}
+	  << ", " << XReg{di.op1()};
       break;
 
     case InstId::fcvt_l_s:
-      out << "fcvt.l.s "  << intRegName(di.op0()) << ", "
-	  << fpRegName(di.op1()) << ", "
+      out << "fcvt.l.s "  << XReg{di.op0()} << ", "
+	  << FReg{di.op1()} << ", "
 	  << roundingModeString(di.roundingMode());
       break;
 
     case InstId::fcvt_lu_s:
-      out << "fcvt.lu.s "  << intRegName(di.op0()) << ", "
-	  << fpRegName(di.op1()) << ", "
+      out << "fcvt.lu.s "  << XReg{di.op0()} << ", "
+	  << FReg{di.op1()} << ", "
 	  << roundingModeString(di.roundingMode());
       break;
 
     case InstId::fcvt_s_l:
-      out << "fcvt.s.l " << ", " << fpRegName(di.op0()) << ", "
-	  << intRegName(di.op1()) << ", "
+      out << "fcvt.s.l " << ", " << FReg{di.op0()} << ", "
+	  << XReg{di.op1()} << ", "
 	  << roundingModeString(di.roundingMode());
       break;
 
     case InstId::fcvt_s_lu:
-      out << "fcvt.s.lu " << fpRegName(di.op0()) << ", "
-	  << intRegName(di.op1()) << ", "
+      out << "fcvt.s.lu " << FReg{di.op0()} << ", "
+	  << XReg{di.op1()} << ", "
 	  << roundingModeString(di.roundingMode());
       break;
 
     case InstId::fld:
-      printFpLdSt(*this, out, "fld", di);
+      printFpLdSt(out, "fld", di);
       break;
 
     case InstId::fsd:
-      printFpLdSt(*this, out, "fsd", di);
+      printFpLdSt(out, "fsd", di);
       break;
 
     case InstId::fmadd_d:
-      printFp4Rm(*this, out, "fmadd.d", di);
+      printFp4Rm(out, "fmadd.d", di);
       break;
 
     case InstId::fmsub_d:
-      printFp4Rm(*this, out, "fmsub.d", di);
+      printFp4Rm(out, "fmsub.d", di);
       break;
 
     case InstId::fnmsub_d:
-      printFp4Rm(*this, out, "fnmsub.d", di);
+      printFp4Rm(out, "fnmsub.d", di);
       break;
 
     case InstId::fnmadd_d:
-      printFp4Rm(*this, out, "fnmadd.d", di);
+      printFp4Rm(out, "fnmadd.d", di);
       break;
 
     case InstId::fadd_d:
-      printFp3Rm(*this, out, "fadd.d", di);
+      printFp3Rm(out, "fadd.d", di);
       break;
 
     case InstId::fsub_d:
-      printFp3Rm(*this, out, "fsub.d", di);
+      printFp3Rm(out, "fsub.d", di);
       break;
 
     case InstId::fmul_d:
-      printFp3Rm(*this, out, "fmul.d", di);
+      printFp3Rm(out, "fmul.d", di);
       break;
 
     case InstId::fdiv_d:
-      printFp3Rm(*this, out, "fdiv.d", di);
+      printFp3Rm(out, "fdiv.d", di);
       break;
 
     case InstId::fsqrt_d:
-      printFp2Rm(*this, out, "fsqrt.d", di);
+      printFp2Rm(out, "fsqrt.d", di);
       break;
 
     case InstId::fsgnj_d:
-      printFp2(*this, out, "fsgnj.d", di);
+      printFp2(out, "fsgnj.d", di);
       break;
 
     case InstId::fsgnjn_d:
-      printFp2(*this, out, "fsgnjn.d", di);
+      printFp2(out, "fsgnjn.d", di);
       break;
 
     case InstId::fsgnjx_d:
-      printFp2(*this, out, "fsgnjx.d", di);
+      printFp2(out, "fsgnjx.d", di);
       break;
 
     case InstId::fmin_d:
-      printFp3(*this, out, "fmin.d", di);
+      printFp3(out, "fmin.d", di);
       break;
 
     case InstId::fmax_d:
-      printFp3(*this, out, "fmax.d", di);
+      printFp3(out, "fmax.d", di);
       break;
 
     case InstId::fcvt_s_d:
-      out << "fcvt.s.d "  << fpRegName(di.op0()) << ", "
-	  << fpRegName(di.op1()) << ", "
+      out << "fcvt.s.d "  << FReg{di.op0()} << ", "
+	  << FReg{di.op1()} << ", "
 	  << roundingModeString(di.roundingMode());
       break;
 
     case InstId::fcvt_d_s:
-      out << "fcvt.d.s "  << fpRegName(di.op0()) << ", "
-	  << fpRegName(di.op1()) << ", "
+      out << "fcvt.d.s "  << FReg{di.op0()} << ", "
+	  << FReg{di.op1()} << ", "
 	  << roundingModeString(di.roundingMode());
       break;
 
     case InstId::feq_d:
-      out << "feq.d    " << intRegName(di.op0()) << ", " << fpRegName(di.op1())
-	  << ", " << fpRegName(di.op2());
+      out << "feq.d    " << XReg{di.op0()} << ", " << FReg{di.op1()}
+	  << ", " << FReg{di.op2()};
       break;
 
     case InstId::flt_d:
-      out << "flt.d    " << intRegName(di.op0()) << ", " << fpRegName(di.op1())
-	  << ", " << fpRegName(di.op2());
+      out << "flt.d    " << XReg{di.op0()} << ", " << FReg{di.op1()}
+	  << ", " << FReg{di.op2()};
       break;
 
     case InstId::fle_d:
-      out << "fle.d    " << intRegName(di.op0()) << ", " << fpRegName(di.op1())
-	  << ", " << fpRegName(di.op2());
+      out << "fle.d    " << XReg{di.op0()} << ", " << FReg{di.op1()}
+	  << ", " << FReg{di.op2()};
       break;
 
     case InstId::fclass_d:
-      out << "fclass.d " << intRegName(di.op0()) << ", " << fpRegName(di.op1());
+      out << "fclass.d " << XReg{di.op0()} << ", " << FReg{di.op1()};
       break;
 
     case InstId::fcvt_w_d:
-      out << "fcvt.w.d "  << intRegName(di.op0()) << ", "
-	  << fpRegName(di.op1()) << ", "
+      out << "fcvt.w.d "  << XReg{di.op0()} << ", "
+	  << FReg{di.op1()} << ", "
 	  << roundingModeString(di.roundingMode());
       break;
 
     case InstId::fcvt_wu_d:
-      out << "fcvt.wu.d "  << intRegName(di.op0()) << ", "
-	  << fpRegName(di.op1()) << ", "
+      out << "fcvt.wu.d "  << XReg{di.op0()} << ", "
+	  << FReg{di.op1()} << ", "
 	  << roundingModeString(di.roundingMode());
       break;
 
     case InstId::fcvt_d_w:
-      out << "fcvt.d.w " << fpRegName(di.op0()) << ", " << intRegName(di.op1())
+      out << "fcvt.d.w " << FReg{di.op0()} << ", " << XReg{di.op1()}
 	  << roundingModeString(di.roundingMode());
       break;
 
     case InstId::fcvt_d_wu:
-      out << "fcvt.d.wu " << fpRegName(di.op0()) << ", " << intRegName(di.op1())
+      out << "fcvt.d.wu " << FReg{di.op0()} << ", " << XReg{di.op1()}
 	  << roundingModeString(di.roundingMode());
       break;
 
     case InstId::fcvt_l_d:
-      out << "fcvt.l.d "  << intRegName(di.op0()) << ", "
-	  << fpRegName(di.op1()) << ", "
+      out << "fcvt.l.d "  << XReg{di.op0()} << ", "
+	  << FReg{di.op1()} << ", "
 	  << roundingModeString(di.roundingMode());
       break;
 
     case InstId::fcvt_lu_d:
-      out << "fcvt.lu.s "  << intRegName(di.op0()) << ", "
-	  << fpRegName(di.op1()) << ", "
+      out << "fcvt.lu.s "  << XReg{di.op0()} << ", "
+	  << FReg{di.op1()} << ", "
 	  << roundingModeString(di.roundingMode());
       break;
 
     case InstId::fmv_x_d:
-      out << "fmv.x.d "  << intRegName(di.op0()) << ", "
-	  << fpRegName(di.op1());
+      out << "fmv.x.d "  << XReg{di.op0()} << ", "
+	  << FReg{di.op1()};
       break;
 
     case InstId::fcvt_d_l:
-      out << "fcvt.d.l " << fpRegName(di.op0()) << ", "
-	  << intRegName(di.op1());
+      out << "fcvt.d.l " << FReg{di.op0()} << ", "
+	  << XReg{di.op1()};
       break;
 
     case InstId::fcvt_d_lu:
-      out << "fcvt.d.lu " << fpRegName(di.op0()) << ", "
-	  << intRegName(di.op1());
+      out << "fcvt.d.lu " << FReg{di.op0()} << ", "
+	  << XReg{di.op1()};
       break;
 
     case InstId::fmv_d_x:
@@ -1157,11 +1280,11 @@ Hart<URV>::disassembleInst(const DecodedInst& di, std::ostream& out)
       break;
 
     case InstId::c_addi4spn:
-      printRegImm(*this, out, "c.addi4spn", di.op0(), di.op2As<int32_t>() >> 2);
+      printRegImm(out, "c.addi4spn", di.op0(), di.op2As<int32_t>() >> 2);
       break;
 
     case InstId::c_fld:
-      printFpLdSt(*this, out, "fld", di);
+      printFpLdSt(out, "fld", di);
       break;
 
     case InstId::c_lq:
@@ -1169,19 +1292,19 @@ Hart<URV>::disassembleInst(const DecodedInst& di, std::ostream& out)
       break;
 
     case InstId::c_lw:
-      printLdSt(*this, out, "c.lw", di);
+      printLdSt(out, "c.lw", di);
       break;
 
     case InstId::c_flw:
-      printFpLdSt(*this, out, "c.flw", di);
+      printFpLdSt(out, "c.flw", di);
       break;
 
     case InstId::c_ld:
-      printLdSt(*this, out, "c.ld", di);
+      printLdSt(out, "c.ld", di);
       break;
 
     case InstId::c_fsd:
-      printFpLdSt(*this, out, "c.fsd", di);
+      printFpLdSt(out, "c.fsd", di);
       break;
 
     case InstId::c_sq:
@@ -1189,22 +1312,22 @@ Hart<URV>::disassembleInst(const DecodedInst& di, std::ostream& out)
       break;
 
     case InstId::c_sw:
-      printLdSt(*this, out, "c.sw", di);
+      printLdSt(out, "c.sw", di);
       break;
 
     case InstId::c_fsw:
-      printFpLdSt(*this, out, "c.fsw", di);
+      printFpLdSt(out, "c.fsw", di);
       break;
 
     case InstId::c_sd:
-      printFpLdSt(*this, out, "c.sd", di);
+      printFpLdSt(out, "c.sd", di);
       break;
 
     case InstId::c_addi:
       if (di.op0() == 0)
 	out << "c.nop";
       else
-	printRegImm(*this, out, "c.addi", di.op0(), di.op2As<int32_t>());
+	printRegImm(out, "c.addi", di.op0(), di.op2As<int32_t>());
       break;
 
     case InstId::c_jal:
@@ -1213,12 +1336,12 @@ Hart<URV>::disassembleInst(const DecodedInst& di, std::ostream& out)
 	int32_t imm = di.op1As<int32_t>();
 	char sign = '+';
 	if (imm < 0) { sign = '-'; imm = -imm; }
-	out << sign << " 0x" << std::hex << imm << std::dec;
+	out << sign << " 0x" << Hex(imm);
       }
       break;
 
     case InstId::c_li:
-      printRegImm(*this, out, "c.li", di.op0(), di.op2As<int32_t>());
+      printRegImm(out, "c.li", di.op0(), di.op2As<int32_t>());
       break;
 
     case InstId::c_addi16sp:
@@ -1226,56 +1349,56 @@ Hart<URV>::disassembleInst(const DecodedInst& di, std::ostream& out)
 	int32_t imm = di.op2As<int32_t>();
 	out << "c.addi16sp ";
 	if (imm < 0) { out << "-"; imm = -imm; }
-	out << "0x" << std::hex << (imm >> 4) << std::dec;
+	out << "0x" << Hex((imm >> 4));
       }
       break;
 
     case InstId::c_lui:
-      printRegImm(*this, out, "c.lui", di.op0(), di.op1() >> 12);
+      printRegImm(out, "c.lui", di.op0(), di.op1() >> 12);
       break;
 
     case InstId::c_srli:
-      printRegImm(*this, out, "c.srli", di.op0(), di.op2As<int32_t>());
+      printRegImm(out, "c.srli", di.op0(), di.op2As<int32_t>());
       break;
 
     case InstId::c_srli64:
-      printRegImm(*this, out, "c.srli64", di.op0(), di.op2As<int32_t>());
+      printRegImm(out, "c.srli64", di.op0(), di.op2As<int32_t>());
       break;
 
     case InstId::c_srai:
-      printRegImm(*this, out, "c.srai", di.op0(), di.op2As<int32_t>());
+      printRegImm(out, "c.srai", di.op0(), di.op2As<int32_t>());
       break;
 
     case InstId::c_srai64:
-      printRegImm(*this, out, "c.srai64", di.op0(), di.op2As<int32_t>());
+      printRegImm(out, "c.srai64", di.op0(), di.op2As<int32_t>());
       break;
 
     case InstId::c_andi:
-      printRegImm(*this, out, "c.andi", di.op0(), di.op2As<int32_t>());
+      printRegImm(out, "c.andi", di.op0(), di.op2As<int32_t>());
       break;
 
     case InstId::c_sub:
-      out << "c.sub    " << intRegName(di.op0()) << ", " << intRegName(di.op2());
+      out << "c.sub    " << XReg{di.op0()} << ", " << XReg{di.op2()};
       break;
 
     case InstId::c_xor:
-      out << "c.xor    " << intRegName(di.op0()) << ", " << intRegName(di.op2());
+      out << "c.xor    " << XReg{di.op0()} << ", " << XReg{di.op2()};
       break;
 
     case InstId::c_or:
-      out << "c.or     " << intRegName(di.op0()) << ", " << intRegName(di.op2());
+      out << "c.or     " << XReg{di.op0()} << ", " << XReg{di.op2()};
       break;
 
     case InstId::c_and:
-      out << "c.and    " << intRegName(di.op0()) << ", " << intRegName(di.op2());
+      out << "c.and    " << XReg{di.op0()} << ", " << XReg{di.op2()};
       break;
 
     case InstId::c_subw:
-      out << "c.subw   " << intRegName(di.op0()) << ", " << intRegName(di.op2());
+      out << "c.subw   " << XReg{di.op0()} << ", " << XReg{di.op2()};
       break;
 
     case InstId::c_addw:
-      out << "c.addw   " << intRegName(di.op0()) << ", " << intRegName(di.op2());
+      out << "c.addw   " << XReg{di.op0()} << ", " << XReg{di.op2()};
       break;
 
     case InstId::c_j:
@@ -1284,52 +1407,48 @@ Hart<URV>::disassembleInst(const DecodedInst& di, std::ostream& out)
 	int32_t imm = di.op1As<int32_t>();
 	char sign = '+';
 	if (imm < 0) { sign = '-'; imm = -imm; }
-	out << sign << " 0x" << std::hex << imm << std::dec;
+	out << sign << " 0x" << Hex(imm);
       }
       break;
 
     case InstId::c_beqz:
-      printBranch2(*this, out, "c.beqz", di);
+      printBranch2(out, "c.beqz", di);
       break;
 
     case InstId::c_bnez:
-      printBranch2(*this, out, "c.bnez", di);
+      printBranch2(out, "c.bnez", di);
       break;
 
     case InstId::c_slli:
-      out << "c.slli   " << intRegName(di.op0()) << ", " << di.op2();
+      out << "c.slli   " << XReg{di.op0()} << ", " << di.op2();
       break;
 
     case InstId::c_slli64:
-      out << "c.slli64 " << intRegName(di.op0()) << ", " << di.op2();
+      out << "c.slli64 " << XReg{di.op0()} << ", " << di.op2();
       break;
 
     case InstId::c_fldsp:
-      out << "c.ldsp   " << intRegName(di.op0()) << ", 0x" << std::hex
-	  << di.op2As<int32_t>() << std::dec;
+      out << "c.ldsp   " << XReg{di.op0()} << ", 0x" << Hex(di.op2As<int32_t>());
       break;
 
     case InstId::c_lwsp:
-      out << "c.lwsp   " << intRegName(di.op0()) << ", 0x" << std::hex
-	  << di.op2As<int32_t>() << std::dec;
+      out << "c.lwsp   " << XReg{di.op0()} << ", 0x" << Hex(di.op2As<int32_t>());
       break;
 
     case InstId::c_flwsp:
-      out << "c.flwsp   " << fpRegName(di.op0()) << ", 0x" << std::hex
-	  << di.op2As<int32_t>() << std::dec;
+      out << "c.flwsp   " << FReg{di.op0()} << ", 0x" << Hex(di.op2As<int32_t>());
       break;
 
     case InstId::c_ldsp:
-      out << "c.ldsp   " << intRegName(di.op0()) << ", 0x" << std::hex
-	  << di.op2As<int32_t>() << std::dec;
+      out << "c.ldsp   " << XReg{di.op0()} << ", 0x" << Hex(di.op2As<int32_t>());
       break;
 
     case InstId::c_jr:
-      out << "c.jr     " << intRegName(di.op1());
+      out << "c.jr     " << XReg{di.op1()};
       break;
 
     case InstId::c_mv:
-      out << "c.mv     " << intRegName(di.op0()) << ", " << intRegName(di.op2());
+      out << "c.mv     " << XReg{di.op0()} << ", " << XReg{di.op2()};
       break;
 
     case InstId::c_ebreak:
@@ -1337,192 +1456,194 @@ Hart<URV>::disassembleInst(const DecodedInst& di, std::ostream& out)
       break;
 
     case InstId::c_jalr:
-      out << "c.jalr   " << intRegName(di.op1());
+      out << "c.jalr   " << XReg{di.op1()};
       break;
 
     case InstId::c_add:
-      out << "c.add    " << intRegName(di.op0()) << ", " << intRegName(di.op2());
+      out << "c.add    " << XReg{di.op0()} << ", " << XReg{di.op2()};
       break;
 
     case InstId::c_fsdsp:
-      out << "c.sdsp   " << fpRegName(di.op0())
-	  << ", 0x" << std::hex << di.op2As<int32_t>() << std::dec;
+      out << "c.sdsp   " << FReg{di.op0()}
+	  << ", 0x" << Hex(di.op2As<int32_t>());
       break;
 
     case InstId::c_swsp:
-      out << "c.swsp   " << intRegName(di.op0()) << ", 0x"
-	  << std::hex << di.op2As<int32_t>() << std::dec;
+      out << "c.swsp   " << XReg{di.op0()} << ", 0x"
+	  << Hex(di.op2As<int32_t>());
       break;
 
     case InstId::c_fswsp:
-      out << "c.swsp   " << fpRegName(di.op0()) << ", 0x"
-	  << std::hex << di.op2As<int32_t>() << std::dec;
+      out << "c.swsp   " << FReg{di.op0()} << ", 0x"
+	  << Hex(di.op2As<int32_t>());
       break;
 
     case InstId::c_addiw:
-      printRegImm(*this, out, "c.addiw", di.op0(), di.op2As<int32_t>());
+      printRegImm(out, "c.addiw", di.op0(), di.op2As<int32_t>());
       break;
 
     case InstId::c_sdsp:
-      out << "c.sdsp   " << intRegName(di.op0()) << ", 0x"
-	  << std::hex << di.op2As<int32_t>() << std::dec;
+      out << "c.sdsp   " << XReg{di.op0()} << ", 0x"
+	  << Hex(di.op2As<int32_t>());
       break;
 
     case InstId::clz:
-      printRdRs1(*this, out, "clz", di);
+      printRdRs1(out, "clz", di);
       break;
 
     case InstId::ctz:
-      printRdRs1(*this, out, "ctz", di);
+      printRdRs1(out, "ctz", di);
       break;
 
     case InstId::pcnt:
-      printRdRs1(*this, out, "pcnt", di);
+      printRdRs1(out, "pcnt", di);
       break;
 
     case InstId::andn:
-      printRdRs1Rs2(*this, out, "andn", di);
+      printRdRs1Rs2(out, "andn", di);
       break;
 
     case InstId::orn:
-      printRdRs1Rs2(*this, out, "orn", di);
+      printRdRs1Rs2(out, "orn", di);
       break;
 
     case InstId::xnor:
-      printRdRs1Rs2(*this, out, "xnor", di);
+      printRdRs1Rs2(out, "xnor", di);
       break;
 
     case InstId::slo:
-      printRdRs1Rs2(*this, out, "slo", di);
+      printRdRs1Rs2(out, "slo", di);
       break;
 
     case InstId::sro:
-      printRdRs1Rs2(*this, out, "sro", di);
+      printRdRs1Rs2(out, "sro", di);
       break;
 
     case InstId::sloi:
-      printShiftImm(*this, out, "sloi", di);
+      printShiftImm(out, "sloi", di);
       break;
 
     case InstId::sroi:
-      printShiftImm(*this, out, "sroi", di);
+      printShiftImm(out, "sroi", di);
       break;
 
     case InstId::min:
-      printRdRs1Rs2(*this, out, "min", di);
+      printRdRs1Rs2(out, "min", di);
       break;
 
     case InstId::max:
-      printRdRs1Rs2(*this, out, "max", di);
+      printRdRs1Rs2(out, "max", di);
       break;
 
     case InstId::minu:
-      printRdRs1Rs2(*this, out, "minu", di);
+      printRdRs1Rs2(out, "minu", di);
       break;
 
     case InstId::maxu:
-      printRdRs1Rs2(*this, out, "maxu", di);
+      printRdRs1Rs2(out, "maxu", di);
       break;
 
     case InstId::rol:
-      printRdRs1Rs2(*this, out, "rol", di);
+      printRdRs1Rs2(out, "rol", di);
       break;
 
     case InstId::ror:
-      printRdRs1Rs2(*this, out, "ror", di);
+      printRdRs1Rs2(out, "ror", di);
       break;
 
     case InstId::rori:
-      printShiftImm(*this, out, "rori", di);
+      printShiftImm(out, "rori", di);
       break;
 
     case InstId::rev8:
-      printRdRs1(*this, out, "rev8", di);
+      printRdRs1(out, "rev8", di);
       break;
 
     case InstId::rev:
-      printRdRs1(*this, out, "rev", di);
+      printRdRs1(out, "rev", di);
       break;
 
     case InstId::pack:
-      printRdRs1Rs2(*this, out, "pack", di);
+      printRdRs1Rs2(out, "pack", di);
       break;
 
     case InstId::orc_b:
-      printRdRs1(*this, out, "rev8", di);
+      printRdRs1(out, "rev8", di);
       break;
 
     case InstId::sbset:
-      printRdRs1Rs2(*this, out, "sbset", di);
+      printRdRs1Rs2(out, "sbset", di);
       break;
 
     case InstId::sbclr:
-      printRdRs1Rs2(*this, out, "sbclr", di);
+      printRdRs1Rs2(out, "sbclr", di);
       break;
 
     case InstId::sbinv:
-      printRdRs1Rs2(*this, out, "sbinv", di);
+      printRdRs1Rs2(out, "sbinv", di);
       break;
 
     case InstId::sbext:
-      printRdRs1Rs2(*this, out, "sbext", di);
+      printRdRs1Rs2(out, "sbext", di);
       break;
 
     case InstId::sbseti:
-      printShiftImm(*this, out, "sbseti", di);
+      printShiftImm(out, "sbseti", di);
       break;
 
     case InstId::sbclri:
-      printShiftImm(*this, out, "sbclri", di);
+      printShiftImm(out, "sbclri", di);
       break;
 
     case InstId::sbinvi:
-      printShiftImm(*this, out, "sbinvi", di);
+      printShiftImm(out, "sbinvi", di);
       break;
 
     case InstId::sbexti:
-      printShiftImm(*this, out, "sbexti", di);
+      printShiftImm(out, "sbexti", di);
       break;
 
     case InstId::bdep:
-      printRdRs1Rs2(*this, out, "bdep", di);
+      printRdRs1Rs2(out, "bdep", di);
       break;
 
     case InstId::bext:
-      printShiftImm(*this, out, "bext", di);
+      printShiftImm(out, "bext", di);
       break;
 
     case InstId::bfp:
-      printShiftImm(*this, out, "bfp", di);
+      printShiftImm(out, "bfp", di);
       break;
 
     case InstId::clmul:
-      printRdRs1Rs2(*this, out, "clmul", di);
+      printRdRs1Rs2(out, "clmul", di);
       break;
 
     case InstId::clmulh:
-      printRdRs1Rs2(*this, out, "clmulh", di);
+      printRdRs1Rs2(out, "clmulh", di);
       break;
 
     case InstId::clmulr:
-      printRdRs1Rs2(*this, out, "clmulr", di);
+      printRdRs1Rs2(out, "clmulr", di);
       break;
 
     case InstId::sh1add:
-      printRdRs1Rs2(*this, out, "sh1add", di);
+      printRdRs1Rs2(out, "sh1add", di);
       break;
 
     case InstId::sh2add:
-      printRdRs1Rs2(*this, out, "sh2add", di);
+      printRdRs1Rs2(out, "sh2add", di);
       break;
 
     case InstId::sh3add:
-      printRdRs1Rs2(*this, out, "sh3add", di);
+      printRdRs1Rs2(out, "sh3add", di);
       break;
 
     default:
       out << "illegal";
     }
+
+  return out.end() - buffer;
 }
 
 
@@ -1530,11 +1651,9 @@ template <typename URV>
 void
 Hart<URV>::disassembleInst(const DecodedInst& di, std::string& str)
 {
-  str.clear();
-
-  std::ostringstream oss;
-  disassembleInst(di, oss);
-  str = oss.str();
+  char buffer[128];
+  size_t len = disassembleInst(di, buffer, sizeof(buffer));
+  str.assign(buffer, len);
 }
 
 
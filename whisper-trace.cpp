@@ -0,0 +1,442 @@
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+// Copyright 2018 Western Digital Corporation or its affiliates.
+//
+// This program is free software: you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program. If not, see <https://www.gnu.org/licenses/>.
+//
+
+// Offline processing of binary instruction traces (see whisper
+// --tracebinary): Convert to the text format of whisper --logfile,
+// filter and summarize.
+
+#include <cinttypes>
+#include <iostream>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <optional>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <boost/program_options.hpp>
+#include "Hart.hpp"
+#include "Trace.hpp"
+
+
+using namespace WdRiscv;
+
+
+/// Hold values provided on the command line.
+struct Args
+{
+  std::string inFile;       // Binary trace file.
+  std::string outFile;      // Output file (standard output if empty).
+  std::string indexFile;    // Chunk index of input file.
+  std::string hartStr;      // Hart to keep.
+  std::string fromStr;      // Smallest tag to keep.
+  std::string toStr;        // Largest tag to keep.
+  std::string lowPcStr;     // Smallest pc to keep.
+  std::string highPcStr;    // Largest pc to keep.
+  unsigned top = 20;        // Number of mnemonics in summary.
+  bool summary = false;
+  bool binary = false;
+  bool abiNames = false;
+  bool help = false;
+
+  std::optional<uint64_t> hart, from, to, lowPc, highPc;
+};
+
+
+/// Convert given string to a number (decimal or 0x-prefixed
+/// hexadecimal) into value. Return true on success and false if
+/// string is not a number. No-op if string is empty.
+static
+bool
+parseNumber(const std::string& option, const std::string& str,
+	    std::optional<uint64_t>& value)
+{
+  if (str.empty())
+    return true;
+
+  char* end = nullptr;
+  uint64_t val = strtoull(str.c_str(), &end, 0);
+  if (end and *end)
+    {
+      std::cerr << "Invalid command line " << option << " value: " << str
+		<< '\n';
+      return false;
+    }
+  value = val;
+  return true;
+}
+
+
+/// Parse command line arguments into args. Return true on success and
+/// false on failure.
+static
+bool
+parseCmdLineArgs(int argc, char* argv[], Args& args)
+{
+  try
+    {
+      namespace po = boost::program_options;
+      po::options_description desc("options");
+      desc.add_options()
+	("help,h", po::bool_switch(&args.help),
+	 "Produce this message.")
+	("input,i", po::value(&args.inFile),
+	 "Binary trace file produced by whisper --tracebinary.")
+	("output,o", po::value(&args.outFile),
+	 "Write output to given file instead of standard output.")
+	("index", po::value(&args.indexFile),
+	 "Chunk index (see whisper --tracechunk) of the trace file: Start "
+	 "reading at the chunk containing the --from tag and stop at the "
+	 "first record past the --to tag instead of scanning the whole file. "
+	 "Text traces are supported (filtered by tag and hart) with an index.")
+	("summary,s", po::bool_switch(&args.summary),
+	 "Print a summary (record, change and instruction counts) of the "
+	 "selected records instead of the records.")
+	("binary,b", po::bool_switch(&args.binary),
+	 "Write the selected records in binary form instead of text.")
+	("hart", po::value(&args.hartStr),
+	 "Select only the records of the given hart.")
+	("from", po::value(&args.fromStr),
+	 "Select only the records with a tag (instruction rank) greater "
+	 "than or equal to the given value.")
+	("to", po::value(&args.toStr),
+	 "Select only the records with a tag less than or equal to the "
+	 "given value.")
+	("lowpc", po::value(&args.lowPcStr),
+	 "Select only the records with a pc greater than or equal to the "
+	 "given value.")
+	("highpc", po::value(&args.highPcStr),
+	 "Select only the records with a pc less than or equal to the "
+	 "given value.")
+	("top", po::value(&args.top),
+	 "Number of most frequent instructions listed in the summary.")
+	("abinames", po::bool_switch(&args.abiNames),
+	 "Use ABI register names (e.g. sp instead of x2) in disassembly.");
+
+      po::positional_options_description pdesc;
+      pdesc.add("input", 1);
+
+      po::variables_map varMap;
+      po::command_line_parser parser(argc, argv);
+      auto parsed = parser.options(desc).positional(pdesc).run();
+      po::store(parsed, varMap);
+      po::notify(varMap);
+
+      if (args.help)
+	{
+	  std::cout <<
+	    "Convert to text, filter or summarize a binary instruction trace\n"
+	    "produced by whisper --tracebinary (possibly gzip compressed or\n"
+	    "chunked, see --tracegzip and --tracechunk). Text output is identical to\n"
+	    "that of whisper --logfile. Numeric arguments are interpreted as\n"
+	    "hexadecimal numbers when prefixed with 0x. Examples:\n"
+	    "  whisper-trace trace.bin > trace.txt\n"
+	    "  whisper-trace --from 1000 --to 2000 --hart 1 trace.bin\n"
+	    "  whisper-trace --summary trace.bin\n"
+	    "  whisper-trace --index trace.gz.idx --from 5000000 --to 5000100 trace.gz\n\n";
+	  std::cout << desc;
+	  return true;
+	}
+    }
+  catch (std::exception& exp)
+    {
+      std::cerr << "Failed to parse command line args: " << exp.what() << '\n';
+      return false;
+    }
+
+  bool ok = parseNumber("--hart", args.hartStr, args.hart);
+  ok = parseNumber("--from", args.fromStr, args.from) and ok;
+  ok = parseNumber("--to", args.toStr, args.to) and ok;
+  ok = parseNumber("--lowpc", args.lowPcStr, args.lowPc) and ok;
+  ok = parseNumber("--highpc", args.highPcStr, args.highPc) and ok;
+
+  if (ok and args.inFile.empty())
+    {
+      std::cerr << "No trace file specified.\n";
+      ok = false;
+    }
+  return ok;
+}
+
+
+/// Return true if given record is selected by the command line
+/// filters.
+static
+bool
+isSelected(const Args& args, const TraceRecord& rec)
+{
+  if (args.hart and rec.hartId != *args.hart)
+    return false;
+  if (args.from and rec.tag < *args.from)
+    return false;
+  if (args.to and rec.tag > *args.to)
+    return false;
+  if (args.lowPc and rec.pc < *args.lowPc)
+    return false;
+  if (args.highPc and rec.pc > *args.highPc)
+    return false;
+  return true;
+}
+
+
+/// Statistics of the selected records.
+struct Summary
+{
+  uint64_t records = 0;
+  uint64_t minTag = ~uint64_t(0), maxTag = 0;
+  uint64_t intWrites = 0, fpWrites = 0, csrWrites = 0, memWrites = 0;
+  uint64_t interrupts = 0, compressed = 0;
+  std::map<unsigned, uint64_t> hartCounts;
+  std::map<std::string, uint64_t> instCounts;  // Mnemonic to count.
+  std::map<uint32_t, std::string> names;       // Opcode to mnemonic cache.
+};
+
+
+template <typename URV>
+static
+void
+addToSummary(Hart<URV>& hart, const TraceRecord& rec, Summary& summary)
+{
+  summary.records++;
+  summary.minTag = std::min(summary.minTag, rec.tag);
+  summary.maxTag = std::max(summary.maxTag, rec.tag);
+  summary.hartCounts[rec.hartId]++;
+  if (rec.intReg > 0)    summary.intWrites++;
+  if (rec.fpReg >= 0)    summary.fpWrites++;
+  if (rec.memSize)       summary.memWrites++;
+  if (rec.interrupted)   summary.interrupts++;
+  if (rec.instSize == 2) summary.compressed++;
+  summary.csrWrites += rec.csrCount;
+
+  auto iter = summary.names.find(rec.inst);
+  if (iter == summary.names.end())
+    {
+      uint32_t op0 = 0, op1 = 0, op2 = 0, op3 = 0;
+      const InstEntry& entry = hart.decode(rec.inst, op0, op1, op2, op3);
+      iter = summary.names.insert({rec.inst, entry.name()}).first;
+    }
+  summary.instCounts[iter->second]++;
+}
+
+
+static
+void
+printSummary(FILE* out, const Summary& summary, unsigned top)
+{
+  fprintf(out, "Records: %" PRIu64 "\n", summary.records);
+  if (summary.records == 0)
+    return;
+
+  fprintf(out, "Tags: %" PRIu64 " to %" PRIu64 "\n", summary.minTag,
+	  summary.maxTag);
+  for (const auto& [hartId, count] : summary.hartCounts)
+    fprintf(out, "Hart %u: %" PRIu64 " records\n", hartId, count);
+  fprintf(out, "Compressed instructions: %" PRIu64 "\n", summary.compressed);
+  fprintf(out, "Interrupted instructions: %" PRIu64 "\n", summary.interrupts);
+  fprintf(out, "Integer register writes: %" PRIu64 "\n", summary.intWrites);
+  fprintf(out, "FP register writes: %" PRIu64 "\n", summary.fpWrites);
+  fprintf(out, "CSR writes: %" PRIu64 "\n", summary.csrWrites);
+  fprintf(out, "Memory writes: %" PRIu64 "\n", summary.memWrites);
+
+  std::vector< std::pair<std::string, uint64_t> > counts;
+  counts.assign(summary.instCounts.begin(), summary.instCounts.end());
+  std::stable_sort(counts.begin(), counts.end(),
+		   [](const auto& a, const auto& b) {
+		     return a.second > b.second;
+		   });
+  if (counts.size() > top)
+    counts.resize(top);
+
+  fprintf(out, "Most frequent instructions:\n");
+  for (const auto& [name, count] : counts)
+    fprintf(out, "  %-12s %" PRIu64 " %.2f%%\n", name.c_str(), count,
+	    100.0 * double(count) / double(summary.records));
+}
+
+
+/// Copy to the given output file the lines of the given text trace
+/// selected by the hart and tag filters stopping at the first record
+/// past the --to tag. Return true on success and false on failure.
+static
+bool
+processTextTrace(const Args& args, gzFile in, FILE* out)
+{
+  if (args.summary or args.binary or args.lowPc or args.highPc)
+    {
+      std::cerr << "Only the --from, --to and --hart filters apply to a "
+		<< "text trace\n";
+      return false;
+    }
+
+  char line[4096];
+  while (gzgets(in, line, sizeof(line)))
+    {
+      uint64_t tag = 0;
+      unsigned hartId = 0;
+      if (sscanf(line, "#%" SCNu64 " %u", &tag, &hartId) != 2)
+	continue;
+      if (args.to and tag > *args.to)
+	break;
+      if (args.from and tag < *args.from)
+	continue;
+      if (args.hart and hartId != *args.hart)
+	continue;
+      fputs(line, out);
+    }
+  return true;
+}
+
+
+/// Process the records of the given reader writing them (in text or
+/// binary form) or their summary to the given output file. Use a hart
+/// of the register width of the trace for disassembly. If stopPastTo
+/// is true, stop at the first record past the --to tag. Return true
+/// on success and false on failure.
+template <typename URV>
+static
+bool
+processTrace(const Args& args, BinaryTraceReader& reader, FILE* out,
+	     bool stopPastTo)
+{
+  // Disassembly only needs a hart configured with the ISA of the trace.
+  Memory memory(64*1024, 4*1024);
+  Hart<URV> hart(0, memory, 32);
+  hart.enableAbiNames(args.abiNames);
+
+  URV isa = reader.isa();
+  URV mask = 0, pokeMask = 0;
+  bool implemented = true, isDebug = false, shared = true;
+  if (isa and not hart.configCsr("misa", implemented, isa, mask, pokeMask,
+				 isDebug, shared))
+    {
+      std::cerr << "Failed to configure MISA CSR\n";
+      return false;
+    }
+  hart.reset();
+
+  std::unique_ptr<BinaryTraceWriter> writer;
+  if (args.binary and not args.summary)
+    writer = std::make_unique<BinaryTraceWriter>(out, reader.xlen(), isa);
+
+  Summary summary;
+  TraceRecord rec;
+  std::string text;
+  bool error = false;
+  while (reader.read(rec, error))
+    {
+      if (stopPastTo and args.to and rec.tag > *args.to)
+	break;
+      if (not isSelected(args, rec))
+	continue;
+
+      if (args.summary)
+	addToSummary(hart, rec, summary);
+      else if (writer)
+	writer->write(rec);
+      else
+	{
+	  hart.disassembleInst(rec.inst, text);
+	  printTraceRecord(out, rec, text.c_str(), reader.xlen());
+	}
+    }
+
+  if (error)
+    {
+      std::cerr << "Corrupt trace record in file " << args.inFile << '\n';
+      return false;
+    }
+
+  if (args.summary)
+    printSummary(out, summary, args.top);
+  return true;
+}
+
+
+int
+main(int argc, char* argv[])
+{
+  Args args;
+  if (not parseCmdLineArgs(argc, argv, args))
+    return 1;
+  if (args.help)
+    return 0;
+
+  TraceIndex index;
+  bool indexed = not args.indexFile.empty();
+  if (indexed and not index.read(args.indexFile))
+    return 1;
+
+  // Position the input at the chunk containing the --from tag.
+  uint64_t offset = 0;
+  if (indexed and args.from)
+    offset = index.findOffset(*args.from);
+
+  int fd = open(args.inFile.c_str(), O_RDONLY);
+  gzFile in = nullptr;
+  if (fd >= 0 and lseek(fd, offset, SEEK_SET) == off_t(offset))
+    in = gzdopen(fd, "rb");
+  if (not in)
+    {
+      std::cerr << "Failed to open trace file '" << args.inFile
+		<< "' for input\n";
+      if (fd >= 0)
+	close(fd);
+      return 1;
+    }
+  gzbuffer(in, 256*1024);
+
+  BinaryTraceReader reader(in);
+  bool binary = not indexed or index.binary;
+  if (binary)
+    {
+      if (offset != 0)
+	reader.setFormat(index.xlen, index.isa);
+      else if (not reader.readHeader())
+	{
+	  std::cerr << "File " << args.inFile << " is not a binary trace file\n";
+	  gzclose(in);
+	  return 1;
+	}
+    }
+
+  FILE* out = stdout;
+  if (not args.outFile.empty())
+    {
+      out = fopen(args.outFile.c_str(), "w");
+      if (not out)
+	{
+	  std::cerr << "Failed to open file '" << args.outFile
+		    << "' for output\n";
+	  gzclose(in);
+	  return 1;
+	}
+    }
+
+  bool ok = false;
+  if (not binary)
+    ok = processTextTrace(args, in, out);
+  else if (reader.xlen() == 32)
+    ok = processTrace<uint32_t>(args, reader, out, indexed);
+  else
+    ok = processTrace<uint64_t>(args, reader, out, indexed);
+
+  if (out != stdout)
+    fclose(out);
+  gzclose(in);
+  return ok? 0 : 1;
+}
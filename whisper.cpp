@@ -20,6 +20,7 @@
 #include <fstream>
 #include <sstream>
 #include <thread>
+#include <atomic>
 #include <experimental/filesystem>
 #include <boost/program_options.hpp>
 #include <boost/algorithm/string.hpp>
@@ -35,12 +36,20 @@ typedef int socklen_t;
 #else
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
+#include <fcntl.h>
 #endif
 
 #include <csignal>
+#include <sys/time.h>
 #include "HartConfig.hpp"
 #include "WhisperMessage.h"
+#include "WhisperShm.h"
 #include "Hart.hpp"
 #include "Server.hpp"
 #include "Interactive.hpp"
@@ -164,6 +173,10 @@ struct Args
   std::string commandLogFile;  // Log of interactive or socket commands.
   std::string consoleOutFile;  // Console io output file.
   std::string serverFile;      // File in which to write server host and port.
+  std::string shmServerName;   // Shared memory object name of shm server.
+  std::string unixServerPath;  // Unix-domain socket path of server.
+  std::string binCommandLogFile; // Binary log of interactive/socket commands.
+  std::string replayBinFile;   // Binary command log to replay.
   std::string instFreqFile;    // Instruction frequency file.
   std::string configFile;      // Configuration (JSON) file.
   std::string isa;
@@ -173,6 +186,8 @@ struct Args
   std::string stderrFile;      // Redirect target program stderr to this. 
   StringVec   zisa;
   StringVec   regInits;        // Initial values of regs
+  StringVec   tracePcs;        // Traced pc ranges (low:high).
+  StringVec   traceFuncs;      // Traced functions (ELF symbols).
   StringVec   targets;         // Target (ELF file) programs and associated
                                // program options to be loaded into simulator
                                // memory. Each target plus args is one string.
@@ -192,6 +207,8 @@ struct Args
   std::optional<uint64_t> memorySize;
   std::optional<uint64_t> snapshotPeriod;
   std::optional<uint64_t> alarmInterval;
+  std::optional<uint64_t> traceStart;  // Rank of first traced instruction.
+  std::optional<uint64_t> traceStop;   // Rank of last traced instruction.
   
   unsigned regWidth = 32;
   unsigned harts = 1;
@@ -214,6 +231,27 @@ struct Args
   bool raw = false;       // True if bare-metal program (no linux no newlib).
   bool fastExt = false;    // True if fast external interrupt dispatch enabled.
   bool unmappedElfOk = false;
+  bool logPerHart = false; // True if each hart traces to its own file.
+  bool traceBinary = false; // True if trace is in binary form.
+  bool traceAsync = false;  // True if trace is written by a background thread.
+  bool traceGzip = false;   // True if trace is gzip compressed.
+  bool traceDrop = false;   // Drop async trace records when ring is full.
+  unsigned traceRingSize = 8192;  // Async trace ring size (records per hart).
+  uint64_t traceChunk = 0;  // Compressed trace chunk size (instructions).
+  bool traceTrigger = false;  // Trace start/stop controlled by triggers.
+  bool traceColumns = false;  // True if trace is in columnar form.
+  unsigned flightRecorder = 0;   // Flight recorder size (instructions).
+  uint64_t flightExceptions = 0; // Dump flight recorder at this count.
+  std::string flightFile;        // Flight recorder dump file.
+  std::string traceStream;       // FIFO or Unix socket trace consumer.
+  unsigned traceStreamBatch = 64*1024;  // Trace stream batch (bytes).
+  bool compactFrame = false; // True if server messages use compact framing.
+  bool connPerHart = false;  // True if server accepts a connection per hart.
+
+  std::string forkServerPath; // Unix-domain socket path of fork server.
+  std::string manifestFile;  // Manifest of tests to run (regression farm).
+  std::string reportFile;    // Manifest run report (JSON or JUnit XML).
+  unsigned jobs = 0;         // Manifest run threads (0: one per core).
 
   // Expand each target program string into program name and args.
   void expandTargets();
@@ -287,6 +325,20 @@ collectCommandLineValues(const boost::program_options::variables_map& varMap,
 	ok = false;
     }
 
+  if (varMap.count("tracestart"))
+    {
+      auto numStr = varMap["tracestart"].as<std::string>();
+      if (not parseCmdLineNumber("tracestart", numStr, args.traceStart))
+	ok = false;
+    }
+
+  if (varMap.count("tracestop"))
+    {
+      auto numStr = varMap["tracestop"].as<std::string>();
+      if (not parseCmdLineNumber("tracestop", numStr, args.traceStop))
+	ok = false;
+    }
+
   if (varMap.count("memorysize"))
     {
       auto numStr = varMap["memorysize"].as<std::string>();
@@ -342,6 +394,12 @@ collectCommandLineValues(const boost::program_options::variables_map& varMap,
   if (args.interactive)
     args.trace = true;  // Enable instruction tracing in interactive mode.
 
+  if (args.connPerHart and not args.shmServerName.empty())
+    {
+      std::cerr << "Option --connperhart cannot be used with --shmserver\n";
+      ok = false;
+    }
+
   return ok;
 }
 
@@ -384,12 +442,123 @@ parseCmdLineArgs(int argc, char* argv[], Args& args)
 	 "HEX file to load into simulator memory.")
 	("logfile,f", po::value(&args.traceFile),
 	 "Enable tracing to given file of executed instructions.")
+	("logperhart", po::bool_switch(&args.logPerHart),
+	 "In a multi-hart batch run, trace each hart to its own file: Hart n "
+	 "traces to <logfile>.<n> where <logfile> is the --logfile path.")
+	("tracebinary", po::bool_switch(&args.traceBinary),
+	 "Write the instruction trace (see --logfile and --logperhart) in "
+	 "compact binary form. Use the whisper-trace tool to convert it to "
+	 "text, filter it or summarize it.")
+	("traceasync", po::bool_switch(&args.traceAsync),
+	 "Disassemble, format and write the instruction trace on a background "
+	 "thread: Each hart pushes its trace records into a bounded ring "
+	 "(see --traceringsize).")
+	("traceringsize", po::value(&args.traceRingSize),
+	 "Capacity in records of the ring of each hart in --traceasync mode. "
+	 "Default: 8192.")
+	("tracedrop", po::bool_switch(&args.traceDrop),
+	 "In --traceasync mode, drop trace records when the ring of a hart is "
+	 "full instead of stalling the hart until the ring has room.")
+	("tracegzip", po::bool_switch(&args.traceGzip),
+	 "Compress the instruction trace with gzip. Implies --traceasync: "
+	 "Compression is done on the background thread.")
+	("tracechunk", po::value(&args.traceChunk),
+	 "Compress the --logfile trace in independent gzip chunks, a chunk "
+	 "starting at each multiple of the given instruction count, and write "
+	 "a chunk index to <logfile>.idx allowing tools to start reading at "
+	 "any chunk. Implies --tracegzip.")
+	("tracecolumns", po::bool_switch(&args.traceColumns),
+	 "Write the instruction trace (see --logfile and --logperhart) in "
+	 "columnar form for bulk analysis: pc, instruction id, destination "
+	 "register and value, data address and size, and hart columns, each "
+	 "compressed separately, in row groups following a schema header. "
+	 "Overrides the other trace format options.")
+	("tracestream", po::value(&args.traceStream),
+	 "Stream the instruction trace in binary form (see --tracebinary) to "
+	 "a consumer reading from the given named pipe or listening on the "
+	 "given Unix-domain socket. Records are formatted and written by a "
+	 "background thread (see --traceasync): A slow consumer stalls the "
+	 "harts unless --tracedrop is used. Not compatible with --logfile.")
+	("tracestreambatch", po::value(&args.traceStreamBatch),
+	 "Size in bytes of the batches written to the --tracestream consumer. "
+	 "Pending records are also written whenever the harts are not "
+	 "producing. Default: 65536.")
+	("tracestart", po::value<std::string>(),
+	 "Trace only the instructions with a rank (trace tag) greater than or "
+	 "equal to the given count. Instructions before the trace window are "
+	 "executed in fast (no trace) mode.")
+	("tracestop", po::value<std::string>(),
+	 "Trace only the instructions with a rank (trace tag) less than or "
+	 "equal to the given count. Instructions after the trace window are "
+	 "executed in fast (no trace) mode.")
+	("tracepc", po::value(&args.tracePcs)->multitoken(),
+	 "Trace only the instructions with a pc in the given range(s) "
+	 "(inclusive bounds). Example: --tracepc 0x1000:0x10ff 0x2000:0x20ff")
+	("tracefunc", po::value(&args.traceFuncs)->multitoken(),
+	 "Trace only the instructions of the given function(s) (ELF symbols). "
+	 "Combines with --tracepc.")
+	("tracetrigger", po::bool_switch(&args.traceTrigger),
+	 "Start with the instruction trace turned off and turn it on/off when "
+	 "a trigger with a start-trace/stop-trace action trips (such triggers "
+	 "do not cause breakpoints). Has no effect unless triggers are enabled.")
+	("flightrecorder", po::value(&args.flightRecorder),
+	 "Keep the changes (pc, opcode, register and memory) of the last n "
+	 "executed instructions of each hart, including in fast (no trace) "
+	 "mode, and print them in the --logfile format when the run fails "
+	 "(failed stop or non-zero exit), on a keyboard interrupt, or when the "
+	 "--flightexceptions limit is reached.")
+	("flightfile", po::value(&args.flightFile),
+	 "Print the --flightrecorder instructions to the given file instead of "
+	 "the standard error stream.")
+	("flightexceptions", po::value(&args.flightExceptions),
+	 "Print the --flightrecorder instructions of a hart once the number "
+	 "of exceptions taken by the hart reaches the given count.")
 	("consoleoutfile", po::value(&args.consoleOutFile),
 	 "Redirect console output to given file.")
 	("commandlog", po::value(&args.commandLogFile),
 	 "Enable logging of interactive/socket commands to the given file.")
+	("bincommandlog", po::value(&args.binCommandLogFile),
+	 "Enable logging of interactive/socket commands to the given file "
+	 "in binary form (serialized server requests) for use with "
+	 "--replaybin.")
+	("replaybin", po::value(&args.replayBinFile),
+	 "Execute the commands recorded in the given binary command log "
+	 "(see --bincommandlog) then exit.")
 	("server", po::value(&args.serverFile),
 	 "Interactive server mode. Put server hostname and port in file.")
+	("shmserver", po::value(&args.shmServerName),
+	 "Interactive server mode using a POSIX shared memory object with the "
+	 "given name (e.g. /whisper) instead of a socket. See WhisperShm.h.")
+	("unixserver", po::value(&args.unixServerPath),
+	 "Interactive server mode listening on a Unix-domain socket bound to "
+	 "the given path instead of a TCP socket.")
+	("compactframe", po::bool_switch(&args.compactFrame),
+	 "In server mode, precede each message by its length and omit the "
+	 "buffer and tag fields when they are not used. See WhisperMessage.h.")
+	("connperhart", po::bool_switch(&args.connPerHart),
+	 "In socket server mode, accept one connection per hart and serve "
+	 "each connection in its own thread so that harts step in parallel. "
+	 "Each connection drives the hart targeted by its first request "
+	 "which must not be driven by another connection.")
+	("forkserver", po::value(&args.forkServerPath),
+	 "Fork-server mode: Load the program files given on the command line "
+	 "(if any) then listen on a Unix-domain socket bound to the given path. "
+	 "For each connection, read a line of whisper command line arguments "
+	 "and fork a child that applies them (e.g. loads a test ELF file) and "
+	 "runs. The child replies with a line holding pass or fail and the "
+	 "executed instruction count. A quit line stops the server.")
+	("manifest", po::value(&args.manifestFile),
+	 "Run the tests listed in the given file (one per line: pass or fail "
+	 "for the expected outcome followed by the whisper command line "
+	 "arguments of the test) in this process using a pool of threads, "
+	 "each test with its own harts and memory. Other command line "
+	 "arguments are ignored except for --configfile, --jobs and --report.")
+	("jobs", po::value(&args.jobs),
+	 "Number of threads running the tests of a --manifest run. Default is "
+	 "the number of processor cores.")
+	("report", po::value(&args.reportFile),
+	 "Write the results of a --manifest run to the given file: JUnit XML "
+	 "if the file name ends with .xml and JSON otherwise.")
 	("startpc,s", po::value<std::string>(),
 	 "Set program entry point. If not specified, use entry point of the "
 	 "most recently loaded ELF file.")
@@ -516,6 +685,31 @@ parseCmdLineArgs(int argc, char* argv[], Args& args)
 }
 
 
+/// Parse the given string of white-space separated command line
+/// arguments (no quoting) into args and expand the target programs.
+/// Return true on success and false on failure.
+static
+bool
+parseArgsString(const std::string& str, Args& args)
+{
+  std::vector<std::string> tokens;
+  boost::split(tokens, str, boost::is_any_of(" \t"),
+	       boost::token_compress_on);
+  std::vector<char*> argv;
+  std::string progName = "whisper";
+  argv.push_back(progName.data());
+  for (auto& token : tokens)
+    if (not token.empty())
+      argv.push_back(token.data());
+  argv.push_back(nullptr);
+
+  if (not parseCmdLineArgs(int(argv.size() - 1), argv.data(), args))
+    return false;
+  args.expandTargets();
+  return true;
+}
+
+
 /// Apply register initializations specified on the command line.
 template<typename URV>
 static
@@ -711,6 +905,62 @@ applyIsaString(const std::string& isaStr, Hart<URV>& hart)
 
 /// Enable linux or newlib based on the symbols in the ELF files.
 /// Return true if either is enabled.
+/// Apply the trace window/filter command line arguments (--tracestart,
+/// --tracestop, --tracepc, --tracefunc and --tracetrigger) to the given
+/// hart. Return true on success and false on failure.
+template<typename URV>
+static
+bool
+applyCmdLineTraceFilters(const Args& args, Hart<URV>& hart)
+{
+  bool ok = true;
+
+  if (args.traceStart or args.traceStop)
+    {
+      uint64_t begin = args.traceStart? *args.traceStart : 0;
+      uint64_t end = args.traceStop? *args.traceStop : ~uint64_t(0);
+      if (begin > end)
+	{
+	  std::cerr << "Trace start (" << begin << ") greater than trace stop ("
+		    << end << ")\n";
+	  ok = false;
+	}
+      hart.setTraceInstWindow(begin, end);
+    }
+
+  for (const auto& range : args.tracePcs)
+    {
+      // Each range is a string of the form low:high.
+      std::vector<std::string> tokens;
+      boost::split(tokens, range, boost::is_any_of(":"),
+		   boost::token_compress_on);
+      URV low = 0, high = 0;
+      if (tokens.size() != 2 or
+	  not parseCmdLineNumber("tracepc", tokens.at(0), low) or
+	  not parseCmdLineNumber("tracepc", tokens.at(1), high) or low > high)
+	{
+	  std::cerr << "Invalid command line trace pc range: " << range << '\n';
+	  ok = false;
+	  continue;
+	}
+      hart.addTracePcRange(low, high);
+    }
+
+  for (const auto& func : args.traceFuncs)
+    if (not hart.addTraceFunction(func))
+      {
+	std::cerr << "Trace function " << func << " not found in ELF "
+		  << "file(s)\n";
+	ok = false;
+      }
+
+  if (args.traceTrigger)
+    hart.enableTraceTriggers(true);
+
+  return ok;
+}
+
+
 template<typename URV>
 static
 bool
@@ -949,6 +1199,9 @@ applyCmdLineArgs(const Args& args, Hart<URV>& hart)
   if (not applyCmdLineRegInit(args, hart))
     errors++;
 
+  if (not applyCmdLineTraceFilters(args, hart))
+    errors++;
+
   if (args.expandedTargets.empty())
     return errors == 0;
 
@@ -980,15 +1233,102 @@ applyCmdLineArgs(const Args& args, Hart<URV>& hart)
 }
 
 
+/// Accept count connections on the given listening socket and
+/// service the requests of the connected test-bench(es). With more
+/// than one connection (one per hart), service each connection in its
+/// own thread so that harts step in parallel: Each connection is
+/// bound to the target hart of its first request (see
+/// Server::interact) and its requests for other harts are rejected. Set TCP_NODELAY on the connections if tcp is true.
+/// Return true on success and false on failure.
+template <typename URV>
+static
+bool
+serveConnections(std::vector<Hart<URV>*>& harts, int soc, unsigned count,
+		 bool tcp, FILE* traceFile, FILE* commandLog, FILE* binaryLog,
+		 bool compact)
+{
+  std::vector<int> socs;
+  for (unsigned i = 0; i < count; ++i)
+    {
+      int newSoc = accept(soc, nullptr, nullptr);
+      if (newSoc < 0)
+	{
+	  perror("Socket accept failed");
+	  for (int s : socs)
+	    close(s);
+	  return false;
+	}
+      socs.push_back(newSoc);
+
+      // Messages are small and each waits for a reply: Do not let
+      // Nagle hold them back.
+      int one = 1;
+      if (tcp and setsockopt(newSoc, IPPROTO_TCP, TCP_NODELAY,
+			     (const char*) &one, sizeof(one)) < 0)
+	perror("Failed to set TCP_NODELAY on socket");
+    }
+
+  bool ok = true;
+
+  try
+    {
+      Server<URV> server(harts);
+      server.enableCompactFraming(compact);
+      server.setBinaryCommandLog(binaryLog);
+
+      if (socs.size() == 1)
+	ok = server.interact(socs.front(), traceFile, commandLog);
+      else
+	{
+	  // Serve each connection in its own thread.
+	  std::vector<std::thread> threadVec;
+	  std::atomic<bool> result = true;
+	  auto threadFunc = [&server, &result, traceFile, commandLog]
+	                    (int s) {
+			      bool r = false;
+			      try
+				{
+				  r = server.interact(s, traceFile, commandLog,
+						      true);
+				}
+			      catch(...)
+				{
+				}
+			      if (not r)
+				result = false;
+			    };
+
+	  for (int s : socs)
+	    threadVec.emplace_back(std::thread(threadFunc, s));
+
+	  for (auto& t : threadVec)
+	    t.join();
+
+	  ok = result;
+	}
+    }
+  catch(...)
+    {
+      ok = false;
+    }
+
+  for (int s : socs)
+    close(s);
+
+  return ok;
+}
+
+
 /// Open a server socket and put opened socket information (hostname
-/// and port number) in the given server file. Wait for one
-/// connection. Service connection. Return true on success and false
+/// and port number) in the given server file. Wait for connCount
+/// connections. Service connections. Return true on success and false
 /// on failure.
 template <typename URV>
 static
 bool
 runServer(std::vector<Hart<URV>*>& harts, const std::string& serverFile,
-	  FILE* traceFile, FILE* commandLog)
+	  unsigned connCount, FILE* traceFile, FILE* commandLog,
+	  FILE* binaryLog, bool compact)
 {
   char hostName[1024];
   if (gethostname(hostName, sizeof(hostName)) != 0)
@@ -1023,7 +1363,7 @@ runServer(std::vector<Hart<URV>*>& harts, const std::string& serverFile,
       return false;
     }
 
-  if (listen(soc, 1) < 0)
+  if (listen(soc, connCount) < 0)
     {
       perror("Socket listen failed");
       return false;
@@ -1049,31 +1389,228 @@ runServer(std::vector<Hart<URV>*>& harts, const std::string& serverFile,
     out << hostName << ' ' << ntohs(socAddr.sin_port) << std::endl;
   }
 
-  sockaddr_in clientAddr;
-  socklen_t clientAddrSize = sizeof(clientAddr);
-  int newSoc = accept(soc, (sockaddr*) & clientAddr, &clientAddrSize);
-  if (newSoc < 0)
+  bool ok = serveConnections(harts, soc, connCount, true, traceFile,
+			     commandLog, binaryLog, compact);
+
+  close(soc);
+
+  return ok;
+}
+
+
+#ifndef __MINGW64__
+
+/// Create a Unix-domain socket bound to the given path (replacing any
+/// stale socket file) and listening with the given backlog. Return
+/// the socket or -1 on failure.
+static
+int
+listenUnixSocket(const std::string& path, unsigned backlog)
+{
+  sockaddr_un serverAddr;
+  memset(&serverAddr, 0, sizeof(serverAddr));
+  serverAddr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(serverAddr.sun_path))
+    {
+      std::cerr << "Unix-domain socket path too long: " << path << '\n';
+      return -1;
+    }
+  strncpy(serverAddr.sun_path, path.c_str(), sizeof(serverAddr.sun_path) - 1);
+
+  int soc = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (soc < 0)
+    {
+      perror("Failed to create socket");
+      return -1;
+    }
+
+  unlink(path.c_str());  // Remove stale socket file from a previous run.
+
+  if (bind(soc, (sockaddr*) &serverAddr, sizeof(serverAddr)) < 0)
+    {
+      perror("Socket bind failed");
+      close(soc);
+      return -1;
+    }
+
+  if (listen(soc, backlog) < 0)
     {
-      perror("Socket accept failed");
+      perror("Socket listen failed");
+      close(soc);
+      unlink(path.c_str());
+      return -1;
+    }
+
+  return soc;
+}
+
+#endif
+
+
+/// Open for writing the given named pipe (waiting for a reader) or
+/// connect to the Unix-domain socket at the given path. Return an
+/// unbuffered file (writes go straight to the consumer) or null on
+/// failure.
+static
+FILE*
+openTraceStream(const std::string& path)
+{
+#ifdef __MINGW64__
+  std::cerr << "Trace streaming (" << path << ") is not supported on this "
+	    << "platform\n";
+  return nullptr;
+#else
+  struct stat info;
+  if (stat(path.c_str(), &info) != 0)
+    {
+      std::cerr << "Trace stream '" << path << "' does not exist\n";
+      return nullptr;
+    }
+
+  int fd = -1;
+  if (S_ISFIFO(info.st_mode))
+    {
+      fd = open(path.c_str(), O_WRONLY);
+      if (fd < 0)
+	perror("Failed to open trace stream pipe");
+    }
+  else if (S_ISSOCK(info.st_mode))
+    {
+      sockaddr_un addr;
+      memset(&addr, 0, sizeof(addr));
+      addr.sun_family = AF_UNIX;
+      if (path.size() >= sizeof(addr.sun_path))
+	{
+	  std::cerr << "Unix-domain socket path too long: " << path << '\n';
+	  return nullptr;
+	}
+      strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+      fd = socket(AF_UNIX, SOCK_STREAM, 0);
+      if (fd >= 0 and connect(fd, (sockaddr*) &addr, sizeof(addr)) < 0)
+	{
+	  perror("Failed to connect to trace stream socket");
+	  close(fd);
+	  fd = -1;
+	}
+    }
+  else
+    std::cerr << "Trace stream '" << path << "' is neither a named pipe "
+	      << "nor a Unix-domain socket\n";
+
+  if (fd < 0)
+    return nullptr;
+
+  // A consumer going away must not kill the simulator: Let the write
+  // fail instead.
+  signal(SIGPIPE, SIG_IGN);
+
+  FILE* file = fdopen(fd, "w");
+  if (not file)
+    {
+      close(fd);
+      return nullptr;
+    }
+  setvbuf(file, nullptr, _IONBF, 0);
+  return file;
+#endif
+}
+
+
+/// Listen on a Unix-domain socket bound to the given path, accept
+/// connCount connections from the test-bench and service their
+/// requests. Remove
+/// the socket file when done. Return true on success and false on
+/// failure.
+template <typename URV>
+static
+bool
+runUnixServer(std::vector<Hart<URV>*>& harts, const std::string& path,
+	      unsigned connCount, FILE* traceFile, FILE* commandLog,
+	      FILE* binaryLog, bool compact)
+{
+#ifdef __MINGW64__
+  std::cerr << "Unix-domain server mode (" << path << ") is not supported "
+	    << "on this platform\n";
+  return false;
+#else
+  int soc = listenUnixSocket(path, connCount);
+  if (soc < 0)
+    return false;
+
+  bool ok = serveConnections(harts, soc, connCount, false, traceFile,
+			     commandLog, binaryLog, compact);
+
+  close(soc);
+  unlink(path.c_str());
+
+  return ok;
+#endif
+}
+
+
+/// Create a POSIX shared memory object with the given name holding a
+/// WhisperShmRegion (see WhisperShm.h) and service the test-bench
+/// requests posted to it. Remove the object when done. Return true on
+/// success and false on failure.
+template <typename URV>
+static
+bool
+runShmServer(std::vector<Hart<URV>*>& harts, const std::string& name,
+	     FILE* traceFile, FILE* commandLog, FILE* binaryLog, bool compact)
+{
+#ifdef __linux__
+  int fd = shm_open(name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0600);
+  if (fd < 0)
+    {
+      perror("Failed to create shared memory object");
       return false;
     }
 
+  size_t size = sizeof(WhisperShmRegion);
+  if (ftruncate(fd, size) != 0)
+    {
+      perror("Failed to size shared memory object");
+      close(fd);
+      shm_unlink(name.c_str());
+      return false;
+    }
+
+  void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED)
+    {
+      perror("Failed to map shared memory object");
+      close(fd);
+      shm_unlink(name.c_str());
+      return false;
+    }
+
+  auto region = static_cast<WhisperShmRegion*>(addr);
+  whisperShmInit(region);
+
   bool ok = true;
 
   try
     {
       Server<URV> server(harts);
-      ok = server.interact(newSoc, traceFile, commandLog);
+      server.enableCompactFraming(compact);
+      server.setBinaryCommandLog(binaryLog);
+      ok = server.interact(*region, traceFile, commandLog);
     }
   catch(...)
     {
       ok = false;
     }
 
-  close(newSoc);
-  close(soc);
+  munmap(addr, size);
+  close(fd);
+  shm_unlink(name.c_str());
 
   return ok;
+#else
+  std::cerr << "Shared memory server mode (" << name << ") is supported "
+	    << "only on Linux\n";
+  return false;
+#endif
 }
 
 
@@ -1096,15 +1633,31 @@ reportInstructionFrequency(Hart<URV>& hart, const std::string& outPath)
 }
 
 
+/// Return true if each hart is to trace to its own file. This is
+/// only done in multi-hart batch runs where harts run in separate
+/// threads: In interactive, replay and server modes harts share one
+/// trace file (with --connperhart, harts stepped from separate server
+/// threads serialize their writes to that file).
+static
+bool
+isTracePerHart(const Args& args)
+{
+  return (args.logPerHart and args.harts > 1 and not args.traceFile.empty()
+	  and not args.interactive and args.serverFile.empty()
+	  and args.shmServerName.empty() and args.unixServerPath.empty()
+	  and args.replayBinFile.empty());
+}
+
+
 /// Open the trace-file, command-log and console-output files
 /// specified on the command line. Return true if successful or false
 /// if any specified file fails to open.
 static
 bool
 openUserFiles(const Args& args, FILE*& traceFile, FILE*& commandLog,
-	      FILE*& consoleOut)
+	      FILE*& binaryLog, FILE*& consoleOut)
 {
-  if (not args.traceFile.empty())
+  if (not args.traceFile.empty() and not isTracePerHart(args))
     {
       traceFile = fopen(args.traceFile.c_str(), "w");
       if (not traceFile)
@@ -1132,6 +1685,17 @@ openUserFiles(const Args& args, FILE*& traceFile, FILE*& commandLog,
       setlinebuf(commandLog);  // Make line-buffered.
     }
 
+  if (not args.binCommandLogFile.empty())
+    {
+      binaryLog = fopen(args.binCommandLogFile.c_str(), "wb");
+      if (not binaryLog or not writeBinaryLogHeader(binaryLog))
+	{
+	  std::cerr << "Failed to open binary command log file '"
+		    << args.binCommandLogFile << "' for output\n";
+	  return false;
+	}
+    }
+
   if (not args.consoleOutFile.empty())
     {
       consoleOut = fopen(args.consoleOutFile.c_str(), "w");
@@ -1147,10 +1711,52 @@ openUserFiles(const Args& args, FILE*& traceFile, FILE*& commandLog,
 }
 
 
+/// Open one trace file per hart (see isTracePerHart) placing the
+/// file of hart n in the nth entry of hartTraceFiles. The trace file
+/// of hart n is named <logfile>.<n>. Return true if successful or
+/// false if any file fails to open. No-op if not tracing per hart.
+static
+bool
+openHartTraceFiles(const Args& args, std::vector<FILE*>& hartTraceFiles)
+{
+  if (not isTracePerHart(args))
+    return true;
+
+  for (unsigned i = 0; i < args.harts; ++i)
+    {
+      std::string path = args.traceFile + "." + std::to_string(i);
+      FILE* file = fopen(path.c_str(), "w");
+      if (not file)
+	{
+	  std::cerr << "Failed to open trace file '" << path
+		    << "' for output\n";
+	  return false;
+	}
+      // Unlike the shared trace file, a per-hart file is written by a
+      // single thread and is left fully buffered.
+      hartTraceFiles.push_back(file);
+    }
+
+  return true;
+}
+
+
+/// Counterpart to openHartTraceFiles: Close any open per-hart trace file.
+static
+void
+closeHartTraceFiles(std::vector<FILE*>& hartTraceFiles)
+{
+  for (auto file : hartTraceFiles)
+    fclose(file);
+  hartTraceFiles.clear();
+}
+
+
 /// Counterpart to openUserFiles: Close any open user file.
 static
 void
-closeUserFiles(FILE*& traceFile, FILE*& commandLog, FILE*& consoleOut)
+closeUserFiles(FILE*& traceFile, FILE*& commandLog, FILE*& binaryLog,
+	       FILE*& consoleOut)
 {
   if (consoleOut and consoleOut != stdout)
     fclose(consoleOut);
@@ -1163,6 +1769,10 @@ closeUserFiles(FILE*& traceFile, FILE*& commandLog, FILE*& consoleOut)
   if (commandLog and commandLog != stdout)
     fclose(commandLog);
   commandLog = nullptr;
+
+  if (binaryLog)
+    fclose(binaryLog);
+  binaryLog = nullptr;
 }
 
 
@@ -1175,9 +1785,12 @@ kbdInterruptHandler(int)
 }
 
 
+/// Run the given harts to completion. If hartTraceFiles is not empty,
+/// hart n traces to the nth file in hartTraceFiles instead of traceFile.
 template <typename URV>
 static bool
-batchRun(std::vector<Hart<URV>*>& harts, FILE* traceFile)
+batchRun(std::vector<Hart<URV>*>& harts, FILE* traceFile,
+	 const std::vector<FILE*>& hartTraceFiles = {})
 {
   if (harts.empty())
     return true;
@@ -1198,13 +1811,16 @@ batchRun(std::vector<Hart<URV>*>& harts, FILE* traceFile)
 
   bool result = true;
 
-  auto threadFunc = [&traceFile, &result] (Hart<URV>* hart) {
-		      bool r = hart->run(traceFile);
+  auto threadFunc = [&result] (Hart<URV>* hart, FILE* out) {
+		      bool r = hart->run(out);
 		      result = result and r;
 		    };
 
-  for (auto hartPtr : harts)
-    threadVec.emplace_back(std::thread(threadFunc, hartPtr));
+  for (size_t i = 0; i < harts.size(); ++i)
+    {
+      FILE* out = hartTraceFiles.empty() ? traceFile : hartTraceFiles.at(i);
+      threadVec.emplace_back(std::thread(threadFunc, harts.at(i), out));
+    }
 
   for (auto& t : threadVec)
     t.join();
@@ -1273,29 +1889,427 @@ snapshotRun(std::vector<Hart<URV>*>& harts, FILE* traceFile,
 }
 
 
+/// Direct the harts to write their instruction traces in binary form
+/// (see BinaryTraceWriter): One writer is created for the shared trace
+/// file or, if tracing per hart, for each per-hart trace file. Writers
+/// are placed in the writers vector and flush on destruction.
+template <typename URV>
+static
+void
+setupBinaryTrace(std::vector<Hart<URV>*>& harts, FILE* traceFile,
+		 const std::vector<FILE*>& hartTraceFiles,
+		 std::vector< std::unique_ptr<BinaryTraceWriter> >& writers)
+{
+  URV isa = 0;
+  harts.at(0)->peekCsr(CsrNumber::MISA, isa);
+  unsigned xlen = sizeof(URV)*8;
+
+  if (not hartTraceFiles.empty())
+    {
+      for (size_t i = 0; i < harts.size(); ++i)
+	{
+	  FILE* file = hartTraceFiles.at(i);
+	  writers.push_back(std::make_unique<BinaryTraceWriter>(file, xlen, isa));
+	  harts.at(i)->setBinaryTraceWriter(writers.back().get());
+	}
+      return;
+    }
+
+  if (not traceFile)
+    return;
+
+  writers.push_back(std::make_unique<BinaryTraceWriter>(traceFile, xlen, isa));
+  for (auto hartPtr : harts)
+    hartPtr->setBinaryTraceWriter(writers.back().get());
+}
+
+
+/// Direct the harts to write their instruction traces in columnar form
+/// (see ColumnTraceWriter): One writer is created for the shared trace
+/// file or, if tracing per hart, for each per-hart trace file. Writers
+/// are placed in the writers vector and flush on destruction.
+template <typename URV>
+static
+void
+setupColumnTrace(std::vector<Hart<URV>*>& harts, FILE* traceFile,
+		 const std::vector<FILE*>& hartTraceFiles,
+		 std::vector< std::unique_ptr<ColumnTraceWriter> >& writers)
+{
+  if (not hartTraceFiles.empty())
+    {
+      for (size_t i = 0; i < harts.size(); ++i)
+	{
+	  FILE* file = hartTraceFiles.at(i);
+	  writers.push_back(std::make_unique<ColumnTraceWriter>(file));
+	  harts.at(i)->setColumnTraceWriter(writers.back().get());
+	}
+      return;
+    }
+
+  if (not traceFile)
+    return;
+
+  writers.push_back(std::make_unique<ColumnTraceWriter>(traceFile));
+  for (auto hartPtr : harts)
+    hartPtr->setColumnTraceWriter(writers.back().get());
+}
+
+
+/// Direct the harts to write their instruction traces through an
+/// asynchronous tracer (see AsyncTracer) created in the tracer
+/// parameter: One tracer output is defined for the shared trace file
+/// or, if tracing per hart, for each per-hart trace file (the chunk
+/// index of trace file x, if any, is x.idx). Return true on success
+/// and false on failure.
+template <typename URV>
+static
+bool
+setupAsyncTrace(std::vector<Hart<URV>*>& harts, const Args& args,
+		FILE* traceFile, const std::vector<FILE*>& hartTraceFiles,
+		std::unique_ptr<AsyncTracer>& tracer)
+{
+  if (not traceFile and hartTraceFiles.empty())
+    return true;
+
+  URV isa = 0;
+  harts.at(0)->peekCsr(CsrNumber::MISA, isa);
+  unsigned xlen = sizeof(URV)*8;
+
+  bool block = not args.traceDrop;
+  tracer = std::make_unique<AsyncTracer>(args.traceRingSize, block);
+
+  // A trace stream is always binary.
+  bool binary = args.traceBinary or not args.traceStream.empty();
+  bool compress = args.traceGzip or args.traceChunk;
+  if (args.traceChunk and args.traceFile.empty())
+    {
+      std::cerr << "Option --tracechunk requires --logfile\n";
+      return false;
+    }
+
+  int shared = -1;
+  if (hartTraceFiles.empty())
+    {
+      std::string indexPath = args.traceFile + ".idx";
+      shared = tracer->addOutput(traceFile, binary, compress, xlen, isa,
+				 args.traceChunk, indexPath);
+      if (shared < 0)
+	{
+	  std::cerr << "Failed to set up trace output\n";
+	  return false;
+	}
+      if (not args.traceStream.empty())
+	tracer->setOutputBatch(shared, args.traceStreamBatch);
+    }
+
+  for (size_t i = 0; i < harts.size(); ++i)
+    {
+      Hart<URV>* hart = harts.at(i);
+      int output = shared;
+      std::string indexPath = args.traceFile + "." + std::to_string(i) + ".idx";
+      if (output < 0)
+	output = tracer->addOutput(hartTraceFiles.at(i), binary, compress,
+				   xlen, isa, args.traceChunk, indexPath);
+      if (output < 0)
+	{
+	  std::cerr << "Failed to set up trace output\n";
+	  return false;
+	}
+
+      // Disassembly only reads the (configured) decoder state of the
+      // hart. It is memoized in a cache private to the tracer thread.
+      auto cache = std::make_shared<DisasCache>();
+      auto disas = [hart, cache](const TraceRecord& rec, std::string& text) {
+	bool hit = false;
+	std::string& cached = cache->slot(rec.pc, rec.inst, hit);
+	if (not hit)
+	  {
+	    DecodedInst di;
+	    hart->decode(URV(rec.pc), rec.inst, di);
+	    hart->disassembleInst(di, cached);
+	  }
+	text = cached;
+      };
+      unsigned source = tracer->addSource(output, xlen, disas);
+      hart->setAsyncTracer(tracer.get(), source);
+    }
+
+  tracer->start();
+  return true;
+}
+
+
+/// Trace outputs created by setupTrace. They must outlive the run:
+/// Writers and tracer flush on destruction, the tracer before the
+/// trace stream (declared first) is closed.
+struct TraceOutputs
+{
+  std::unique_ptr<FILE, int(*)(FILE*)> stream{nullptr, fclose};
+  std::unique_ptr<FILE, int(*)(FILE*)> flightFile{nullptr, fclose};
+  std::unique_ptr<AsyncTracer> asyncTracer;
+  std::vector< std::unique_ptr<BinaryTraceWriter> > binaryTraces;
+  std::vector< std::unique_ptr<ColumnTraceWriter> > columnTraces;
+};
+
+
+/// Set up the trace form (stream, columnar, asynchronous, compressed,
+/// chunked or binary) and the flight recorder of the harts according
+/// to the command line args placing the created outputs in the
+/// outputs parameter. Replace traceFile by the trace stream if one is
+/// requested. Return true on success and false on failure.
+template <typename URV>
+static
+bool
+setupTrace(std::vector<Hart<URV>*>& harts, const Args& args,
+	   FILE*& traceFile, const std::vector<FILE*>& hartTraceFiles,
+	   TraceOutputs& outputs)
+{
+  // A trace stream replaces the trace file.
+  if (not args.traceStream.empty())
+    {
+      if (traceFile or not hartTraceFiles.empty())
+	{
+	  std::cerr << "Option --tracestream is not compatible with "
+		    << "--logfile\n";
+	  return false;
+	}
+      outputs.stream.reset(openTraceStream(args.traceStream));
+      if (not outputs.stream)
+	return false;
+      traceFile = outputs.stream.get();
+    }
+
+  if (outputs.stream)
+    {
+      if (not setupAsyncTrace(harts, args, traceFile, hartTraceFiles,
+			      outputs.asyncTracer))
+	return false;
+    }
+  else if (args.traceColumns)
+    setupColumnTrace(harts, traceFile, hartTraceFiles, outputs.columnTraces);
+  else if (args.traceAsync or args.traceGzip or args.traceChunk)
+    {
+      if (not setupAsyncTrace(harts, args, traceFile, hartTraceFiles,
+			      outputs.asyncTracer))
+	return false;
+    }
+  else if (args.traceBinary)
+    setupBinaryTrace(harts, traceFile, hartTraceFiles, outputs.binaryTraces);
+
+  if (args.flightRecorder)
+    {
+      if (not args.flightFile.empty())
+	{
+	  outputs.flightFile.reset(fopen(args.flightFile.c_str(), "w"));
+	  if (not outputs.flightFile)
+	    {
+	      std::cerr << "Failed to open flight recorder file '"
+			<< args.flightFile << "' for output\n";
+	      return false;
+	    }
+	}
+      for (auto hartPtr : harts)
+	{
+	  hartPtr->enableFlightRecorder(args.flightRecorder,
+					outputs.flightFile.get());
+	  if (args.flightExceptions)
+	    hartPtr->setFlightRecorderExceptionLimit(args.flightExceptions);
+	}
+    }
+
+  return true;
+}
+
+
+/// Fork-server mode (see --forkserver): Listen on a Unix-domain socket
+/// bound to the given path. For each connection, read a line of
+/// command line arguments and fork a child that applies them to the
+/// harts (already holding the base program, if any), runs them and
+/// replies with "pass <count>" or "fail <count>" where count is the
+/// number of executed instructions. The parent does not wait for the
+/// children: Tests may run concurrently. Return when a "quit" line is
+/// received (true) or on failure (false).
+template <typename URV>
+static
+bool
+runForkServer(std::vector<Hart<URV>*>& harts, const std::string& path)
+{
+#ifdef __MINGW64__
+  std::cerr << "Fork-server mode (" << path << ") is not supported "
+	    << "on this platform\n";
+  return false;
+#else
+  int soc = listenUnixSocket(path, 64);
+  if (soc < 0)
+    return false;
+
+  // Children are reaped automatically.
+  signal(SIGCHLD, SIG_IGN);
+
+  bool ok = true;
+
+  while (true)
+    {
+      int conn = accept(soc, nullptr, nullptr);
+      if (conn < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+	  perror("Socket accept failed");
+	  ok = false;
+	  break;
+	}
+
+      // Read request line.
+      std::string line;
+      char c = 0;
+      while (line.size() < 64*1024 and read(conn, &c, 1) == 1 and c != '\n')
+	line += c;
+      boost::algorithm::trim(line);
+
+      if (line == "quit")
+	{
+	  close(conn);
+	  break;
+	}
+
+      // Flush before forking so that buffered output is not duplicated.
+      fflush(stdout);
+      fflush(stderr);
+
+      pid_t pid = fork();
+      if (pid < 0)
+	{
+	  perror("Fork failed");
+	  close(conn);
+	  continue;
+	}
+
+      if (pid > 0)
+	{
+	  close(conn);  // Parent: Child owns the connection.
+	  continue;
+	}
+
+      // Child: Apply the per-test arguments and run.
+      close(soc);
+      signal(SIGCHLD, SIG_DFL);
+
+      bool passed = false;
+      Args args;
+      FILE* traceFile = nullptr;
+      FILE* commandLog = nullptr;
+      FILE* binaryLog = nullptr;
+      FILE* consoleOut = stdout;
+      std::vector<FILE*> hartTraceFiles;
+      bool parsed = parseArgsString(line, args);
+      args.harts = unsigned(harts.size());  // Harts are those of the server.
+      if (parsed and
+	  openUserFiles(args, traceFile, commandLog, binaryLog, consoleOut) and
+	  openHartTraceFiles(args, hartTraceFiles))
+	{
+	  passed = true;
+	  for (auto hartPtr : harts)
+	    {
+	      hartPtr->setConsoleOutput(consoleOut);
+	      passed = applyCmdLineArgs(args, *hartPtr) and passed;
+	    }
+
+	  // Trace outputs are flushed before the reply is sent. A trace
+	  // stream replaces out, not the trace file closed below.
+	  FILE* out = traceFile;
+	  TraceOutputs traceOutputs;
+	  passed = (passed and
+		    setupTrace(harts, args, out, hartTraceFiles,
+			       traceOutputs) and
+		    batchRun(harts, out, hartTraceFiles));
+	}
+
+      uint64_t count = 0;
+      for (auto hartPtr : harts)
+	count += hartPtr->getInstructionCount();
+
+      std::string reply = (passed? "pass " : "fail ") + std::to_string(count);
+      reply += '\n';
+      if (write(conn, reply.data(), reply.size()) < 0)
+	perror("Fork-server reply failed");
+      close(conn);
+
+      closeHartTraceFiles(hartTraceFiles);
+      closeUserFiles(traceFile, commandLog, binaryLog, consoleOut);
+      fflush(stdout);
+      fflush(stderr);
+      _exit(passed? 0 : 1);
+    }
+
+  close(soc);
+  unlink(path.c_str());
+  return ok;
+#endif
+}
+
+
 /// Depending on command line args, start a server, run in interactive
 /// mode, or initiate a batch run.
 template <typename URV>
 static
 bool
 sessionRun(std::vector<Hart<URV>*>& harts, const Args& args, FILE* traceFile,
-	   FILE* commandLog)
+	   FILE* commandLog, FILE* binaryLog,
+	   const std::vector<FILE*>& hartTraceFiles)
 {
   for (auto hartPtr : harts)
     if (not applyCmdLineArgs(args, *hartPtr))
       if (not args.interactive)
 	return false;
 
-  bool serverMode = not args.serverFile.empty();
-  if (serverMode or args.interactive)
+  if (not args.forkServerPath.empty())
+    return runForkServer(harts, args.forkServerPath);
+
+  // Trace outputs must outlive the run.
+  TraceOutputs traceOutputs;
+  if (not setupTrace(harts, args, traceFile, hartTraceFiles, traceOutputs))
+    return false;
+
+  bool serverMode = ( not args.serverFile.empty() or
+		     not args.shmServerName.empty() or
+		     not args.unixServerPath.empty() );
+  bool replayMode = not args.replayBinFile.empty();
+  if (serverMode or replayMode or args.interactive)
     for (auto hartPtr : harts)
       {
 	hartPtr->enableTriggers(true);
 	hartPtr->enablePerformanceCounters(true);
       }
 
+  if (replayMode)
+    {
+      FILE* file = fopen(args.replayBinFile.c_str(), "rb");
+      if (not file)
+	{
+	  std::cerr << "Failed to open binary command log file '"
+		    << args.replayBinFile << "' for input\n";
+	  return false;
+	}
+      Server<URV> server(harts);
+      bool ok = server.replay(file, traceFile, commandLog);
+      fclose(file);
+      return ok;
+    }
+
   if (serverMode)
-    return runServer(harts, args.serverFile, traceFile, commandLog);
+    {
+      bool compact = args.compactFrame;
+      unsigned connCount = args.connPerHart? harts.size() : 1;
+      if (not args.shmServerName.empty())
+	return runShmServer(harts, args.shmServerName, traceFile, commandLog,
+			    binaryLog, compact);
+      if (not args.unixServerPath.empty())
+	return runUnixServer(harts, args.unixServerPath, connCount,
+			     traceFile, commandLog, binaryLog, compact);
+      return runServer(harts, args.serverFile, connCount, traceFile,
+		       commandLog, binaryLog, compact);
+    }
 
   if (args.interactive)
     {
@@ -1312,6 +2326,7 @@ sessionRun(std::vector<Hart<URV>*>& harts, const Args& args, FILE* traceFile,
 #endif
 
       Interactive interactive(harts);
+      interactive.setBinaryCommandLog(binaryLog);
       return interactive.interact(traceFile, commandLog);
     }
 
@@ -1324,14 +2339,15 @@ sessionRun(std::vector<Hart<URV>*>& harts, const Args& args, FILE* traceFile,
       std::cerr << "Warning: Snapshots not supported for multi-thread runs\n";
     }
 
-  return batchRun(harts, traceFile);
+  return batchRun(harts, traceFile, hartTraceFiles);
 }
 
 
 template <typename URV>
 static
 bool
-session(const Args& args, const HartConfig& config)
+session(const Args& args, const HartConfig& config,
+	uint64_t* instCount = nullptr)
 {
   unsigned registerCount = 32;
   unsigned hartCount = args.harts;
@@ -1382,7 +2398,7 @@ session(const Args& args, const HartConfig& config)
     harts.at(i)->copyMemRegionConfig(*harts.at(0));
 
   if (args.hexFiles.empty() and args.expandedTargets.empty()
-      and not args.interactive)
+      and not args.interactive and args.forkServerPath.empty())
     {
       std::cerr << "No program file specified.\n";
       return false;
@@ -1390,9 +2406,21 @@ session(const Args& args, const HartConfig& config)
 
   FILE* traceFile = nullptr;
   FILE* commandLog = nullptr;
+  FILE* binaryLog = nullptr;
   FILE* consoleOut = stdout;
-  if (not openUserFiles(args, traceFile, commandLog, consoleOut))
-    return false;
+  if (not openUserFiles(args, traceFile, commandLog, binaryLog, consoleOut))
+    {
+      closeUserFiles(traceFile, commandLog, binaryLog, consoleOut);
+      return false;
+    }
+
+  std::vector<FILE*> hartTraceFiles;
+  if (not openHartTraceFiles(args, hartTraceFiles))
+    {
+      closeHartTraceFiles(hartTraceFiles);
+      closeUserFiles(traceFile, commandLog, binaryLog, consoleOut);
+      return false;
+    }
 
   for (auto hartPtr : harts)
     {
@@ -1400,7 +2428,12 @@ session(const Args& args, const HartConfig& config)
       hartPtr->reset();
     }
 
-  bool result = sessionRun(harts, args, traceFile, commandLog);
+  bool result = sessionRun(harts, args, traceFile, commandLog, binaryLog,
+			   hartTraceFiles);
+
+  if (instCount)
+    for (auto hartPtr : harts)
+      *instCount += hartPtr->getInstructionCount();
 
   if (not args.instFreqFile.empty())
     {
@@ -1408,7 +2441,8 @@ session(const Args& args, const HartConfig& config)
       result = reportInstructionFrequency(hart0, args.instFreqFile) and result;
     }
 
-  closeUserFiles(traceFile, commandLog, consoleOut);
+  closeHartTraceFiles(hartTraceFiles);
+  closeUserFiles(traceFile, commandLog, binaryLog, consoleOut);
 
   return result;
 }
@@ -1466,6 +2500,273 @@ determineRegisterWidth(const Args& args, const HartConfig& config)
 }
 
 
+/// A test of a manifest run (see --manifest) and its outcome.
+struct ManifestTest
+{
+  std::string name;          // First target/hex file of the test.
+  std::string command;       // Command line arguments of the test.
+  bool expectPass = true;
+  bool valid = false;        // True if command line arguments are valid.
+  bool passed = false;       // True if the run succeeded.
+  uint64_t instCount = 0;
+  double seconds = 0;
+};
+
+
+/// Read the manifest file with the given path placing the tests in
+/// the given vector. Return true on success and false on failure.
+static
+bool
+readManifest(const std::string& path, std::vector<ManifestTest>& tests)
+{
+  std::ifstream in(path);
+  if (not in.good())
+    {
+      std::cerr << "Failed to open manifest file '" << path << "' for input\n";
+      return false;
+    }
+
+  unsigned errors = 0;
+  std::string line;
+  for (unsigned lineNum = 1; std::getline(in, line); ++lineNum)
+    {
+      boost::algorithm::trim(line);
+      if (line.empty() or line.front() == '#')
+	continue;
+
+      ManifestTest test;
+      size_t pos = line.find_first_of(" \t");
+      std::string expect = line.substr(0, pos);
+      if (expect != "pass" and expect != "fail")
+	{
+	  std::cerr << "File " << path << ", line " << lineNum << ": Expecting "
+		    << "pass or fail at beginning of line\n";
+	  errors++;
+	  continue;
+	}
+      test.expectPass = expect == "pass";
+      if (pos != std::string::npos)
+	test.command = boost::algorithm::trim_copy(line.substr(pos));
+      test.name = "line" + std::to_string(lineNum);
+      tests.push_back(test);
+    }
+
+  return errors == 0;
+}
+
+
+/// Run the given manifest test using the given configuration unless
+/// the test specifies its own. Set the outcome fields of the test.
+static
+void
+runManifestTest(ManifestTest& test, const HartConfig& config)
+{
+  Args args;
+  if (not parseArgsString(test.command, args))
+    return;
+
+  if (not args.expandedTargets.empty())
+    test.name = args.expandedTargets.front().front();
+  else if (not args.hexFiles.empty())
+    test.name = args.hexFiles.front();
+
+  HartConfig testConfig;
+  if (not args.configFile.empty())
+    if (not testConfig.loadConfigFile(args.configFile))
+      return;
+  const HartConfig& conf = args.configFile.empty()? config : testConfig;
+
+  test.valid = true;
+
+  struct timeval t0;
+  gettimeofday(&t0, nullptr);
+
+  try
+    {
+      unsigned regWidth = determineRegisterWidth(args, conf);
+      if (regWidth == 32)
+	test.passed = session<uint32_t>(args, conf, &test.instCount);
+      else if (regWidth == 64)
+	test.passed = session<uint64_t>(args, conf, &test.instCount);
+      else
+	test.valid = false;
+    }
+  catch (std::exception& e)
+    {
+      std::cerr << e.what() << '\n';
+      test.passed = false;
+    }
+
+  struct timeval t1;
+  gettimeofday(&t1, nullptr);
+  test.seconds = (double(t1.tv_sec - t0.tv_sec) +
+		  double(t1.tv_usec - t0.tv_usec)*1e-6);
+}
+
+
+/// Return the given string with the characters that are special in
+/// XML (xml true) or in a JSON string (xml false) escaped.
+static
+std::string
+escapeReportString(const std::string& str, bool xml)
+{
+  std::string result;
+  for (char c : str)
+    {
+      if (xml and c == '<')
+	result += "&lt;";
+      else if (xml and c == '>')
+	result += "&gt;";
+      else if (xml and c == '&')
+	result += "&amp;";
+      else if (xml and c == '"')
+	result += "&quot;";
+      else if (not xml and (c == '"' or c == '\\'))
+	{
+	  result += '\\';
+	  result += c;
+	}
+      else
+	result += c;
+    }
+  return result;
+}
+
+
+/// Write the results of the given manifest tests to the given file in
+/// JUnit XML form if the file name ends with .xml and in JSON form
+/// otherwise. Return true on success and false on failure.
+static
+bool
+writeManifestReport(const std::string& path,
+		    const std::vector<ManifestTest>& tests, double seconds)
+{
+  std::ofstream out(path);
+  if (not out.good())
+    {
+      std::cerr << "Failed to open report file '" << path << "' for output\n";
+      return false;
+    }
+
+  unsigned failures = 0;
+  for (const auto& test : tests)
+    if (not test.valid or test.passed != test.expectPass)
+      failures++;
+
+  bool xml = boost::algorithm::ends_with(path, ".xml");
+
+  if (xml)
+    {
+      out << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+	  << "<testsuite name=\"whisper\" tests=\"" << tests.size()
+	  << "\" failures=\"" << failures << "\" time=\"" << seconds << "\">\n";
+      for (const auto& test : tests)
+	{
+	  double mips = test.seconds > 0? test.instCount / test.seconds * 1e-6 : 0;
+	  out << "  <testcase name=\"" << escapeReportString(test.name, true)
+	      << "\" time=\"" << test.seconds << "\">\n";
+	  if (not test.valid)
+	    out << "    <error message=\"invalid test command\"/>\n";
+	  else if (test.passed != test.expectPass)
+	    out << "    <failure message=\"expected "
+		<< (test.expectPass? "pass" : "fail") << "\"/>\n";
+	  out << "    <system-out>command: "
+	      << escapeReportString(test.command, true)
+	      << " instructions: " << test.instCount
+	      << " mips: " << mips << "</system-out>\n"
+	      << "  </testcase>\n";
+	}
+      out << "</testsuite>\n";
+    }
+  else
+    {
+      out << "{\n  \"tests\": " << tests.size() << ",\n  \"failures\": "
+	  << failures << ",\n  \"seconds\": " << seconds
+	  << ",\n  \"results\": [\n";
+      for (size_t i = 0; i < tests.size(); ++i)
+	{
+	  const auto& test = tests.at(i);
+	  double mips = test.seconds > 0? test.instCount / test.seconds * 1e-6 : 0;
+	  const char* status = "pass";
+	  if (not test.valid)
+	    status = "error";
+	  else if (test.passed != test.expectPass)
+	    status = "fail";
+	  out << "    { \"name\": \"" << escapeReportString(test.name, false)
+	      << "\", \"command\": \"" << escapeReportString(test.command, false)
+	      << "\", \"expected\": \"" << (test.expectPass? "pass" : "fail")
+	      << "\", \"status\": \"" << status
+	      << "\", \"instructions\": " << test.instCount
+	      << ", \"seconds\": " << test.seconds
+	      << ", \"mips\": " << mips << " }"
+	      << (i + 1 < tests.size()? ",\n" : "\n");
+	}
+      out << "  ]\n}\n";
+    }
+
+  return out.good();
+}
+
+
+/// Run the tests of the manifest file specified on the command line
+/// (see --manifest) in this process using a pool of threads. Each
+/// test gets its own harts and memory. The configuration file given on
+/// the command line is parsed once and shared by the tests (unless a
+/// test specifies its own). Return true if all the tests have their
+/// expected outcome and false otherwise.
+static
+bool
+runManifest(const Args& args, const HartConfig& config)
+{
+  std::vector<ManifestTest> tests;
+  if (not readManifest(args.manifestFile, tests))
+    return false;
+
+  unsigned jobs = args.jobs;
+  if (jobs == 0)
+    jobs = std::max(1u, std::thread::hardware_concurrency());
+
+  struct timeval t0;
+  gettimeofday(&t0, nullptr);
+
+  // Each thread repeatedly picks the next test to run.
+  std::atomic<size_t> next = 0;
+  auto threadFunc = [&tests, &next, &config] () {
+		      for (size_t i = next++; i < tests.size(); i = next++)
+			runManifestTest(tests.at(i), config);
+		    };
+
+  std::vector<std::thread> threadVec;
+  for (unsigned i = 0; i < jobs and i < tests.size(); ++i)
+    threadVec.emplace_back(std::thread(threadFunc));
+  for (auto& t : threadVec)
+    t.join();
+
+  struct timeval t1;
+  gettimeofday(&t1, nullptr);
+  double seconds = (double(t1.tv_sec - t0.tv_sec) +
+		    double(t1.tv_usec - t0.tv_usec)*1e-6);
+
+  unsigned failures = 0;
+  uint64_t instCount = 0;
+  for (const auto& test : tests)
+    {
+      instCount += test.instCount;
+      if (not test.valid or test.passed != test.expectPass)
+	failures++;
+    }
+
+  std::cout << "Ran " << tests.size() << " tests in " << seconds << " s ("
+	    << (seconds > 0? instCount / seconds * 1e-6 : 0) << " MIPS): "
+	    << failures << " unexpected outcome(s)\n";
+
+  bool ok = failures == 0;
+  if (not args.reportFile.empty())
+    ok = writeManifestReport(args.reportFile, tests, seconds) and ok;
+  return ok;
+}
+
+
 int
 main(int argc, char* argv[])
 {
@@ -1485,6 +2786,9 @@ main(int argc, char* argv[])
     if (not config.loadConfigFile(args.configFile))
       return 1;
 
+  if (not args.manifestFile.empty())
+    return runManifest(args, config)? 0 : 1;
+
   unsigned regWidth = determineRegisterWidth(args, config);
 
   bool ok = true;